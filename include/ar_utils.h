@@ -13,10 +13,13 @@
 namespace ar_utils {
 
 /**
- * @brief Creates a new Aruco marker and saves it to a file
+ * @brief Creates a new Aruco marker from dictionary, markerSize pixels wide,
+ * and saves it to a file
  */
 void
-createArucoMarker(int markerId);
+createArucoMarker(int markerId,
+                  const cv::aruco::Dictionary& dictionary,
+                  int markerSize);
 
 /**
  * @brief Loads the camera parameters found in filePath to calibrate the camera
@@ -35,22 +38,29 @@ void
 printBorder();
 
 /**
- * @brief Saves a screenshot of the current frame
+ * @brief Saves a screenshot of the current frame. suffix is appended to the
+ * timestamped file name, e.g. to tell cameras apart.
  */
 void
-screenshot(cv::Mat& frame);
+screenshot(cv::Mat& frame, std::string suffix = "");
 
 /**
- * @brief Load images from a given directory into a vector of Mats
+ * @brief Returns true if the file extension is a video container
  */
-std::vector<cv::Mat>
-loadImagesFromDirectory(std::string path);
+bool
+isVideoFile(const std::string& path);
+
+/**
+ * @brief Returns true if the file extension is an image format imread reads
+ */
+bool
+isImageFile(const std::string& path);
 
 /**
  * @brief Set the coordinates for the ArUco marker
  */
 cv::Mat
-setCoordinateSystem(int markerSize);
+setCoordinateSystem(float markerLength);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: C interface to the engine, for host applications that are not
+ * built with the same C++ compiler and OpenCV. Frames stay owned by the host
+ * and are composited where they are.
+ */
+
+#include <stddef.h>
+
+#ifndef AUGMUSEUM_H
+#define AUGMUSEUM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief One engine with its own paintings and cameras. Contexts are
+ * independent of each other; each is used from one thread at a time.
+ */
+typedef struct augmuseum_context augmuseum_context;
+
+/**
+ * @brief Layout of a frame's pixels. BGR24 frames are composited in place
+ * without a copy; BGRA32 frames go through a BGR copy and keep their alpha.
+ */
+typedef enum augmuseum_format
+{
+  AUGMUSEUM_FORMAT_BGR24 = 0,
+  AUGMUSEUM_FORMAT_BGRA32 = 1
+} augmuseum_format;
+
+/**
+ * @brief A frame owned by the caller. stride is the number of bytes from one
+ * row to the next. timestamp is when it was captured in seconds of
+ * cv::getTickCount() time, or 0 for now.
+ */
+typedef struct augmuseum_frame
+{
+  unsigned char* data;
+  int width;
+  int height;
+  size_t stride;
+  augmuseum_format format;
+  double timestamp;
+} augmuseum_frame;
+
+/**
+ * @brief What a context loads. Paths left NULL use the defaults of the
+ * command line program; painting_index NULL turns off recognition without
+ * markers.
+ */
+typedef struct augmuseum_options
+{
+  const char* painting_directory;
+  const char* detector_config;
+  const char* board_file;
+  const char* painting_index;
+  int handle_occlusion;
+  int yuv420_paintings;
+} augmuseum_options;
+
+/**
+ * @brief A marker found in the last frame of a camera. corners are x, y pairs
+ * clockwise from the top-left.
+ */
+typedef struct augmuseum_marker
+{
+  int id;
+  float corners[8];
+} augmuseum_marker;
+
+/**
+ * @brief Fills options with the defaults
+ */
+void
+augmuseum_default_options(augmuseum_options* options);
+
+/**
+ * @brief Loads the paintings and detector settings of options (the defaults
+ * if NULL). Returns NULL on failure.
+ */
+augmuseum_context*
+augmuseum_create(const augmuseum_options* options);
+
+void
+augmuseum_destroy(augmuseum_context* context);
+
+/**
+ * @brief Adds a camera with the calibration in calibration_file. name labels
+ * its metrics. Returns its index, or -1 on failure.
+ */
+int
+augmuseum_add_camera(augmuseum_context* context,
+                     const char* name,
+                     const char* calibration_file);
+
+int
+augmuseum_exhibit_count(const augmuseum_context* context);
+
+/**
+ * @brief Makes the exhibit at index the one drawn. Returns -1 on failure.
+ */
+int
+augmuseum_select_exhibit(augmuseum_context* context, int index);
+
+/**
+ * @brief Detects markers in a frame seen by camera and draws the current
+ * exhibit onto them, in the frame's own buffer. The buffer is not kept after
+ * the call. Returns 1 if anything was drawn, 0 if not and -1 on failure.
+ */
+int
+augmuseum_composite(augmuseum_context* context,
+                    int camera,
+                    const augmuseum_frame* frame);
+
+/**
+ * @brief Copies up to capacity of the markers camera found in its last frame
+ * to markers. Returns how many it found, or -1 on failure.
+ */
+int
+augmuseum_markers(const augmuseum_context* context,
+                  int camera,
+                  augmuseum_marker* markers,
+                  int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Sweep ArUco detector parameters over a recorded clip and report
+ * detection rate against time per frame.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "detector_config.h"
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+namespace autotune {
+
+/**
+ * @brief Runs every parameter combination over up to maxFrames frames of
+ * clipPath, prints the Pareto front of detection rate vs. ms/frame and writes
+ * the chosen parameter set to outputPath. config provides the dictionary and
+ * the starting parameters.
+ */
+int
+tuneDetector(const std::string& clipPath,
+             const detector_config::DetectorConfig& config,
+             int maxFrames,
+             const std::string& outputPath);
+}
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Time the compositing pipeline on a synthetic scene so changes to
+ * the hot path can be compared without a camera attached.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "painting.h"
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+namespace benchmark {
+
+/**
+ * @brief Runs the compositor over a synthetic frame and pose and prints the
+ * average time per frame for the CPU and the UMat paths.
+ */
+void
+runCompositorBenchmark(const std::vector<painting::Painting>& paintings,
+                       const cv::Mat& camMatrix,
+                       const cv::Mat& dCoeffs,
+                       int iterations);
+}
+
+#endif
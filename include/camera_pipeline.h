@@ -0,0 +1,285 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-camera detection and compositing. Each capture source gets its
+ * own pipeline with its own calibration, while the paintings are shared by
+ * every camera in the process.
+ */
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "capture.h"
+#include "detector_config.h"
+#include "marker_board.h"
+#include "marker_tracker.h"
+#include "metrics.h"
+#include "motion_gate.h"
+#include "occlusion.h"
+#include "painting.h"
+#include "preprocess.h"
+#include "recognition.h"
+#include "session.h"
+#include "video_overlay.h"
+
+#ifndef CAMERA_PIPELINE_H
+#define CAMERA_PIPELINE_H
+
+namespace camera_pipeline {
+
+/**
+ * @brief Paintings and videos loaded once and shared by all cameras.
+ * markerPaintings maps marker ids assigned in the layout file to an index in
+ * paintings, namedPaintings maps file names.
+ */
+struct ExhibitSet
+{
+  std::vector<painting::Painting> paintings;
+  std::vector<std::shared_ptr<video_overlay::VideoOverlay>> videos;
+  std::map<int, size_t> markerPaintings;
+  std::map<std::string, size_t> namedPaintings;
+
+  void indexMarkers();
+
+  int size() const { return (int)(paintings.size() + videos.size()); }
+};
+
+/**
+ * @brief The painting every camera composites this frame. uImage is only
+ * filled on the OpenCL path; uVideoFrame holds the upload of a video frame so
+ * it never overwrites a shared painting. objectCorners place the painting on
+ * the marker. version changes whenever a video moves to a new frame or a
+ * painting is reloaded, which tells cached warps apart. tiled is only set for
+ * paintings that were loaded with a tiled copy. exhibit is the index it was
+ * resolved from, -1 before the first.
+ */
+struct OverlayFrame
+{
+  cv::Mat image;
+  cv::UMat uImage, uVideoFrame;
+  std::vector<cv::Point3f> objectCorners;
+  int64_t version = 0;
+  int exhibit = -1;
+  std::shared_ptr<const tiled_image::TiledImage> tiled;
+};
+
+/**
+ * @brief Resolves the exhibit at index into the frame to draw at displayTime.
+ * Video exhibits are advanced here, once per frame, rather than per camera.
+ */
+void
+selectExhibit(const ExhibitSet& exhibits,
+              int index,
+              double displayTime,
+              bool useOpenCL,
+              OverlayFrame& overlay);
+
+/**
+ * @brief Metrics of one camera, registered once and updated lock-free from
+ * the render loop
+ */
+struct CameraMetrics
+{
+  explicit CameraMetrics(const std::string& source);
+
+  metrics::Counter& frames;
+  metrics::Counter& dropped;
+  metrics::Counter& framesWithMarkers;
+  metrics::Counter& markersDetected;
+  metrics::Gauge& visibleMarkers;
+  metrics::Gauge& idle;
+  metrics::Counter& prefetched;
+  metrics::Counter& latched;
+  metrics::Counter& recognized;
+  metrics::Histogram& processSeconds;
+  metrics::Histogram& latencySeconds;
+};
+
+/**
+ * @brief Seconds spent in each stage of the last processed frame
+ */
+struct StageTimes
+{
+  double preprocess = 0;
+  double detect = 0;
+  double pose = 0;
+  double composite = 0;
+};
+
+/**
+ * @brief Capture, detection and compositing for a single camera
+ */
+class CameraPipeline
+{
+public:
+  /**
+   * @brief source is a device index ("0") or a file/stream URL. The camera
+   * parameters are read from calibrationFile and the dictionary, marker size
+   * and detector parameters from config. Markers that belong to one of boards
+   * are posed together with the rest of their board. With handleOcclusion,
+   * people in front of a marker are kept in front of its painting. With a
+   * paintingIndex, the paintings in it are also recognized without markers.
+   */
+  CameraPipeline(
+    const std::string& source,
+    const std::string& calibrationFile,
+    const detector_config::DetectorConfig& config,
+    const std::vector<marker_board::MarkerBoard>& boards,
+    bool useOpenCL,
+    bool handleOcclusion = false,
+    std::shared_ptr<const recognition::PaintingIndex> paintingIndex = nullptr);
+
+  /**
+   * @brief Opens the capture source with the requested backend and format
+   */
+  bool open(const capture::CaptureSettings& settings =
+              capture::CaptureSettings());
+  bool isOpened() const { return capture.isOpened(); }
+
+  /**
+   * @brief Grabs the next frame without decoding it. All cameras are grabbed
+   * before any are processed so their frames line up in time.
+   */
+  bool grab();
+
+  /**
+   * @brief Decodes the grabbed frame, detects markers and composites the
+   * overlay into output(). Markers assigned to a painting in exhibits show
+   * that painting instead. Returns the area covered by the overlay. An idle
+   * camera only decodes a few frames a second to look for activity; for the
+   * rest hasFrame() turns false.
+   */
+  cv::Rect process(const OverlayFrame& overlay, const ExhibitSet& exhibits);
+
+  /**
+   * @brief Same as process() for a frame that did not come from the capture,
+   * such as one read back from a recorded session. timestamp is when it was
+   * captured, now if 0.
+   */
+  cv::Rect processFrame(const cv::Mat& input,
+                        const OverlayFrame& overlay,
+                        const ExhibitSet& exhibits,
+                        double timestamp = 0);
+
+  /**
+   * @brief Same as processFrame() but composites into image itself, which
+   * must be CV_8UC3, instead of into a copy. Coasting paintings are latched
+   * right away. The pipeline lets go of image before returning, so input()
+   * and output() are left empty.
+   */
+  cv::Rect processInPlace(cv::Mat& image,
+                          const OverlayFrame& overlay,
+                          const ExhibitSet& exhibits,
+                          double timestamp = 0);
+
+  /**
+   * @brief Draws the paintings whose pose is older than the frame, such as
+   * markers coasting through a missed detection, where their motion predicts
+   * them at the frame's capture time. Call after process(), right before
+   * output() is shown.
+   */
+  void latch();
+
+  /**
+   * @brief Writes the output frame to a video file in directory instead of
+   * showing it in a window
+   */
+  bool writeOutput(const std::string& directory);
+
+  /**
+   * @brief Records the output frame as shown. Observes the time from capture
+   * to display.
+   */
+  void presented();
+
+  const std::string& name() const { return source; }
+  const cv::Mat& input() const { return frame; }
+  const cv::Mat& output() const { return frameCopy; }
+  bool hasFrame() const { return grabbed; }
+  // When the last processed frame was captured, in getTickCount() seconds
+  double captureTime() const { return capturedAt; }
+  bool idle() const { return gate.idle(); }
+
+  // What the last processed frame detected and tracked, for recording
+  const std::vector<session::MarkerDetection>& detections() const
+  {
+    return detected;
+  }
+  const std::vector<session::TrackedPose>& poses() const
+  {
+    return trackedPoses;
+  }
+  const StageTimes& stageTimes() const { return times; }
+
+private:
+  cv::Rect compose(const OverlayFrame& overlay, const ExhibitSet& exhibits);
+  bool activityWhileIdle(double now);
+
+  template<typename MatT>
+  cv::Rect detectAndOverlayMarker(MatT& src,
+                                  MatT& dest,
+                                  const MatT& overlay,
+                                  const std::vector<cv::Point3f>& corners,
+                                  int64_t overlayVersion,
+                                  const tiled_image::TiledImage* tiles,
+                                  const ExhibitSet& exhibits);
+
+  occlusion::RegionModel* occluderFor(int key);
+
+  std::string source;
+  bool useOpenCL;
+  bool handleOcclusion;
+  bool grabbed = false;
+  bool inPlace = false;
+  double capturedAt = 0;
+
+  cv::VideoCapture capture;
+  cv::VideoWriter writer;
+  cv::Mat camMatrix, dCoeffs;
+  cv::Mat objPoints;
+  float markerLength;
+  cv::aruco::ArucoDetector detector;
+  std::vector<marker_board::MarkerBoard> boards;
+  marker_tracker::MarkerTracker tracker;
+  CameraMetrics stats;
+
+  // Rejected candidates read per frame to prepare paintings early, and the
+  // bit error budget they are read with
+  size_t prefetchCandidates;
+  double prefetchCorrectionRate;
+
+  // Tracks left for latch() to draw this frame
+  std::vector<int> pendingLatch;
+
+  // Paintings recognized without a marker, only with a painting index
+  std::unique_ptr<recognition::PaintingRecognizer> recognizer;
+
+  // Gray image and pyramid of the current frame, shared by detection and
+  // occlusion. Poses use poseCoeffs, which are empty when detection runs on
+  // an undistorted image.
+  preprocess::FramePreprocessor preprocessor;
+  cv::Mat poseCoeffs;
+
+  // While idle output() shares the decoded frame instead of copying it
+  motion_gate::MotionGate gate;
+  bool sharedOutput = false;
+  int visibleTracks = 0;
+  cv::Mat idleScan;
+
+  // Background models keyed by marker id, boards use -1 - board index
+  std::map<int, occlusion::RegionModel> occlusionRegions;
+
+  std::vector<session::MarkerDetection> detected;
+  std::vector<session::TrackedPose> trackedPoses;
+  StageTimes times;
+
+  // Frame buffers reused from one frame to the next
+  cv::Mat frame, frameCopy;
+  cv::UMat uFrame, uFrameCopy;
+};
+}
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Capture backend, format and buffering for camera sources, so a
+ * deployment can ask for the resolution and pixel format it needs instead of
+ * whatever the driver picks.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+namespace capture {
+
+/**
+ * @brief Requested capture format. Zero or empty values leave the driver's
+ * choice alone. buffers only applies to device sources; a short queue keeps
+ * the frame being processed close to the newest one.
+ */
+struct CaptureSettings
+{
+  std::string backend = "any";
+  cv::Size resolution;
+  double fps = 0;
+  std::string fourcc;
+  int buffers = 2;
+};
+
+/**
+ * @brief Converts a backend name such as "v4l2" to its cv::VideoCaptureAPIs
+ * value. Returns -1 if the name is unknown.
+ */
+int
+backendFromName(const std::string& name);
+
+/**
+ * @brief Parses a resolution such as "1280x720". Returns an empty size if
+ * text is empty or malformed.
+ */
+cv::Size
+parseResolution(const std::string& text);
+
+/**
+ * @brief Opens source, a device index ("0") or a file/stream URL, with
+ * settings and prints the format the driver agreed to. YUYV devices on Linux
+ * deliver raw CV_8UC2 frames so the luma plane can go straight to detection.
+ */
+bool
+openCapture(cv::VideoCapture& capture,
+            const std::string& source,
+            const CaptureSettings& settings);
+
+/**
+ * @brief Capture time of the frame just grabbed, in seconds on the
+ * getTickCount clock. Uses the driver's buffer timestamp where it is on the
+ * same clock (V4L2), so time spent queued in the driver is included, and
+ * grabTime otherwise.
+ */
+double
+frameTimestamp(const cv::VideoCapture& capture, double grabTime);
+}
+
+#endif
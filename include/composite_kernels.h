@@ -0,0 +1,46 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Inner loops of the CPU compositor, written as templates over the
+ * pixel format of the painting and the frame and over the interpolation, so
+ * each combination compiles to its own loop with no per-pixel type checks.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef COMPOSITE_KERNELS_H
+#define COMPOSITE_KERNELS_H
+
+namespace composite_kernels {
+
+/**
+ * @brief True if a painting of overlayType can be drawn onto a frame of
+ * destType: CV_8UC3 onto CV_8UC3, CV_8UC4 (alpha) onto CV_8UC3, and CV_8UC1
+ * onto CV_8UC1 for grayscale debug frames
+ */
+bool
+supported(int overlayType, int destType);
+
+/**
+ * @brief Copies warped into dest wherever mask is set, blending by the alpha
+ * channel when warped has one. Returns false, leaving dest untouched, if the
+ * types aren't supported.
+ */
+bool
+blend(const cv::Mat& warped, const cv::Mat& mask, cv::Mat& dest);
+
+/**
+ * @brief Warps overlay with toRoi and blends it into dest in a single pass,
+ * without an intermediate warped image. Only pixels where mask is set are
+ * sampled. interpolation is INTER_NEAREST or INTER_LINEAR. Returns false,
+ * leaving dest untouched, if the types or interpolation aren't supported.
+ */
+bool
+composite(const cv::Mat& overlay,
+          const cv::Matx33d& toRoi,
+          const cv::Mat& mask,
+          int interpolation,
+          cv::Mat& dest);
+}
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Warp paintings onto detected ArUco markers and blend them into the
+ * camera frame. Every entry point has a cv::Mat (CPU) and a cv::UMat
+ * (transparent API / OpenCL) overload.
+ */
+
+#include <cstdint>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "occlusion.h"
+#include "tiled_image.h"
+
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+namespace compositor {
+
+/**
+ * @brief Enables the OpenCL transparent API path if requested and supported by
+ * the current machine. Returns true when the UMat path is active.
+ */
+bool
+configureOpenCL(bool requested);
+
+/**
+ * @brief Returns true when frames should be routed through the UMat path
+ */
+bool
+openCLActive();
+
+/**
+ * @brief Where a painting lands in the frame for one marker pose: its
+ * projected corners, the homography from painting pixels to the frame and its
+ * bounding box clipped to the frame. Kept between frames so a marker can be
+ * redrawn without being posed again.
+ */
+struct Placement
+{
+  cv::Point2f imageCorners[4];
+  cv::Point polygon[4];
+  cv::Matx33d homography;
+  cv::Rect roi;
+
+  // What the placement was computed for
+  cv::Size overlaySize;
+  cv::Point3f objectCorners[4];
+
+  bool matches(cv::Size overlaySize,
+               const std::vector<cv::Point3f>& corners) const;
+};
+
+/**
+ * @brief The last warp drawn for one marker, limited to its bounding box.
+ * Reused as long as the marker holds still and the overlay doesn't change.
+ */
+struct WarpCache
+{
+  cv::Mat warped, mask, occludedMask;
+  cv::UMat uWarped, uMask;
+  cv::Point2f corners[4];
+  cv::Rect roi;
+
+  // The warp and mask moved by drawCorrected
+  cv::Mat corrected, correctedMask;
+
+  // Overlay the warp was made from
+  cv::Size overlaySize;
+  const void* source = nullptr;
+  int64_t version = -1;
+
+  bool reusableFor(const Placement& placement,
+                   const void* source,
+                   int64_t version) const;
+};
+
+/**
+ * @brief Projects objectCorners with the marker pose and works out where a
+ * painting of overlaySize lands in a frame of frameSize. Returns false if the
+ * painting is degenerate or entirely outside the frame.
+ */
+bool
+placeOverlay(cv::Size frameSize,
+             cv::Size overlaySize,
+             const std::vector<cv::Point3f>& objectCorners,
+             const cv::Vec3d& rvec,
+             const cv::Vec3d& tvec,
+             const cv::Mat& camMatrix,
+             const cv::Mat& dCoeffs,
+             Placement& placement);
+
+/**
+ * @brief Size of the painting in overlay or, when only its tiled copy is
+ * kept, in tiled
+ */
+cv::Size
+overlaySize(const cv::Mat& overlay, const tiled_image::TiledImage* tiled);
+
+/**
+ * @brief Size of the painting in overlay. Tiles are not read by the
+ * transparent API path.
+ */
+cv::Size
+overlaySize(const cv::UMat& overlay, const tiled_image::TiledImage* tiled);
+
+/**
+ * @brief Warps overlay for a placement into cache without drawing it, so the
+ * frame that first draws a marker can reuse the warp if the marker hasn't
+ * moved since. Does nothing if the cached warp is still usable.
+ */
+void
+prepareWarp(const cv::Mat& overlay,
+            const Placement& placement,
+            WarpCache& cache,
+            int64_t overlayVersion = 0,
+            const tiled_image::TiledImage* tiled = nullptr);
+
+/**
+ * @brief Warps overlay for a placement into cache using the transparent API
+ */
+void
+prepareWarp(const cv::UMat& overlay,
+            const Placement& placement,
+            WarpCache& cache,
+            int64_t overlayVersion = 0,
+            const tiled_image::TiledImage* tiled = nullptr);
+
+/**
+ * @brief Draws overlay at a placement computed by placeOverlay. When occluder
+ * is given, foreground in front of the marker is kept over the painting. With
+ * a cache, the warp is only redone when the placement moves by more than a
+ * fraction of a pixel or overlayVersion changes. A tiled copy of overlay, if
+ * given, is warped from instead and overlay may then be empty. Returns the
+ * area of dest that was drawn.
+ */
+cv::Rect
+drawOverlay(const cv::Mat& src,
+            cv::Mat& dest,
+            const cv::Mat& overlay,
+            const Placement& placement,
+            occlusion::RegionModel* occluder = nullptr,
+            WarpCache* cache = nullptr,
+            int64_t overlayVersion = 0,
+            const tiled_image::TiledImage* tiled = nullptr);
+
+/**
+ * @brief Draws overlay at a placement using the transparent API. tiled is
+ * only used by the CPU path and ignored here.
+ */
+cv::Rect
+drawOverlay(const cv::UMat& src,
+            cv::UMat& dest,
+            const cv::UMat& overlay,
+            const Placement& placement,
+            occlusion::RegionModel* occluder = nullptr,
+            WarpCache* cache = nullptr,
+            int64_t overlayVersion = 0,
+            const tiled_image::TiledImage* tiled = nullptr);
+
+/**
+ * @brief Draws the warp in cache with its corners moved to corners, by
+ * warping the cached bounding box instead of the painting. Meant for the
+ * small corrections of a late pose update. Returns the area of dest that was
+ * drawn.
+ */
+cv::Rect
+drawCorrected(WarpCache& cache, const cv::Point2f corners[4], cv::Mat& dest);
+
+/**
+ * @brief Overlay a painting onto an ArUco marker. objectCorners are the
+ * painting's corners in marker coordinates (see painting::Painting), matching
+ * the overlay's top-left, top-right, bottom-right and bottom-left. When
+ * occluder is given, foreground in front of the marker is kept over the
+ * painting. A tiled copy of overlay, if given, is warped from instead, and is
+ * all that is needed when overlay is empty. Returns the bounding box of the
+ * painting in dest, or an empty Rect if nothing was drawn.
+ */
+cv::Rect
+overlayImage2(const cv::Mat& src,
+              cv::Mat& dest,
+              const cv::Mat& overlay,
+              const std::vector<cv::Point3f>& objectCorners,
+              const cv::Vec3d& rvec,
+              const cv::Vec3d& tvec,
+              const cv::Mat& camMatrix,
+              const cv::Mat& dCoeffs,
+              occlusion::RegionModel* occluder = nullptr,
+              const tiled_image::TiledImage* tiled = nullptr);
+
+/**
+ * @brief Overlay a painting onto an ArUco marker using the transparent API.
+ * tiled is ignored here.
+ */
+cv::Rect
+overlayImage2(const cv::UMat& src,
+              cv::UMat& dest,
+              const cv::UMat& overlay,
+              const std::vector<cv::Point3f>& objectCorners,
+              const cv::Vec3d& rvec,
+              const cv::Vec3d& tvec,
+              const cv::Mat& camMatrix,
+              const cv::Mat& dCoeffs,
+              occlusion::RegionModel* occluder = nullptr,
+              const tiled_image::TiledImage* tiled = nullptr);
+}
+
+#endif
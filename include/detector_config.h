@@ -0,0 +1,89 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: ArUco dictionary, marker size and detector parameters loaded from a
+ * YAML/XML file, so deployments can tune detection without recompiling.
+ */
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#ifndef DETECTOR_CONFIG_H
+#define DETECTOR_CONFIG_H
+
+namespace detector_config {
+
+/**
+ * @brief Everything needed to create and detect markers
+ */
+struct DetectorConfig
+{
+  // One of cv::aruco::PredefinedDictionaryType
+  int dictionary = cv::aruco::DICT_6X6_250;
+
+  // Side of a marker in coordinate units. Paintings are placed in the same
+  // units.
+  float markerLength = 200.f;
+
+  // Side in pixels of generated marker images
+  int markerImageSize = 200;
+
+  // Frames a new marker must be seen in a row before it is drawn, and frames
+  // a tracked marker keeps being drawn after it is last seen
+  int acquireFrames = 2;
+  int coastFrames = 5;
+
+  // Detect on an undistorted copy of the frame. Helps with wide-angle lenses
+  // where markers near the edges are too curved to be found.
+  bool undistort = false;
+
+  // Seconds without a marker before a camera goes idle (0 never idles), and
+  // how often an idle camera checks a frame for motion and scans one for
+  // markers
+  double idleAfter = 30;
+  double idleCheckInterval = 0.1;
+  double idleScanInterval = 1;
+
+  // Rejected candidates read each frame for markers about to be detected, so
+  // their paintings are warped ahead of time (0 turns it off)
+  int prefetchCandidates = 4;
+
+  // With --markerless, frames between matches against the painting index
+  // (paintings found are followed with optical flow in between), and the
+  // features that must agree before a painting counts as recognized
+  int recognitionInterval = 10;
+  int recognitionInliers = 15;
+
+  cv::aruco::DetectorParameters parameters;
+
+  cv::aruco::Dictionary getDictionary() const;
+};
+
+/**
+ * @brief Fills config from filePath. Keys that are missing keep their default
+ * values. Returns 0 on success and -1 on failure, like loadCalibrationFile.
+ */
+int
+loadDetectorConfig(std::string filePath, DetectorConfig& config);
+
+/**
+ * @brief Writes config to filePath in the format read by loadDetectorConfig
+ */
+int
+saveDetectorConfig(std::string filePath, const DetectorConfig& config);
+
+/**
+ * @brief Converts a dictionary name such as "DICT_6X6_250" to its enum value.
+ * Returns -1 if the name is unknown.
+ */
+int
+dictionaryFromName(const std::string& name);
+
+/**
+ * @brief Converts a dictionary enum value to its name
+ */
+std::string
+dictionaryName(int dictionary);
+}
+
+#endif
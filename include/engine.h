@@ -0,0 +1,150 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: The detection and compositing engine without the application
+ * around it. An Engine holds everything one installation needs, so a host
+ * application can run several side by side and feed them its own frames. The
+ * command line program is one such host.
+ */
+
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "camera_pipeline.h"
+#include "detector_config.h"
+#include "exhibit_library.h"
+#include "marker_board.h"
+#include "recognition.h"
+#include "tiled_image.h"
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+namespace engine {
+
+/**
+ * @brief What an Engine loads. A paintingIndexFile turns on recognition
+ * without markers; the index is built there from the paintings if it can't
+ * be read. useOpenCL only takes effect if compositor::configureOpenCL turned
+ * the OpenCL path on.
+ */
+struct EngineOptions
+{
+  std::string paintingDirectory = "bin/paintings";
+  detector_config::DetectorConfig detectorConfig;
+  std::string boardFile;
+  std::string paintingIndexFile;
+  std::string paintingFeatures = "orb";
+  bool useOpenCL = false;
+  bool handleOcclusion = false;
+  bool tilePaintings = false;
+  tiled_image::PixelFormat paintingFormat = tiled_image::PixelFormat::Bgr;
+};
+
+/**
+ * @brief Paintings, marker boards and a pipeline per camera. Engines share
+ * nothing but the metrics registry, so each can be driven from its own
+ * thread; a single Engine is used from one thread at a time.
+ */
+class Engine
+{
+public:
+  Engine() = default;
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+
+  /**
+   * @brief Loads the paintings, the boards and the painting index. Returns
+   * false if there are no exhibits or the index could not be built.
+   */
+  bool open(const EngineOptions& options);
+
+  /**
+   * @brief Adds a camera whose parameters are read from calibrationFile.
+   * source names it in the metrics and is the device index or URL that
+   * camera(index).open() captures from. Returns the camera's index.
+   */
+  int addCamera(const std::string& source, const std::string& calibrationFile);
+
+  /**
+   * @brief Starts picking up changes to the painting directory
+   */
+  bool watch();
+
+  /**
+   * @brief Grabs the next frame of every camera opened for capture. Returns
+   * false if none had one.
+   */
+  bool grab();
+
+  /**
+   * @brief Composites the current exhibit into the grabbed frame of every
+   * camera, in parallel. drawn receives the area covered in each camera.
+   */
+  void process(double displayTime, std::vector<cv::Rect>& drawn);
+
+  /**
+   * @brief Detects markers in frame, a CV_8UC3 image seen by camera, and
+   * draws the current exhibit into it in place. Nothing is copied and frame
+   * is not kept. timestamp is when it was captured, now if 0. Returns the
+   * area drawn.
+   */
+  cv::Rect composite(int camera, cv::Mat& frame, double timestamp = 0);
+
+  /**
+   * @brief Makes the exhibit at index, wrapped around, the one drawn
+   */
+  void select(int index);
+  int selected() const { return currentExhibit; }
+  int exhibitCount() const { return exhibits()->size(); }
+
+  /**
+   * @brief The exhibits as of now. Stays valid if a reload replaces them.
+   */
+  std::shared_ptr<const camera_pipeline::ExhibitSet> exhibits() const
+  {
+    return library->current();
+  }
+
+  camera_pipeline::CameraPipeline& camera(int index)
+  {
+    return *cameras[index];
+  }
+  const camera_pipeline::CameraPipeline& camera(int index) const
+  {
+    return *cameras[index];
+  }
+  int cameraCount() const { return (int)cameras.size(); }
+
+  const detector_config::DetectorConfig& config() const
+  {
+    return options.detectorConfig;
+  }
+  const std::vector<marker_board::MarkerBoard>& markerBoards() const
+  {
+    return boards;
+  }
+  bool openCL() const { return useOpenCL; }
+
+private:
+  std::shared_ptr<const camera_pipeline::ExhibitSet> beginFrame(
+    double displayTime);
+
+  EngineOptions options;
+  bool useOpenCL = false;
+  std::unique_ptr<exhibit_library::ExhibitLibrary> library;
+  std::shared_ptr<const recognition::PaintingIndex> paintingIndex;
+  std::vector<marker_board::MarkerBoard> boards;
+  std::vector<std::unique_ptr<camera_pipeline::CameraPipeline>> cameras;
+
+  // The exhibit being drawn and the frame of it drawn last, with the set
+  // that frame was resolved from
+  int currentExhibit = 0;
+  camera_pipeline::OverlayFrame overlay;
+  std::shared_ptr<const camera_pipeline::ExhibitSet> overlaySet;
+};
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Keep the exhibits in sync with the painting directory while the
+ * application runs, so curators can add or swap a painting without a
+ * restart.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+
+#include "camera_pipeline.h"
+#include "metrics.h"
+
+#ifndef EXHIBIT_LIBRARY_H
+#define EXHIBIT_LIBRARY_H
+
+namespace exhibit_library {
+
+/**
+ * @brief The exhibits of one painting directory. Readers take a snapshot with
+ * current() and use it for a whole frame. Changes are decoded on a background
+ * thread into a new set, which replaces the old one with a single pointer
+ * swap, so the render loop never waits on a decode. An old set is freed once
+ * the last frame using it lets go.
+ */
+class ExhibitLibrary
+{
+public:
+  /**
+   * @brief With uploadPaintings, paintings are also uploaded for the OpenCL
+   * path as they are loaded. With tilePaintings, they also get a tiled copy
+   * for the CPU warp. With a Yuv420 paintingFormat, paintings are kept in
+   * YUV 4:2:0 tiles only, at half the memory.
+   */
+  ExhibitLibrary(
+    const std::string& directory,
+    float markerLength,
+    bool uploadPaintings,
+    bool tilePaintings = false,
+    tiled_image::PixelFormat paintingFormat = tiled_image::PixelFormat::Bgr);
+  ~ExhibitLibrary();
+
+  ExhibitLibrary(const ExhibitLibrary&) = delete;
+  ExhibitLibrary& operator=(const ExhibitLibrary&) = delete;
+
+  /**
+   * @brief Loads every painting and video in the directory. Returns the
+   * number of exhibits.
+   */
+  int load();
+
+  /**
+   * @brief Starts reloading added, changed and removed files in the
+   * background. Uses inotify on Linux and polls elsewhere.
+   */
+  bool watch();
+  void stop();
+
+  std::shared_ptr<const camera_pipeline::ExhibitSet> current() const;
+
+private:
+  void watchLoop();
+  bool waitForChanges(std::set<std::string>& changed);
+  void scanForChanges(std::set<std::string>& changed);
+  void readEvents(std::set<std::string>& changed);
+  void rebuild(const std::set<std::string>& changed);
+  void publish(const std::shared_ptr<camera_pipeline::ExhibitSet>& next);
+  void prepare(painting::Painting& painting) const;
+
+  std::string directory;
+  float markerLength;
+  bool uploadPaintings;
+  bool tilePaintings;
+  tiled_image::PixelFormat paintingFormat;
+
+  // Only ever read and replaced with std::atomic_load/atomic_store
+  std::shared_ptr<const camera_pipeline::ExhibitSet> exhibits;
+
+  // Modification time and size of each file, for the polling fallback
+  std::map<std::string, std::pair<int64_t, uintmax_t>> snapshot;
+  int inotifyFd = -1;
+
+  std::atomic<bool> stopping{ false };
+  std::thread watcher;
+
+  metrics::Gauge& paintingBytes;
+  metrics::Counter& reloads;
+};
+}
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Publish camera frames, composited frames and what was detected in
+ * them to a POSIX shared-memory ring, so other processes on the kiosk can
+ * read them in place instead of opening the cameras or scraping the window.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "session.h"
+
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+namespace frame_bus {
+
+// Readers and the writer share these atomics across processes
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "The frame bus needs lock-free 64-bit atomics");
+
+const uint32_t busVersion = 1;
+const int maxMarkers = 32;
+
+/**
+ * @brief What a slot holds
+ */
+enum FrameKind : uint32_t
+{
+  RawFrame = 0,
+  CompositedFrame = 1
+};
+
+/**
+ * @brief A detected marker, corners as x, y pairs
+ */
+struct BusDetection
+{
+  int32_t id;
+  float corners[8];
+};
+
+/**
+ * @brief A tracked marker or board (negative key) with its pose
+ */
+struct BusPose
+{
+  int32_t key;
+  int32_t state;
+  double rvec[3];
+  double tvec[3];
+};
+
+/**
+ * @brief Metadata at the start of every slot. sequence is 0 while the writer
+ * fills the slot and the frame's sequence number once it is complete. The
+ * pixels follow at pixelsOffset from the start of the slot.
+ */
+struct SlotHeader
+{
+  std::atomic<uint64_t> sequence;
+  uint32_t camera;
+  uint32_t kind;
+  uint64_t frameNumber;
+  double timestamp;
+  int32_t width, height, type;
+  uint32_t step;
+  uint64_t bytes;
+  uint32_t detectionCount, poseCount;
+  BusDetection detections[maxMarkers];
+  BusPose poses[maxMarkers];
+};
+
+/**
+ * @brief The start of the shared memory. Frame n (counting from 1) is in
+ * slot (n - 1) % slotCount, which starts slotsOffset + that * slotStride
+ * bytes in; latest is the last complete frame.
+ */
+struct BusHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slotCount;
+  uint64_t slotsOffset;
+  uint64_t slotStride;
+  uint64_t pixelsOffset;
+  uint64_t frameCapacity;
+  std::atomic<uint64_t> latest;
+};
+
+/**
+ * @brief Writing end of the bus, owned by the application. Creates the
+ * shared memory, failing if the name is taken, and removes it again on
+ * close.
+ */
+class FrameBus
+{
+public:
+  FrameBus() = default;
+  ~FrameBus();
+
+  FrameBus(const FrameBus&) = delete;
+  FrameBus& operator=(const FrameBus&) = delete;
+
+  /**
+   * @brief Creates the shared memory called name ("/augmuseum") with slots
+   * slots of up to frameCapacity bytes of pixels each
+   */
+  bool open(const std::string& name, int slots, size_t frameCapacity);
+  void close();
+  bool isOpened() const { return header != nullptr; }
+
+  /**
+   * @brief Copies frame and its markers into the next slot. Returns the
+   * frame's sequence number, or 0 if it didn't fit.
+   */
+  uint64_t publish(int camera,
+                   FrameKind kind,
+                   const cv::Mat& frame,
+                   double timestamp,
+                   const std::vector<session::MarkerDetection>& detections,
+                   const std::vector<session::TrackedPose>& poses);
+
+private:
+  std::string name;
+  BusHeader* header = nullptr;
+  size_t mappedBytes = 0;
+  uint64_t sequence = 0;
+  std::vector<uint64_t> frameNumbers;
+  bool warnedTooLarge = false;
+};
+
+/**
+ * @brief Reading end of the bus, mapped read-only. A slot is only valid while
+ * its sequence still matches: check valid() after reading the pixels, and
+ * drop what was read if the writer has come round to the slot again.
+ */
+class FrameBusReader
+{
+public:
+  FrameBusReader() = default;
+  ~FrameBusReader();
+
+  FrameBusReader(const FrameBusReader&) = delete;
+  FrameBusReader& operator=(const FrameBusReader&) = delete;
+
+  bool open(const std::string& name);
+  void close();
+  bool isOpened() const { return header != nullptr; }
+
+  /**
+   * @brief Sequence number of the newest complete frame, 0 if none yet
+   */
+  uint64_t latest() const;
+  uint32_t slotCount() const { return header->slotCount; }
+
+  /**
+   * @brief The slot holding frame sequence, or nullptr if it was already
+   * overwritten or is being written
+   */
+  const SlotHeader* slot(uint64_t sequence) const;
+
+  /**
+   * @brief True if the slot still holds frame sequence
+   */
+  bool valid(const SlotHeader* slot, uint64_t sequence) const;
+
+  /**
+   * @brief The slot's pixels as a Mat that points into the shared memory
+   */
+  cv::Mat image(const SlotHeader* slot) const;
+
+private:
+  const BusHeader* header = nullptr;
+  size_t mappedBytes = 0;
+};
+}
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Groups of ArUco markers laid out on one wall that share a single
+ * pose. Every visible marker of a board feeds one solvePnP, which keeps large
+ * paintings steady at long range.
+ */
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#ifndef MARKER_BOARD_H
+#define MARKER_BOARD_H
+
+namespace marker_board {
+
+/**
+ * @brief A set of markers with known positions on a plane. Coordinates follow
+ * setCoordinateSystem: board units, origin at the board centre, y up.
+ */
+struct MarkerBoard
+{
+  std::string name;
+  cv::aruco::Board board;
+  std::vector<int> ids;
+
+  // Where the painting centre sits relative to the board origin
+  cv::Vec3d paintingOffset;
+};
+
+/**
+ * @brief Loads grid and custom board layouts from a YAML/XML file. Boards that
+ * don't give a markerLength use defaultMarkerLength.
+ */
+std::vector<MarkerBoard>
+loadBoardsFromFile(std::string filePath,
+                   const cv::aruco::Dictionary& dictionary,
+                   float defaultMarkerLength);
+
+/**
+ * @brief Solves one pose for board from every detected marker that belongs to
+ * it. Markers used are flagged in onBoard. The returned pose is moved to the
+ * painting centre. Returns false if none of the board's markers are visible.
+ */
+bool
+estimateBoardPose(const MarkerBoard& board,
+                  const std::vector<std::vector<cv::Point2f>>& markerCorners,
+                  const std::vector<int>& markerIds,
+                  const cv::Mat& camMatrix,
+                  const cv::Mat& dCoeffs,
+                  cv::Vec3d& rvec,
+                  cv::Vec3d& tvec,
+                  std::vector<bool>& onBoard);
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Generate ArUco markers in bulk. Markers are rendered at print
+ * resolution, tiled onto printable pages, and assigned to paintings in the
+ * painting layout file so the runtime knows which marker shows which
+ * painting.
+ */
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#ifndef MARKER_SHEET_H
+#define MARKER_SHEET_H
+
+namespace marker_sheet {
+
+/**
+ * @brief What to print and how large. Sizes are in millimetres, the page
+ * defaults to A4.
+ */
+struct SheetOptions
+{
+  std::vector<int> ids;
+  int dpi = 300;
+  float markerMillimetres = 50;
+  float marginMillimetres = 10;
+  cv::Size2f pageMillimetres = cv::Size2f(210, 297);
+  std::string outputDirectory = "markers";
+};
+
+/**
+ * @brief Parses a list of ids and ranges such as "0-9,40,41". Returns an empty
+ * vector if the list is malformed.
+ */
+std::vector<int>
+parseIdList(const std::string& spec);
+
+/**
+ * @brief Renders every marker in options.ids in parallel, writes each one as
+ * its own PNG and tiles them onto numbered page images in
+ * options.outputDirectory
+ */
+int
+generateMarkerSheets(const SheetOptions& options,
+                     const cv::aruco::Dictionary& dictionary);
+
+/**
+ * @brief Assigns ids to the paintings in paintingDirectory, in file name
+ * order, and records the assignment in its layout file. With more ids than
+ * paintings the assignment wraps around.
+ */
+int
+writeMarkerManifest(const std::string& paintingDirectory,
+                    const std::vector<int>& ids);
+}
+
+#endif
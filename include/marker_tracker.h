@@ -0,0 +1,137 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Track markers from one frame to the next. Each marker id moves
+ * through acquiring, tracked, coasting and lost with some hysteresis, so a
+ * single missed detection doesn't make its painting flicker.
+ */
+
+#include <map>
+#include <opencv2/opencv.hpp>
+
+#include "compositor.h"
+
+#ifndef MARKER_TRACKER_H
+#define MARKER_TRACKER_H
+
+namespace marker_tracker {
+
+/**
+ * @brief Lifecycle of a marker. Acquiring markers are not drawn yet, coasting
+ * markers are drawn where they were last seen.
+ */
+enum class TrackState
+{
+  Acquiring,
+  Tracked,
+  Coasting,
+  Lost
+};
+
+/**
+ * @brief What is remembered about one marker (or board) between frames
+ */
+struct MarkerTrack
+{
+  TrackState state = TrackState::Lost;
+  int hits = 0;
+  int misses = 0;
+  bool seen = false;
+
+  // Last pose, used as the starting guess for the next solvePnP
+  bool hasPose = false;
+  cv::Vec3d rvec, tvec;
+
+  // Last placement of the painting, redrawn as is while coasting, and the
+  // warp drawn for it
+  compositor::Placement placement;
+  compositor::WarpCache warp;
+
+  // Frames a lost marker keeps a placement and warp that were prepared
+  // before it was detected
+  int prefetchFrames = 0;
+
+  // Image corners of the last placement drawn from a detection, the capture
+  // time of that frame (0 when unknown) and how fast each corner was moving,
+  // in pixels per second
+  cv::Point2f seenCorners[4];
+  cv::Point2f cornerVelocity[4];
+  double seenTime = 0;
+  bool hasMotion = false;
+
+  bool visible() const
+  {
+    return state == TrackState::Tracked || state == TrackState::Coasting;
+  }
+
+  /**
+   * @brief Updates the corner velocities from the placement of a frame
+   * captured at time
+   */
+  void recordMotion(double time);
+
+  /**
+   * @brief Forgets the motion, for when the placement jumps for reasons
+   * other than the marker moving
+   */
+  void resetMotion();
+
+  /**
+   * @brief Where the corners of the last seen placement are predicted to be
+   * at time, looking at most horizon seconds ahead. Returns false if there
+   * is no motion to predict from yet.
+   */
+  bool predictCorners(double time,
+                      double horizon,
+                      cv::Point2f corners[4]) const;
+};
+
+/**
+ * @brief State table of every marker a camera has seen, keyed by marker id
+ * (boards use negative keys)
+ */
+class MarkerTracker
+{
+public:
+  /**
+   * @brief A marker is drawn once it was seen acquireFrames frames in a row
+   * and keeps being drawn for coastFrames frames after it was last seen
+   */
+  MarkerTracker(int acquireFrames, int coastFrames);
+
+  /**
+   * @brief Starts a new frame. Every track is unseen until observed.
+   */
+  void beginFrame();
+
+  /**
+   * @brief Records that key was detected this frame and returns its track
+   */
+  MarkerTrack& observe(int key);
+
+  /**
+   * @brief Returns the track of key without observing it, so its painting
+   * can be prepared before the marker is detected. A lost track keeps what
+   * is prepared for a few frames.
+   */
+  MarkerTrack& prepare(int key);
+
+  /**
+   * @brief True if key was already observed this frame
+   */
+  bool seenThisFrame(int key) const;
+
+  /**
+   * @brief Moves the tracks that weren't observed this frame towards lost
+   */
+  void endFrame();
+
+  std::map<int, MarkerTrack>& tracks() { return table; }
+
+private:
+  int acquireFrames, coastFrames;
+  std::map<int, MarkerTrack> table;
+};
+}
+
+#endif
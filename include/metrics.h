@@ -0,0 +1,175 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Runtime metrics for monitoring kiosks. Counters, gauges and
+ * histograms are plain atomics that the render loop updates without locking,
+ * and a small HTTP server exposes them in the Prometheus text format on a
+ * local port or Unix socket.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef METRICS_H
+#define METRICS_H
+
+namespace metrics {
+
+/**
+ * @brief Monotonically increasing count
+ */
+class Counter
+{
+public:
+  void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value{ 0 };
+};
+
+/**
+ * @brief Value that can go up and down
+ */
+class Gauge
+{
+public:
+  void set(double v) { value.store(v, std::memory_order_relaxed); }
+  double get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> value{ 0 };
+};
+
+/**
+ * @brief Distribution of observed values over fixed bucket upper bounds
+ */
+class Histogram
+{
+public:
+  explicit Histogram(const std::vector<double>& bounds);
+
+  void observe(double v);
+
+  const std::vector<double>& upperBounds() const { return bounds; }
+  uint64_t bucketCount(size_t bucket) const;
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+  double sum() const { return valueSum.load(std::memory_order_relaxed); }
+
+private:
+  std::vector<double> bounds;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+  std::atomic<uint64_t> total{ 0 };
+  std::atomic<double> valueSum{ 0 };
+};
+
+/**
+ * @brief Owns every metric of the process. Metrics are registered up front
+ * and keep their address for the lifetime of the registry, so the hot path
+ * holds references and never touches the registry itself.
+ */
+class Registry
+{
+public:
+  /**
+   * @brief Returns the metric called name with labels (e.g. camera="0"),
+   * creating it on first use
+   */
+  Counter& counter(const std::string& name,
+                   const std::string& help,
+                   const std::string& labels = "");
+  Gauge& gauge(const std::string& name,
+               const std::string& help,
+               const std::string& labels = "");
+  Histogram& histogram(const std::string& name,
+                       const std::string& help,
+                       const std::vector<double>& bounds,
+                       const std::string& labels = "");
+
+  /**
+   * @brief Every metric in the Prometheus text exposition format
+   */
+  std::string render() const;
+
+private:
+  enum class Type
+  {
+    Counter,
+    Gauge,
+    Histogram
+  };
+
+  struct Entry
+  {
+    std::string labels;
+    size_t index;
+  };
+
+  struct Family
+  {
+    std::string name, help;
+    Type type;
+    std::vector<Entry> entries;
+  };
+
+  size_t find(const std::string& name,
+              const std::string& help,
+              Type type,
+              const std::string& labels,
+              bool& created);
+
+  mutable std::mutex registryMutex;
+  std::vector<Family> families;
+  std::deque<Counter> counters;
+  std::deque<Gauge> gauges;
+  std::deque<Histogram> histograms;
+};
+
+/**
+ * @brief The process-wide registry
+ */
+Registry&
+registry();
+
+/**
+ * @brief Formats a label for Registry, escaping the value
+ */
+std::string
+label(const std::string& name, const std::string& value);
+
+/**
+ * @brief Serves the registry over HTTP. address is a TCP port on localhost
+ * ("9100") or a Unix socket path prefixed with "unix:".
+ */
+class MetricsServer
+{
+public:
+  explicit MetricsServer(Registry& registry);
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  bool start(const std::string& address);
+  void stop();
+
+private:
+  void serve();
+  void respond(int client);
+
+  Registry& source;
+  Gauge& maxResident;
+  int listenFd = -1;
+  std::string socketPath;
+  std::atomic<bool> stopping{ false };
+  std::thread worker;
+};
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Idle mode for cameras that have not seen a marker in a while. An
+ * idle camera only looks at a few tiny frames a second for motion, plus an
+ * occasional low resolution marker scan, until something shows up.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+namespace motion_gate {
+
+/**
+ * @brief Decides when a camera goes idle and when it wakes up. Times are in
+ * seconds. An idleAfter of 0 keeps the camera active for good.
+ */
+class MotionGate
+{
+public:
+  MotionGate(double idleAfter, double checkInterval, double scanInterval);
+
+  bool idle() const { return isIdle; }
+
+  /**
+   * @brief Reports whether markers were visible in the frame processed at
+   * now. The gate goes idle after idleAfter seconds without any.
+   */
+  void update(bool markersVisible, double now);
+
+  /**
+   * @brief While idle, whether the frame grabbed at now should be looked at
+   * at all. Every other frame is dropped without being decoded.
+   */
+  bool dueForCheck(double now);
+
+  /**
+   * @brief While idle, whether the frame at now should also get a low
+   * resolution marker scan
+   */
+  bool dueForScan(double now);
+
+  /**
+   * @brief Compares a tiny copy of frame (BGR, raw YUYV or gray) with the
+   * previous one. Returns true if enough of it changed.
+   */
+  bool motion(const cv::Mat& frame);
+
+  /**
+   * @brief Leaves idle mode, e.g. after motion or a marker was found
+   */
+  void wake(double now);
+
+private:
+  double idleAfter, checkInterval, scanInterval;
+  bool isIdle = false;
+  double lastActive = -1, lastCheck = 0, lastScan = 0;
+
+  // Downscaled gray frames, reused between checks
+  cv::Mat tiny, tinyGray, previous, difference;
+};
+}
+
+#endif
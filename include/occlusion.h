@@ -0,0 +1,60 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Keep visitors in front of the painting. A small background model of
+ * the wall behind each marker is kept in the painting's own plane, and pixels
+ * that differ from it are left out when the painting is blended in.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+namespace occlusion {
+
+/**
+ * @brief Background model for the area covered by one marker's painting. The
+ * model is stored rectified to the painting plane, so it stays registered
+ * while the camera or the marker moves, and all work is bounded by the
+ * painting's size on screen.
+ */
+class RegionModel
+{
+public:
+  /**
+   * @brief Samples from a gray pyramid of the frame (level 0 at full
+   * resolution) instead of the frame passed to apply. The level closest to
+   * the model's resolution is used. pyramid must outlive the calls to apply.
+   */
+  void sampleFrom(const std::vector<cv::Mat>* pyramid)
+  {
+    this->pyramid = pyramid;
+  }
+
+  /**
+   * @brief Samples frame inside the painting outlined by imageCorners
+   * (top-left, top-right, bottom-right, bottom-left), updates the background
+   * and clears every foreground pixel from mask, which covers roi of the
+   * frame. overlaySize gives the painting's aspect ratio.
+   */
+  void apply(const cv::Mat& frame,
+             const cv::Point2f imageCorners[4],
+             cv::Size overlaySize,
+             cv::Rect roi,
+             cv::Mat& mask);
+
+private:
+  const std::vector<cv::Mat>* pyramid = nullptr;
+
+  // Running average of the wall, CV_32F with the sampled image's channel
+  // count
+  cv::Mat background;
+
+  // Scratch buffers reused between frames
+  cv::Mat plane, background8u, difference, differenceGray;
+  cv::Mat foreground, backgroundMask, roiForeground;
+};
+}
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-painting descriptors. The physical size and anchor of every
+ * painting are worked out once at load time so the compositor only has to
+ * project four precomputed corners per frame.
+ */
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+#include "tiled_image.h"
+
+#ifndef PAINTING_H
+#define PAINTING_H
+
+namespace painting {
+
+// Name of the optional layout file in the painting directory
+extern const std::string layoutFileName;
+
+// Paintings are downscaled so their longest side is at most this many pixels
+extern const int maxPaintingSide;
+
+/**
+ * @brief Placement of one painting as given in the layout file. A height of 0
+ * means the default height. markerIds are the markers that always show this
+ * painting, written by the marker sheet generator.
+ */
+struct Layout
+{
+  float height = 0;
+  cv::Point2f anchorOffset;
+  std::vector<int> markerIds;
+};
+
+/**
+ * @brief A painting and where it sits relative to its marker. objectCorners
+ * are in marker coordinates (see setCoordinateSystem) and match the image
+ * corners top-left, top-right, bottom-right, bottom-left.
+ */
+struct Painting
+{
+  std::string name;
+
+  // BGR, or BGRA for a transparent PNG, WebP or TIFF
+  cv::Mat image;
+  cv::UMat uImage;
+  cv::Size2f physicalSize;
+  cv::Point2f anchorOffset;
+  std::vector<cv::Point3f> objectCorners;
+  std::vector<int> markerIds;
+
+  // Unique per decoded image, so cached warps never outlive a reload
+  int64_t version = 0;
+
+  // Tiled copy of image for the CPU warp, only built when requested
+  std::shared_ptr<const tiled_image::TiledImage> tiled;
+};
+
+/**
+ * @brief A version number no painting has used yet
+ */
+int64_t
+nextVersion();
+
+/**
+ * @brief Reads the layout file in directory, keyed by file name. Returns an
+ * empty map if there is no layout file.
+ */
+std::map<std::string, Layout>
+loadLayouts(std::string directory);
+
+/**
+ * @brief Writes layouts to the layout file in directory, replacing it
+ */
+int
+saveLayouts(std::string directory,
+            const std::map<std::string, Layout>& layouts);
+
+/**
+ * @brief Names of the files in directory with an extension imread reads,
+ * sorted. Video files, the layout file and anything else are left out.
+ */
+std::vector<std::string>
+listPaintingFiles(std::string directory);
+
+/**
+ * @brief Builds the descriptor for a painting of pixelSize. The painting keeps
+ * its aspect ratio; its height comes from layouts or defaults to a fixed
+ * multiple of markerLength.
+ */
+Painting
+describePainting(const std::string& name,
+                 cv::Size pixelSize,
+                 const std::map<std::string, Layout>& layouts,
+                 float markerLength);
+
+/**
+ * @brief Decodes fileName in directory into painting, downscaled to
+ * maxPaintingSide and placed according to layouts. Returns false if the file
+ * is not a readable image.
+ */
+bool
+loadPainting(const std::string& directory,
+             const std::string& fileName,
+             const std::map<std::string, Layout>& layouts,
+             float markerLength,
+             Painting& painting);
+
+/**
+ * @brief Load the images in a directory as paintings. Video files and the
+ * layout file are skipped.
+ */
+std::vector<Painting>
+loadPaintingsFromDirectory(std::string path, float markerLength);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Guess which markers are about to be detected from the candidates
+ * the detector rejected, so their paintings can be prepared a frame or two
+ * before they are first drawn.
+ */
+
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+namespace prefetch {
+
+/**
+ * @brief A rejected candidate that looks like marker id. corners are in the
+ * order detectMarkers returns for that id.
+ */
+struct LikelyMarker
+{
+  int id;
+  cv::Point2f corners[4];
+};
+
+/**
+ * @brief Reads the bits of the maxCandidates largest quads in rejected and
+ * matches them to ids of dictionary. maxCorrectionRate is the fraction of
+ * the dictionary's correctable bits that may be wrong, as in
+ * DetectorParameters::errorCorrectionRate; passing more than the detector
+ * uses catches markers that are blurred, partly covered or still small.
+ */
+std::vector<LikelyMarker>
+decodeCandidates(const cv::Mat& gray,
+                 const std::vector<std::vector<cv::Point2f>>& rejected,
+                 const cv::aruco::Dictionary& dictionary,
+                 int borderBits,
+                 double maxCorrectionRate,
+                 size_t maxCandidates);
+}
+
+#endif
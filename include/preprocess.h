@@ -0,0 +1,64 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-frame preprocessing shared by every stage of a camera's
+ * pipeline, so the frame is converted to gray once however many stages read
+ * it.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+namespace preprocess {
+
+/**
+ * @brief Gray image, gray pyramid and optionally an undistorted gray image of
+ * the current frame, kept in buffers reused from one frame to the next
+ */
+class FramePreprocessor
+{
+public:
+  /**
+   * @brief levels is the number of pyramid levels, counting the full
+   * resolution gray image. With undistort, detectionImage() is corrected for
+   * the lens described by camMatrix and dCoeffs.
+   */
+  void configure(int levels,
+                 bool undistort,
+                 const cv::Mat& camMatrix,
+                 const cv::Mat& dCoeffs);
+
+  /**
+   * @brief Derives every image from frame, which is BGR, BGRA, raw YUYV
+   * (CV_8UC2) or gray
+   */
+  void run(const cv::Mat& frame);
+
+  const cv::Mat& gray() const { return levels[0]; }
+  const std::vector<cv::Mat>& pyramid() const { return levels; }
+
+  /**
+   * @brief The image markers are detected in. Corners found in it carry no
+   * lens distortion when undistorts() is true.
+   */
+  const cv::Mat& detectionImage() const
+  {
+    return undistort ? undistorted : levels[0];
+  }
+  bool undistorts() const { return undistort; }
+
+private:
+  std::vector<cv::Mat> levels = std::vector<cv::Mat>(1);
+  bool undistort = false;
+  cv::Mat camMatrix, dCoeffs;
+
+  // Undistortion maps, rebuilt when the frame size changes
+  cv::Mat mapX, mapY;
+  cv::Size mapSize;
+  cv::Mat undistorted;
+};
+}
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Recognize the paintings themselves, without a printed marker. The
+ * features of the whole collection are computed once into an on-disk index;
+ * cameras match against it on keyframes only and follow what they found
+ * with optical flow in between.
+ */
+
+#include <memory>
+#include <mutex>
+#include <opencv2/flann.hpp>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "painting.h"
+
+#ifndef RECOGNITION_H
+#define RECOGNITION_H
+
+namespace recognition {
+
+// Tracker keys of recognized paintings start here, above any marker id
+const int keyBase = 1 << 20;
+
+/**
+ * @brief A painting found in a frame. entry is its index in the
+ * PaintingIndex, corners are the painting image's corners in the frame
+ * (top-left, top-right, bottom-right, bottom-left) and points the frame
+ * positions of the features that agreed on them.
+ */
+struct Recognition
+{
+  int entry;
+  cv::Point2f corners[4];
+  std::vector<cv::Point2f> points;
+};
+
+/**
+ * @brief Binary features (ORB or AKAZE) of every painting in one
+ * locality-sensitive hashing index, so a lookup costs about the same for ten
+ * paintings as for thousands. Safe to share between cameras.
+ */
+class PaintingIndex
+{
+public:
+  /**
+   * @brief Computes the features of paintings with features ("orb" or
+   * "akaze") and indexes them. Returns false if none had any features.
+   */
+  bool build(const std::vector<painting::Painting>& paintings,
+             const std::string& features = "orb");
+
+  /**
+   * @brief Writes the features to path and the hash tables next to it
+   */
+  bool save(const std::string& path) const;
+
+  /**
+   * @brief Reads an index written by save. The hash tables are rebuilt if
+   * their file is missing or stale.
+   */
+  bool load(const std::string& path);
+
+  /**
+   * @brief Paintings in gray with at least minInliers features agreeing on
+   * where they are, best first
+   */
+  std::vector<Recognition> recognize(const cv::Mat& gray, int minInliers) const;
+
+  int size() const { return (int)names.size(); }
+  const std::string& name(int entry) const { return names[entry]; }
+  const std::string& features() const { return featureType; }
+
+private:
+  bool buildTables();
+
+  std::string featureType;
+
+  // File name and image size of each painting
+  std::vector<std::string> names;
+  std::vector<cv::Size> sizes;
+
+  // Every painting's features, row i of descriptors belongs to keypoints[i]
+  // and to painting owner[i]
+  cv::Mat descriptors;
+  std::vector<cv::Point2f> keypoints;
+  std::vector<int> owner;
+
+  // flann::Index searches are not const, cameras take turns
+  mutable cv::flann::Index tables;
+  mutable std::mutex tablesMutex;
+};
+
+/**
+ * @brief Recognized paintings of one camera. Matches against the index every
+ * keyframeInterval frames and tracks the paintings it found with optical
+ * flow in between, until too few of their features can be followed.
+ */
+class PaintingRecognizer
+{
+public:
+  PaintingRecognizer(std::shared_ptr<const PaintingIndex> index,
+                     int keyframeInterval,
+                     int minInliers);
+
+  /**
+   * @brief Paintings in this frame's gray image
+   */
+  const std::vector<Recognition>& update(const cv::Mat& gray);
+
+  const PaintingIndex& index() const { return *paintings; }
+
+  /**
+   * @brief True if this frame was matched against the index
+   */
+  bool keyframe() const { return matched; }
+
+private:
+  void follow(const cv::Mat& gray);
+
+  std::shared_ptr<const PaintingIndex> paintings;
+  int keyframeInterval;
+  int minInliers;
+  int framesSinceKeyframe;
+  bool matched = false;
+
+  std::vector<Recognition> found;
+  cv::Mat previous;
+  std::vector<cv::Point2f> next;
+  std::vector<uchar> status;
+  std::vector<float> error;
+};
+}
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Replay a recorded session through the pipeline without a camera or
+ * window and compare the result against golden frames, so a change to the
+ * hot path can be checked for both output and speed.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include "camera_pipeline.h"
+#include "detector_config.h"
+#include "marker_board.h"
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+namespace replay {
+
+/**
+ * @brief Where to read the session and golden frames from. Cameras without an
+ * entry in cameraCalibrations use calibrationFile.
+ */
+struct ReplayOptions
+{
+  std::string sessionFile;
+  std::string goldenDirectory;
+  double minPsnr = 40;
+  std::string calibrationFile;
+  std::vector<std::string> cameraCalibrations;
+  bool useOpenCL = false;
+  bool handleOcclusion = false;
+};
+
+/**
+ * @brief Feeds every frame of the session through a pipeline per recorded
+ * camera and prints per-stage timing. Composited frames are compared by PSNR
+ * against the golden frame of the same name; missing golden frames are
+ * written instead, so the first run records the baseline. Returns 1 if any
+ * frame falls below minPsnr, -1 if the session cannot be read and 0
+ * otherwise.
+ */
+int
+runReplay(const ReplayOptions& options,
+          const detector_config::DetectorConfig& config,
+          const std::vector<marker_board::MarkerBoard>& boards,
+          const camera_pipeline::ExhibitSet& exhibits);
+}
+
+#endif
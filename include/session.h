@@ -0,0 +1,90 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Recorded sessions for reproducing field issues. Every processed
+ * camera frame is appended to a stream file together with what was detected
+ * and tracked in it, so the session can be replayed later without a camera.
+ */
+
+#include <cstdint>
+#include <fstream>
+#include <opencv2/opencv.hpp>
+
+#ifndef SESSION_H
+#define SESSION_H
+
+namespace session {
+
+/**
+ * @brief One detected marker and its corners in the frame
+ */
+struct MarkerDetection
+{
+  int id;
+  cv::Point2f corners[4];
+};
+
+/**
+ * @brief A tracked marker or board (negative key) after the frame
+ */
+struct TrackedPose
+{
+  int key;
+  int state;
+  cv::Vec3d rvec, tvec;
+};
+
+/**
+ * @brief Everything recorded for one camera frame
+ */
+struct FrameRecord
+{
+  int camera = 0;
+  int exhibit = 0;
+  double timestamp = 0;
+  cv::Mat frame;
+  std::vector<MarkerDetection> detections;
+  std::vector<TrackedPose> poses;
+};
+
+/**
+ * @brief Appends frame records to a session file. Each record is length
+ * prefixed, so a session cut short by a crash replays up to its last
+ * complete frame.
+ */
+class SessionWriter
+{
+public:
+  bool open(const std::string& path);
+  bool isOpened() const { return out.is_open(); }
+  bool write(const FrameRecord& record);
+  void close();
+
+private:
+  std::ofstream out;
+  cv::Mat converted;
+  std::vector<uchar> encoded;
+  std::vector<char> payload;
+};
+
+/**
+ * @brief Reads frame records back in the order they were written
+ */
+class SessionReader
+{
+public:
+  bool open(const std::string& path);
+
+  /**
+   * @brief Reads the next record. Returns false at the end of the session or
+   * on a truncated record.
+   */
+  bool read(FrameRecord& record);
+
+private:
+  std::ifstream in;
+  std::vector<char> payload;
+};
+}
+
+#endif
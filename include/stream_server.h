@@ -0,0 +1,116 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Stream the augmented feeds as MJPEG over HTTP for lobby displays
+ * and remote monitors. Each frame is JPEG-encoded once on a worker thread and
+ * the same buffer is sent to every client watching that camera.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+namespace stream_server {
+
+/**
+ * @brief One encoded frame, shared read-only by every client sending it
+ */
+struct EncodedFrame
+{
+  uint64_t sequence = 0;
+  std::vector<uchar> jpeg;
+};
+
+/**
+ * @brief Serves one multipart/x-mixed-replace stream per camera at
+ * /stream/<camera> (/stream and / are camera 0). publish() never blocks the
+ * render loop: it hands the frame to the encoder only when someone is
+ * watching and the previous frame has been taken, and a client still sending
+ * an older frame picks up the newest one when it is done, skipping the rest.
+ */
+class StreamServer
+{
+public:
+  StreamServer(int cameras, int quality = 80);
+  ~StreamServer();
+
+  StreamServer(const StreamServer&) = delete;
+  StreamServer& operator=(const StreamServer&) = delete;
+
+  /**
+   * @brief address is a port on localhost ("8080") or host:port to listen on
+   * another interface ("0.0.0.0:8080")
+   */
+  bool start(const std::string& address);
+  void stop();
+  bool running() const { return listenFd >= 0; }
+
+  /**
+   * @brief Offers the composited frame of a camera for streaming
+   */
+  void publish(int camera, const cv::Mat& frame);
+
+private:
+  struct Channel
+  {
+    // Guarded by encodeMutex
+    cv::Mat pending;
+    bool hasPending = false;
+    uint64_t sequence = 0;
+
+    // Only ever read and replaced with std::atomic_load/atomic_store
+    std::shared_ptr<const EncodedFrame> latest;
+
+    std::atomic<int> clients{ 0 };
+    metrics::Counter* encoded = nullptr;
+    metrics::Counter* skipped = nullptr;
+  };
+
+  struct Client
+  {
+    int fd = -1;
+    int camera = -1;
+    std::string request;
+    bool closing = false;
+
+    // What is being sent: head, then the shared JPEG and a CRLF if any
+    std::string head;
+    std::shared_ptr<const EncodedFrame> frame;
+    size_t offset = 0;
+    uint64_t lastSequence = 0;
+  };
+
+  void encode();
+  void serve();
+  void acceptClient();
+  bool readRequest(Client& client);
+  bool startPart(Client& client);
+  bool sendPending(Client& client);
+  void drop(Client& client);
+
+  int quality;
+  std::vector<std::unique_ptr<Channel>> channels;
+  std::vector<Client> clients;
+  metrics::Gauge& clientCount;
+
+  int listenFd = -1;
+  int wakeFds[2] = { -1, -1 };
+  std::atomic<bool> stopping{ false };
+  std::mutex encodeMutex;
+  std::condition_variable encodeReady;
+  std::thread encoder, worker;
+};
+}
+
+#endif
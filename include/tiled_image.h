@@ -0,0 +1,132 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Paintings stored in small square tiles instead of rows, with a
+ * warp that fills the destination a tile at a time. A rotated painting is
+ * read along slanted lines; in tiles those reads stay within a few cache
+ * lines whatever the angle.
+ */
+
+#include <opencv2/opencv.hpp>
+
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+namespace tiled_image {
+
+/**
+ * @brief How the pixels of a tile are stored. Bgr keeps 3 bytes per pixel.
+ * Yuv420 keeps full resolution luma and chroma at half resolution both ways
+ * (YCrCb as OpenCV converts it), 1.5 bytes per pixel, and is converted back
+ * to BGR by the warp for the pixels it draws only.
+ */
+enum class PixelFormat
+{
+  Bgr,
+  Yuv420
+};
+
+/**
+ * @brief Converts a format name ("bgr" or "yuv420") to its value. Returns
+ * false if the name is unknown.
+ */
+bool
+formatFromName(const std::string& name, PixelFormat& format);
+
+/**
+ * @brief An image laid out in 8x8 pixel tiles, each tile contiguous and the
+ * tiles in row-major order. A Bgr tile holds its pixels in rows of 9, the
+ * ninth column and row repeating the first of the tiles to the right and
+ * below (black past the image), so bilinear reads never leave the tile. A
+ * Yuv420 tile holds 64 luma bytes, then the 4x4 Cb and the 4x4 Cr of the same
+ * pixels.
+ */
+class TiledImage
+{
+public:
+  static const int tileSide = 8;
+  // Bytes from a Bgr pixel to the one below it, in the same tile
+  static const int bgrRowStride = (tileSide + 1) * 3;
+  // A 9x9 Bgr tile takes 243 bytes and is padded to 256
+  static const int bgrTileBytes = 256;
+
+  /**
+   * @brief Copies image, which must be CV_8UC3, into tiles of format. Leaves
+   * the tiled image empty for any other type.
+   */
+  void build(const cv::Mat& image, PixelFormat format = PixelFormat::Bgr);
+
+  /**
+   * @brief Converts the tiles back to a BGR image
+   */
+  void copyTo(cv::Mat& image) const;
+
+  bool empty() const { return data.empty(); }
+  cv::Size size() const { return imageSize; }
+  size_t bytes() const { return data.size(); }
+  PixelFormat format() const { return pixelFormat; }
+
+  /**
+   * @brief First of the three bytes of the pixel at (x, y) of a Bgr image.
+   * The pixels to its right and below are 3 and bgrRowStride bytes further,
+   * even on the last column and row of a tile.
+   */
+  const uchar* at(int x, int y) const { return data.data() + offset(x, y); }
+
+  /**
+   * @brief Luma of the pixel at (x, y) of a Yuv420 image
+   */
+  uchar luma(int x, int y) const { return data[lumaOffset(x, y)]; }
+
+  /**
+   * @brief Cb of the chroma sample at (cx, cy) of a Yuv420 image, which
+   * covers pixels 2 * cx and 2 * cy and their right and lower neighbours. Cr
+   * is 16 bytes further.
+   */
+  const uchar* chroma(int cx, int cy) const
+  {
+    return data.data() + chromaOffset(cx, cy);
+  }
+
+private:
+  size_t tileOf(int x, int y) const
+  {
+    return (size_t)(y >> 3) * tilesPerRow + (x >> 3);
+  }
+  size_t offset(int x, int y) const
+  {
+    return tileOf(x, y) * bgrTileBytes + (y & 7) * bgrRowStride + (x & 7) * 3;
+  }
+  size_t lumaOffset(int x, int y) const
+  {
+    return tileOf(x, y) * 96 + ((y & 7) << 3) + (x & 7);
+  }
+  size_t chromaOffset(int cx, int cy) const
+  {
+    return tileOf(cx << 1, cy << 1) * 96 + 64 + ((cy & 3) << 2) + (cx & 3);
+  }
+
+  cv::Size imageSize;
+  PixelFormat pixelFormat = PixelFormat::Bgr;
+  int tilesPerRow = 0;
+  std::vector<uchar> data;
+};
+
+/**
+ * @brief cv::warpPerspective with INTER_LINEAR and a constant black border,
+ * reading from a tiled painting. Pixels that fall less than a pixel past the
+ * painting's edge are blended with black as warpPerspective does, so the result
+ * matches it to within rounding. Positions are stepped in fixed point across
+ * each 8x8 destination block where that stays within 1/32 pixel of the
+ * perspective divide, which is done per pixel elsewhere. toRoi maps painting
+ * pixels to warped, which is created with roiSize as CV_8UC3 whatever the
+ * painting's format. Blocks are spread over OpenCV's thread pool.
+ */
+void
+warpPerspectiveTiled(const TiledImage& painting,
+                     const cv::Matx33d& toRoi,
+                     cv::Size roiSize,
+                     cv::Mat& warped);
+}
+
+#endif
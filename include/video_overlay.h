@@ -0,0 +1,112 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Play short video loops on markers. Each video is decoded on its own
+ * background thread into a small ring of frames that the render loop pulls
+ * from according to the display clock.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "painting.h"
+
+#ifndef VIDEO_OVERLAY_H
+#define VIDEO_OVERLAY_H
+
+namespace video_overlay {
+
+/**
+ * @brief A looping video exhibit decoded ahead of the render loop
+ */
+class VideoOverlay
+{
+public:
+  /**
+   * @brief Opens the video at path. Its placement on the marker is worked out
+   * from the native aspect ratio and layouts, independent of the resolution
+   * it is decoded at.
+   */
+  VideoOverlay(const std::string& path,
+               const std::map<std::string, painting::Layout>& layouts,
+               float markerLength,
+               size_t ringSize = 4);
+  ~VideoOverlay();
+
+  VideoOverlay(const VideoOverlay&) = delete;
+  VideoOverlay& operator=(const VideoOverlay&) = delete;
+
+  bool isOpened() const { return opened; }
+  const painting::Painting& placement() const { return descriptor; }
+
+  /**
+   * @brief Returns the frame that should be on screen at displayTime (in
+   * seconds). The reference stays valid until the next call.
+   */
+  const cv::Mat& frameAt(double displayTime);
+
+  /**
+   * @brief Counts the frames frameAt has moved on to, so callers can tell a
+   * new frame from the one they already have
+   */
+  long frameNumber() const { return shownFrames; }
+
+  /**
+   * @brief Tells the decoder how large the video currently is on screen so
+   * it can decode at a matching resolution.
+   */
+  void setTargetSize(cv::Size onScreen);
+
+private:
+  struct Slot
+  {
+    cv::Mat frame;
+    double pts = 0;
+  };
+
+  void decodeLoop();
+  bool decodeNext(cv::Size target, cv::Mat& frame, double& pts);
+  bool isVisible() const;
+
+  std::string path;
+  cv::VideoCapture capture;
+  painting::Painting descriptor;
+  cv::Size nativeSize, decodeSize;
+  double fps = 25;
+  bool opened = false;
+
+  // Decoder state, only touched by the decode thread after construction
+  cv::Mat decoded;
+  double loopOffset = 0;
+  long frameIndex = 0;
+
+  // Ring of decoded frames, guarded by ringMutex
+  std::vector<Slot> ring;
+  size_t head = 0, count = 0;
+  bool stopping = false;
+  std::chrono::steady_clock::time_point lastRequest;
+  std::mutex ringMutex;
+  std::condition_variable ringChanged;
+
+  // Consumer state, only touched by the render thread
+  cv::Mat current;
+  double playbackTime = 0;
+  double lastDisplayTime = -1;
+  long shownFrames = 0;
+
+  std::thread decoder;
+};
+
+/**
+ * @brief Opens every video found in a directory as a looping exhibit
+ */
+std::vector<std::shared_ptr<VideoOverlay>>
+loadVideosFromDirectory(std::string path, float markerLength);
+}
+
+#endif
@@ -4,6 +4,7 @@
  * Purpose: Provide utilities to the main functionality of the application
  */
 
+#include <algorithm>
 #include <ctime>
 #include <filesystem>
 #include <iostream>
@@ -20,19 +21,19 @@ namespace fs = std::__fs::filesystem;
 namespace ar_utils {
 
 /**
- * @brief Creates a new Aruco marker and saves it to a file
+ * @brief Creates a new Aruco marker from dictionary, markerSize pixels wide,
+ * and saves it to a file
  */
 void
-createArucoMarker(int markerId)
+createArucoMarker(int markerId,
+                  const aruco::Dictionary& dictionary,
+                  int markerSize)
 {
   cout << "Creating new ArUco marker..." << endl;
   Mat markerImage;
-  aruco::Dictionary arucoDict =
-    aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
-  int markerSize = 200;
   int borderBits = 1;
   aruco::generateImageMarker(
-    arucoDict, markerId, markerSize, markerImage, borderBits);
+    dictionary, markerId, markerSize, markerImage, borderBits);
   string filename = "aruco_marker_" + to_string(markerId) + ".png";
   imwrite(filename, markerImage);
   cout << "ArUco Marker created and saved as " << filename << endl;
@@ -118,7 +119,7 @@ printBorder()
  * @brief Saves a screenshot of the current frame
  */
 void
-screenshot(Mat& frame)
+screenshot(Mat& frame, string suffix)
 {
   time_t time_now = time(nullptr);
   char buffer[80];
@@ -127,6 +128,7 @@ screenshot(Mat& frame)
 
   string filename = "img/";
   filename += buffer;
+  filename += suffix;
   filename += ".png";
 
   imwrite(filename, frame);
@@ -134,55 +136,48 @@ screenshot(Mat& frame)
 }
 
 /**
- * @brief Load images from a given directory into an array
+ * @brief Returns true if the file extension is a video container
  */
-vector<Mat>
-loadImagesFromDirectory(string path)
+bool
+isVideoFile(const string& path)
 {
-  printBorder();
-  cout << "Loading images from " << path << endl;
-  vector<Mat> images;
-
-  for (const auto& file : fs::directory_iterator(path)) {
-    try {
-      Mat image = imread(file.path().string());
-      Mat overlay;
-      if (image.empty()) {
-        cerr << "Failed to load image: " << file.path().string() << endl;
-        continue;
-      }
-
-      double aspectX = (double)560 / image.cols;
-      double aspectY = (double)720 / image.rows;
-      resize(image, overlay, Size(), aspectX, aspectY, INTER_LINEAR);
-      cout << "Loaded image: " << file.path().string() << endl;
-      images.push_back(overlay);
-
-    } catch (const Exception& e) {
-      cerr << e.what() << endl;
-    }
-  }
-
-  if (images.empty()) {
-    cerr << "Unable to load images" << endl;
-    return images;
-  }
+  static const vector<string> extensions = { ".mp4", ".m4v", ".mov",
+                                             ".avi", ".mkv", ".webm" };
+  string extension = fs::path(path).extension().string();
+  std::transform(
+    extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return std::find(extensions.begin(), extensions.end(), extension) !=
+         extensions.end();
+}
 
-  cout << "Number of images loaded:  " << images.size() << endl;
-  return images;
+/**
+ * @brief Returns true if the file extension is an image format imread reads
+ */
+bool
+isImageFile(const string& path)
+{
+  static const vector<string> extensions = {
+    ".bmp", ".dib", ".jpeg", ".jpg", ".jpe",  ".jp2", ".png", ".webp",
+    ".pbm", ".pgm", ".ppm",  ".pxm", ".pnm",  ".pfm", ".sr",  ".ras",
+    ".tif", ".tiff", ".exr", ".hdr", ".pic", ".avif"
+  };
+  string extension = fs::path(path).extension().string();
+  std::transform(
+    extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return std::find(extensions.begin(), extensions.end(), extension) !=
+         extensions.end();
 }
 
 /**
  * @brief Set the coordinates for the ArUco marker
  */
 Mat
-setCoordinateSystem(int markerSize)
+setCoordinateSystem(float markerLength)
 {
   printBorder();
-  cout << "Setting coordinate system for ArUco marker size " << markerSize
+  cout << "Setting coordinate system for ArUco marker size " << markerLength
        << endl;
 
-  int markerLength = 200;
   Mat objPoints(4, 1, CV_32FC3);
 
   objPoints.ptr<Vec3f>(0)[0] =
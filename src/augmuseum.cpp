@@ -0,0 +1,234 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: C interface to the engine, for host applications that are not
+ * built with the same C++ compiler and OpenCV. Frames stay owned by the host
+ * and are composited where they are.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+#include "../include/augmuseum.h"
+#include "../include/detector_config.h"
+#include "../include/engine.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief An engine and the BGR copy BGRA32 frames are composited in
+ */
+struct augmuseum_context
+{
+  engine::Engine engine;
+  Mat converted;
+};
+
+/**
+ * @brief The caller's pixels as a Mat, without a copy. Empty if the frame is
+ * malformed.
+ */
+static Mat
+wrapFrame(const augmuseum_frame& frame)
+{
+  if (frame.format != AUGMUSEUM_FORMAT_BGR24 &&
+      frame.format != AUGMUSEUM_FORMAT_BGRA32) {
+    return Mat();
+  }
+  int channels = frame.format == AUGMUSEUM_FORMAT_BGRA32 ? 4 : 3;
+  if (!frame.data || frame.width <= 0 || frame.height <= 0 ||
+      frame.stride < (size_t)frame.width * channels) {
+    return Mat();
+  }
+  return Mat(frame.height,
+             frame.width,
+             CV_8UC(channels),
+             frame.data,
+             frame.stride);
+}
+
+/**
+ * @brief True if context has a camera at index
+ */
+static bool
+validCamera(const augmuseum_context* context, int camera)
+{
+  return context && camera >= 0 && camera < context->engine.cameraCount();
+}
+
+extern "C" {
+
+/**
+ * @brief Fills options with the defaults
+ */
+void
+augmuseum_default_options(augmuseum_options* options)
+{
+  if (!options) {
+    return;
+  }
+  options->painting_directory = "bin/paintings";
+  options->detector_config = "bin/detector_config.yml";
+  options->board_file = nullptr;
+  options->painting_index = nullptr;
+  options->handle_occlusion = 0;
+  options->yuv420_paintings = 0;
+}
+
+/**
+ * @brief Loads the paintings and detector settings of options (the defaults
+ * if NULL). Returns NULL on failure.
+ */
+augmuseum_context*
+augmuseum_create(const augmuseum_options* options)
+{
+  augmuseum_options defaults;
+  augmuseum_default_options(&defaults);
+  const augmuseum_options& given = options ? *options : defaults;
+
+  // Exceptions must not cross into the caller's C code
+  try {
+    engine::EngineOptions engineOptions;
+    if (given.painting_directory) {
+      engineOptions.paintingDirectory = given.painting_directory;
+    }
+    detector_config::loadDetectorConfig(given.detector_config
+                                          ? given.detector_config
+                                          : defaults.detector_config,
+                                        engineOptions.detectorConfig);
+    if (given.board_file) {
+      engineOptions.boardFile = given.board_file;
+    }
+    if (given.painting_index) {
+      engineOptions.paintingIndexFile = given.painting_index;
+    }
+    engineOptions.handleOcclusion = given.handle_occlusion != 0;
+    if (given.yuv420_paintings) {
+      engineOptions.paintingFormat = tiled_image::PixelFormat::Yuv420;
+    }
+
+    unique_ptr<augmuseum_context> context(new augmuseum_context());
+    if (!context->engine.open(engineOptions)) {
+      return nullptr;
+    }
+    return context.release();
+  } catch (const exception& e) {
+    cerr << "Failed to create augmuseum context: " << e.what() << endl;
+    return nullptr;
+  }
+}
+
+void
+augmuseum_destroy(augmuseum_context* context)
+{
+  delete context;
+}
+
+/**
+ * @brief Adds a camera with the calibration in calibration_file. name labels
+ * its metrics. Returns its index, or -1 on failure.
+ */
+int
+augmuseum_add_camera(augmuseum_context* context,
+                     const char* name,
+                     const char* calibration_file)
+{
+  if (!context || !name || !calibration_file) {
+    return -1;
+  }
+  try {
+    return context->engine.addCamera(name, calibration_file);
+  } catch (const exception& e) {
+    cerr << "Failed to add camera " << name << ": " << e.what() << endl;
+    return -1;
+  }
+}
+
+int
+augmuseum_exhibit_count(const augmuseum_context* context)
+{
+  return context ? context->engine.exhibitCount() : 0;
+}
+
+/**
+ * @brief Makes the exhibit at index the one drawn. Returns -1 on failure.
+ */
+int
+augmuseum_select_exhibit(augmuseum_context* context, int index)
+{
+  if (!context || index < 0 || index >= context->engine.exhibitCount()) {
+    return -1;
+  }
+  context->engine.select(index);
+  return 0;
+}
+
+/**
+ * @brief Detects markers in a frame seen by camera and draws the current
+ * exhibit onto them, in the frame's own buffer. The buffer is not kept after
+ * the call. Returns 1 if anything was drawn, 0 if not and -1 on failure.
+ */
+int
+augmuseum_composite(augmuseum_context* context,
+                    int camera,
+                    const augmuseum_frame* frame)
+{
+  if (!validCamera(context, camera) || !frame) {
+    return -1;
+  }
+  Mat pixels = wrapFrame(*frame);
+  if (pixels.empty()) {
+    cerr << "Malformed frame passed to augmuseum_composite" << endl;
+    return -1;
+  }
+
+  try {
+    if (pixels.type() == CV_8UC3) {
+      Rect drawn =
+        context->engine.composite(camera, pixels, frame->timestamp);
+      return drawn.area() > 0 ? 1 : 0;
+    }
+
+    // The compositor blends into BGR; the alpha channel is left as it was
+    cvtColor(pixels, context->converted, COLOR_BGRA2BGR);
+    Rect drawn = context->engine.composite(
+      camera, context->converted, frame->timestamp);
+    if (drawn.area() > 0) {
+      const int fromTo[] = { 0, 0, 1, 1, 2, 2 };
+      mixChannels(&context->converted, 1, &pixels, 1, fromTo, 3);
+    }
+    return drawn.area() > 0 ? 1 : 0;
+  } catch (const exception& e) {
+    cerr << "Failed to composite frame: " << e.what() << endl;
+    return -1;
+  }
+}
+
+/**
+ * @brief Copies up to capacity of the markers camera found in its last frame
+ * to markers. Returns how many it found, or -1 on failure.
+ */
+int
+augmuseum_markers(const augmuseum_context* context,
+                  int camera,
+                  augmuseum_marker* markers,
+                  int capacity)
+{
+  if (!validCamera(context, camera) || (capacity > 0 && !markers)) {
+    return -1;
+  }
+  const vector<session::MarkerDetection>& found =
+    context->engine.camera(camera).detections();
+  int copied = min(capacity, (int)found.size());
+  for (int i = 0; i < copied; i++) {
+    markers[i].id = found[i].id;
+    for (int k = 0; k < 4; k++) {
+      markers[i].corners[2 * k] = found[i].corners[k].x;
+      markers[i].corners[2 * k + 1] = found[i].corners[k].y;
+    }
+  }
+  return (int)found.size();
+}
+}
@@ -0,0 +1,232 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Sweep ArUco detector parameters over a recorded clip and report
+ * detection rate against time per frame.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/autotune.h"
+
+using namespace std;
+using namespace cv;
+
+namespace autotune {
+
+// Candidates within this much of the best detection rate count as equally
+// good, and the fastest of them is written out
+static const double rateTolerance = 0.01;
+
+/**
+ * @brief One parameter combination and how it did on the clip
+ */
+struct Candidate
+{
+  aruco::DetectorParameters parameters;
+  vector<int> detections;
+  double msPerFrame = 0;
+  double detectionRate = 0;
+};
+
+/**
+ * @brief Reads up to maxFrames frames spread evenly over the clip. Frames are
+ * kept in grayscale, which is what the detector thresholds anyway.
+ */
+static vector<Mat>
+loadClip(const string& clipPath, int maxFrames)
+{
+  vector<Mat> frames;
+  VideoCapture clip(clipPath);
+  if (!clip.isOpened()) {
+    cerr << "Failed to open clip: " << clipPath << endl;
+    return frames;
+  }
+
+  int frameCount = (int)clip.get(CAP_PROP_FRAME_COUNT);
+  int stride = frameCount > maxFrames ? frameCount / maxFrames : 1;
+
+  Mat frame;
+  for (int i = 0; clip.read(frame) && (int)frames.size() < maxFrames; i++) {
+    if (i % stride != 0) {
+      continue;
+    }
+    Mat gray;
+    cvtColor(frame, gray, COLOR_BGR2GRAY);
+    frames.push_back(gray);
+  }
+
+  cout << "Loaded " << frames.size() << " frames from " << clipPath << endl;
+  return frames;
+}
+
+/**
+ * @brief Every combination of the swept parameters, starting from base
+ */
+static vector<Candidate>
+buildCandidates(const aruco::DetectorParameters& base)
+{
+  const int winMins[] = { 3, 5 };
+  const int winMaxes[] = { 15, 23, 33 };
+  const int winSteps[] = { 4, 10 };
+  const double perimeterRates[] = { 0.01, 0.03, 0.05 };
+  const aruco::CornerRefineMethod refinements[] = {
+    aruco::CORNER_REFINE_NONE,
+    aruco::CORNER_REFINE_SUBPIX,
+    aruco::CORNER_REFINE_CONTOUR
+  };
+
+  vector<Candidate> candidates;
+  for (int winMin : winMins) {
+    for (int winMax : winMaxes) {
+      for (int winStep : winSteps) {
+        for (double perimeterRate : perimeterRates) {
+          for (aruco::CornerRefineMethod refinement : refinements) {
+            Candidate candidate;
+            candidate.parameters = base;
+            candidate.parameters.adaptiveThreshWinSizeMin = winMin;
+            candidate.parameters.adaptiveThreshWinSizeMax = winMax;
+            candidate.parameters.adaptiveThreshWinSizeStep = winStep;
+            candidate.parameters.minMarkerPerimeterRate = perimeterRate;
+            candidate.parameters.cornerRefinementMethod = refinement;
+            candidates.push_back(candidate);
+          }
+        }
+      }
+    }
+  }
+  return candidates;
+}
+
+/**
+ * @brief Prints one row of the results table
+ */
+static void
+printCandidate(const Candidate& candidate)
+{
+  const aruco::DetectorParameters& p = candidate.parameters;
+  cout << fixed << setprecision(2) << setw(10) << candidate.msPerFrame
+       << setw(11) << setprecision(1) << candidate.detectionRate * 100 << "%"
+       << setw(8) << p.adaptiveThreshWinSizeMin << setw(8)
+       << p.adaptiveThreshWinSizeMax << setw(6) << p.adaptiveThreshWinSizeStep
+       << setw(11) << setprecision(2) << p.minMarkerPerimeterRate << setw(8)
+       << p.cornerRefinementMethod << endl;
+}
+
+/**
+ * @brief Runs every parameter combination over up to maxFrames frames of
+ * clipPath, prints the Pareto front of detection rate vs. ms/frame and writes
+ * the chosen parameter set to outputPath. config provides the dictionary and
+ * the starting parameters.
+ */
+int
+tuneDetector(const string& clipPath,
+             const detector_config::DetectorConfig& config,
+             int maxFrames,
+             const string& outputPath)
+{
+  ar_utils::printBorder();
+  cout << "Auto-tuning detector parameters" << endl;
+
+  vector<Mat> frames = loadClip(clipPath, maxFrames);
+  if (frames.empty()) {
+    return -1;
+  }
+
+  aruco::Dictionary dictionary = config.getDictionary();
+  vector<Candidate> candidates = buildCandidates(config.parameters);
+  vector<int> reference(frames.size(), 0);
+
+  for (size_t c = 0; c < candidates.size(); c++) {
+    Candidate& candidate = candidates[c];
+    aruco::ArucoDetector detector(dictionary, candidate.parameters);
+    vector<int> markerIds;
+    vector<vector<Point2f>> markerCorners;
+
+    TickMeter timer;
+    for (size_t f = 0; f < frames.size(); f++) {
+      timer.start();
+      detector.detectMarkers(frames[f], markerCorners, markerIds);
+      timer.stop();
+      candidate.detections.push_back((int)markerIds.size());
+      reference[f] = max(reference[f], (int)markerIds.size());
+    }
+    candidate.msPerFrame = timer.getTimeMilli() / frames.size();
+
+    if ((c + 1) % 10 == 0 || c + 1 == candidates.size()) {
+      cout << "Evaluated " << c + 1 << "/" << candidates.size()
+           << " parameter sets" << endl;
+    }
+  }
+
+  // The most markers any parameter set found in a frame is taken as the
+  // number of markers actually in it
+  int referenceTotal = 0;
+  for (int count : reference) {
+    referenceTotal += count;
+  }
+  if (referenceTotal == 0) {
+    cerr << "No markers were detected in the clip with any parameters" << endl;
+    return -1;
+  }
+  for (Candidate& candidate : candidates) {
+    int total = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+      total += min(candidate.detections[f], reference[f]);
+    }
+    candidate.detectionRate = (double)total / referenceTotal;
+  }
+
+  // Pareto front: nothing else is both at least as fast and at least as good
+  vector<const Candidate*> front;
+  for (const Candidate& a : candidates) {
+    bool dominated = false;
+    for (const Candidate& b : candidates) {
+      if (b.detectionRate >= a.detectionRate && b.msPerFrame <= a.msPerFrame &&
+          (b.detectionRate > a.detectionRate || b.msPerFrame < a.msPerFrame)) {
+        dominated = true;
+        break;
+      }
+    }
+    if (!dominated) {
+      front.push_back(&a);
+    }
+  }
+  sort(front.begin(), front.end(), [](const Candidate* a, const Candidate* b) {
+    return a->msPerFrame < b->msPerFrame;
+  });
+
+  ar_utils::printBorder();
+  cout << "Pareto front (" << front.size() << " of " << candidates.size()
+       << " parameter sets):" << endl;
+  cout << "  ms/frame  detection  winMin  winMax  step  perimeter  refine"
+       << endl;
+  double bestRate = 0;
+  for (const Candidate* candidate : front) {
+    printCandidate(*candidate);
+    bestRate = max(bestRate, candidate->detectionRate);
+  }
+
+  // Fastest set that detects practically as well as the best one
+  const Candidate* chosen = front.back();
+  for (const Candidate* candidate : front) {
+    if (candidate->detectionRate >= bestRate - rateTolerance) {
+      chosen = candidate;
+      break;
+    }
+  }
+
+  cout << "\nChosen parameter set:" << endl;
+  printCandidate(*chosen);
+
+  detector_config::DetectorConfig tuned = config;
+  tuned.parameters = chosen->parameters;
+  return detector_config::saveDetectorConfig(outputPath, tuned);
+}
+
+}
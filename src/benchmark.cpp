@@ -0,0 +1,382 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Time the compositing pipeline on a synthetic scene so changes to
+ * the hot path can be compared without a camera attached.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/benchmark.h"
+#include "../include/composite_kernels.h"
+#include "../include/compositor.h"
+#include "../include/tiled_image.h"
+
+using namespace std;
+using namespace cv;
+
+namespace benchmark {
+
+static const int warmupIterations = 5;
+
+/**
+ * @brief Builds a pinhole camera matrix for the synthetic frame when no
+ * calibration has been loaded.
+ */
+static Mat
+defaultCameraMatrix(Size frameSize)
+{
+  return (Mat_<double>(3, 3) << frameSize.width,
+          0,
+          frameSize.width / 2.0,
+          0,
+          frameSize.width,
+          frameSize.height / 2.0,
+          0,
+          0,
+          1);
+}
+
+/**
+ * @brief Prints one line of the results table
+ */
+static void
+printResult(const string& label, double totalMs, int iterations)
+{
+  double perFrame = totalMs / iterations;
+  cout << left << setw(32) << label << right << fixed << setprecision(3)
+       << setw(10) << perFrame << " ms/frame" << setw(10) << setprecision(1)
+       << 1000.0 / perFrame << " fps" << endl;
+}
+
+/**
+ * @brief Times the warp alone from the row-major painting and from its BGR
+ * and YUV 4:2:0 tiles while the marker turns in its own plane. Rows of a
+ * painting turned by 90 degrees are read down its columns, the worst case for
+ * row-major storage.
+ */
+static void
+benchmarkTiledWarp(const painting::Painting& painting,
+                   Size frameSize,
+                   const Mat& K,
+                   const Mat& D,
+                   int iterations)
+{
+  const Mat& overlay = painting.image;
+  if (overlay.type() != CV_8UC3) {
+    return;
+  }
+  tiled_image::TiledImage tiled, compact;
+  tiled.build(overlay);
+  compact.build(overlay, tiled_image::PixelFormat::Yuv420);
+
+  cout << "Warp only, painting close to the camera (" << fixed
+       << setprecision(0) << overlay.total() * overlay.elemSize() / 1024.0
+       << " KiB row-major, " << tiled.bytes() / 1024.0 << " KiB tiled, "
+       << compact.bytes() / 1024.0 << " KiB yuv420):" << endl;
+  Vec3d tvec(0, 0, 1.5 * painting.physicalSize.height);
+  Mat warped;
+  for (int degrees : { 0, 45, 90 }) {
+    Vec3d rvec(0, 0, degrees * CV_PI / 180);
+    compositor::Placement placement;
+    if (!compositor::placeOverlay(frameSize,
+                                  overlay.size(),
+                                  painting.objectCorners,
+                                  rvec,
+                                  tvec,
+                                  K,
+                                  D,
+                                  placement)) {
+      continue;
+    }
+    const Rect& roi = placement.roi;
+    Matx33d toRoi =
+      Matx33d(1, 0, -roi.x, 0, 1, -roi.y, 0, 0, 1) * placement.homography;
+
+    TickMeter rowTimer, tiledTimer, compactTimer;
+    for (int i = -warmupIterations; i < iterations; i++) {
+      if (i == 0) {
+        rowTimer.start();
+      }
+      warpPerspective(overlay, warped, toRoi, roi.size());
+    }
+    rowTimer.stop();
+    for (int i = -warmupIterations; i < iterations; i++) {
+      if (i == 0) {
+        tiledTimer.start();
+      }
+      tiled_image::warpPerspectiveTiled(tiled, toRoi, roi.size(), warped);
+    }
+    tiledTimer.stop();
+    for (int i = -warmupIterations; i < iterations; i++) {
+      if (i == 0) {
+        compactTimer.start();
+      }
+      tiled_image::warpPerspectiveTiled(compact, toRoi, roi.size(), warped);
+    }
+    compactTimer.stop();
+
+    string angle = to_string(degrees) + " deg";
+    printResult("  row-major, " + angle, rowTimer.getTimeMilli(), iterations);
+    printResult("  tiled 8x8, " + angle, tiledTimer.getTimeMilli(), iterations);
+    printResult(
+      "  tiled yuv420, " + angle, compactTimer.getTimeMilli(), iterations);
+  }
+}
+
+/**
+ * @brief Prints the memory the whole collection takes in each painting
+ * format. Paintings with an alpha channel are kept as they are in both.
+ */
+static void
+printPaintingMemory(const vector<painting::Painting>& paintings)
+{
+  double bgr = 0, yuv420 = 0;
+  for (const painting::Painting& painting : paintings) {
+    Size size = compositor::overlaySize(painting.image, painting.tiled.get());
+    if (painting.image.channels() == 4) {
+      bgr += size.area() * 4.0;
+      yuv420 += size.area() * 4.0;
+      continue;
+    }
+    int side = tiled_image::TiledImage::tileSide;
+    double tiles = (double)((size.width + side - 1) / side) *
+                   ((size.height + side - 1) / side);
+    bgr += size.area() * 3.0;
+    yuv420 += tiles * (side * side * 3 / 2);
+  }
+  cout << "Paintings in memory: " << fixed << setprecision(1)
+       << bgr / (1 << 20) << " MiB as bgr, " << yuv420 / (1 << 20)
+       << " MiB as yuv420" << endl;
+}
+
+/**
+ * @brief Total milliseconds for iterations runs of body, after a warmup
+ */
+template<typename Body>
+static double
+timeMilli(int iterations, Body body)
+{
+  TickMeter timer;
+  for (int i = -warmupIterations; i < iterations; i++) {
+    if (i == 0) {
+      timer.start();
+    }
+    body();
+  }
+  timer.stop();
+  return timer.getTimeMilli();
+}
+
+/**
+ * @brief Times each specialization of the composite kernels: a BGR, a
+ * half-transparent BGRA and a grayscale painting onto a matching frame. Each
+ * is drawn with the generic two passes (warpPerspective, then a masked copy
+ * or the blend kernel) and with the fused kernel for both interpolations.
+ */
+static void
+benchmarkKernels(const painting::Painting& painting,
+                 const Mat& frame,
+                 const Vec3d& rvec,
+                 const Vec3d& tvec,
+                 const Mat& K,
+                 const Mat& D,
+                 int iterations)
+{
+  compositor::Placement placement;
+  if (!compositor::placeOverlay(frame.size(),
+                                painting.image.size(),
+                                painting.objectCorners,
+                                rvec,
+                                tvec,
+                                K,
+                                D,
+                                placement)) {
+    return;
+  }
+  const Rect& roi = placement.roi;
+  Matx33d toRoi =
+    Matx33d(1, 0, -roi.x, 0, 1, -roi.y, 0, 0, 1) * placement.homography;
+  Point polygon[4];
+  for (int i = 0; i < 4; i++) {
+    polygon[i] = placement.polygon[i] - roi.tl();
+  }
+  Mat mask(roi.size(), CV_8UC1, Scalar(0));
+  fillConvexPoly(mask, polygon, 4, Scalar(255));
+
+  Mat bgr, bgra, gray, grayFrame;
+  if (painting.image.channels() == 4) {
+    cvtColor(painting.image, bgr, COLOR_BGRA2BGR);
+  } else {
+    bgr = painting.image;
+  }
+  cvtColor(bgr, bgra, COLOR_BGR2BGRA);
+  insertChannel(Mat(bgr.size(), CV_8UC1, Scalar(160)), bgra, 3);
+  cvtColor(bgr, gray, COLOR_BGR2GRAY);
+  cvtColor(frame, grayFrame, COLOR_BGR2GRAY);
+
+  struct Case
+  {
+    string name;
+    const Mat* overlay;
+    const Mat* frame;
+  };
+  const Case cases[] = { { "BGR", &bgr, &frame },
+                         { "BGRA", &bgra, &frame },
+                         { "gray", &gray, &grayFrame } };
+
+  cout << "Composite kernels, warp and blend of the painting only:" << endl;
+  Mat dest, warped;
+  for (const Case& c : cases) {
+    c.frame->copyTo(dest);
+    Mat destRoi = dest(roi);
+
+    // Only an opaque painting can be drawn with a plain masked copy
+    if (c.overlay->channels() != 4) {
+      printResult("  " + c.name + ", warp + copyTo",
+                  timeMilli(iterations,
+                            [&] {
+                              warpPerspective(
+                                *c.overlay, warped, toRoi, roi.size());
+                              warped.copyTo(destRoi, mask);
+                            }),
+                  iterations);
+    }
+    printResult("  " + c.name + ", warp + blend",
+                timeMilli(iterations,
+                          [&] {
+                            warpPerspective(
+                              *c.overlay, warped, toRoi, roi.size());
+                            composite_kernels::blend(warped, mask, destRoi);
+                          }),
+                iterations);
+    printResult("  " + c.name + ", fused linear",
+                timeMilli(iterations,
+                          [&] {
+                            composite_kernels::composite(
+                              *c.overlay, toRoi, mask, INTER_LINEAR, destRoi);
+                          }),
+                iterations);
+    printResult("  " + c.name + ", fused nearest",
+                timeMilli(iterations,
+                          [&] {
+                            composite_kernels::composite(
+                              *c.overlay, toRoi, mask, INTER_NEAREST, destRoi);
+                          }),
+                iterations);
+  }
+}
+
+/**
+ * @brief Runs the compositor over a synthetic frame and pose and prints the
+ * average time per frame for the CPU and the UMat paths.
+ */
+void
+runCompositorBenchmark(const vector<painting::Painting>& paintings,
+                       const Mat& camMatrix,
+                       const Mat& dCoeffs,
+                       int iterations)
+{
+  ar_utils::printBorder();
+  if (paintings.empty() || iterations <= 0) {
+    cerr << "Benchmark needs at least one painting and one iteration" << endl;
+    return;
+  }
+
+  Size frameSize(1280, 720);
+  Mat frame(frameSize, CV_8UC3);
+  randu(frame, Scalar::all(0), Scalar::all(255));
+
+  Mat K = camMatrix.empty() ? defaultCameraMatrix(frameSize) : camMatrix;
+  Mat D = camMatrix.empty() ? Mat() : dCoeffs;
+
+  // A marker tilted away from the camera, roughly centred in the frame
+  Vec3d rvec(0.35, -0.25, 0.1);
+  // A painting kept only in tiles is decoded for the row-major paths
+  painting::Painting painting = paintings[0];
+  if (painting.image.empty() && painting.tiled) {
+    painting.tiled->copyTo(painting.image);
+  }
+  Vec3d tvec(0, 0, 4 * painting.physicalSize.height);
+  const Mat& overlay = painting.image;
+
+  cout << "Compositor benchmark: " << iterations << " iterations, "
+       << frameSize.width << "x" << frameSize.height << " frame, "
+       << overlay.cols << "x" << overlay.rows << " painting" << endl;
+
+  bool wasActive = compositor::openCLActive();
+
+  // CPU path
+  ocl::setUseOpenCL(false);
+  Mat dest;
+  TickMeter cpuTimer;
+  for (int i = -warmupIterations; i < iterations; i++) {
+    if (i == 0) {
+      cpuTimer.start();
+    }
+    frame.copyTo(dest);
+    compositor::overlayImage2(
+      frame, dest, overlay, painting.objectCorners, rvec, tvec, K, D);
+  }
+  cpuTimer.stop();
+  printResult("Mat (CPU)", cpuTimer.getTimeMilli(), iterations);
+
+  // Same pose every frame, as for a marker on a wall in front of a mounted
+  // camera: after the first frame only the ROI blend is left
+  compositor::Placement placement;
+  compositor::WarpCache warpCache;
+  compositor::placeOverlay(frameSize,
+                           overlay.size(),
+                           painting.objectCorners,
+                           rvec,
+                           tvec,
+                           K,
+                           D,
+                           placement);
+  TickMeter staticTimer;
+  for (int i = -warmupIterations; i < iterations; i++) {
+    if (i == 0) {
+      staticTimer.start();
+    }
+    frame.copyTo(dest);
+    compositor::drawOverlay(
+      frame, dest, overlay, placement, nullptr, &warpCache);
+  }
+  staticTimer.stop();
+  printResult(
+    "Mat (CPU, static pose)", staticTimer.getTimeMilli(), iterations);
+
+  // Transparent API path, including the upload and the download a live
+  // frame pays for
+  ocl::setUseOpenCL(ocl::haveOpenCL());
+  string label = ocl::useOpenCL()
+                   ? "UMat (" + ocl::Device::getDefault().name() + ")"
+                   : "UMat (no OpenCL, CPU fallback)";
+  UMat uFrame, uDest, uOverlay;
+  overlay.copyTo(uOverlay);
+  TickMeter umatTimer;
+  for (int i = -warmupIterations; i < iterations; i++) {
+    if (i == 0) {
+      umatTimer.start();
+    }
+    frame.copyTo(uFrame);
+    uFrame.copyTo(uDest);
+    compositor::overlayImage2(
+      uFrame, uDest, uOverlay, painting.objectCorners, rvec, tvec, K, D);
+    uDest.copyTo(dest);
+  }
+  umatTimer.stop();
+  printResult(label, umatTimer.getTimeMilli(), iterations);
+
+  ocl::setUseOpenCL(wasActive);
+
+  benchmarkKernels(painting, frame, rvec, tvec, K, D, iterations);
+  benchmarkTiledWarp(painting, frameSize, K, D, iterations);
+  printPaintingMemory(paintings);
+}
+
+}
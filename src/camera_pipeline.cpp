@@ -0,0 +1,833 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-camera detection and compositing. Each capture source gets its
+ * own pipeline with its own calibration, while the paintings are shared by
+ * every camera in the process.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/camera_pipeline.h"
+#include "../include/compositor.h"
+#include "../include/prefetch.h"
+
+using namespace std;
+using namespace cv;
+
+namespace camera_pipeline {
+
+// Seconds ahead a coasting painting is moved along with its last motion.
+// Past that it is held where the prediction ended.
+static const double maxPrediction = 0.1;
+
+/**
+ * @brief Builds markerPaintings from the marker ids of each painting and
+ * namedPaintings from their names
+ */
+void
+ExhibitSet::indexMarkers()
+{
+  markerPaintings.clear();
+  namedPaintings.clear();
+  for (size_t i = 0; i < paintings.size(); i++) {
+    for (int id : paintings[i].markerIds) {
+      markerPaintings[id] = i;
+    }
+    namedPaintings[paintings[i].name] = i;
+  }
+}
+
+/**
+ * @brief The painting's pixels in the same container as the current overlay
+ */
+static const Mat&
+pixelsOf(const painting::Painting& painting, const Mat&)
+{
+  return painting.image;
+}
+
+static const UMat&
+pixelsOf(const painting::Painting& painting, const UMat&)
+{
+  return painting.uImage;
+}
+
+/**
+ * @brief Resolves the exhibit at index into the frame to draw at displayTime.
+ * Video exhibits are advanced here, once per frame, rather than per camera.
+ */
+void
+selectExhibit(const ExhibitSet& exhibits,
+              int index,
+              double displayTime,
+              bool useOpenCL,
+              OverlayFrame& overlay)
+{
+  // The corners are only copied when the exhibit or its placement changes,
+  // not every frame
+  bool sameExhibit = index == overlay.exhibit;
+  overlay.exhibit = index;
+
+  if (index < (int)exhibits.paintings.size()) {
+    const painting::Painting& painting = exhibits.paintings[index];
+    overlay.image = painting.image;
+    if (!sameExhibit || painting.version != overlay.version) {
+      overlay.objectCorners = painting.objectCorners;
+    }
+    overlay.version = painting.version;
+    overlay.tiled = painting.tiled;
+    if (useOpenCL) {
+      overlay.uImage = painting.uImage;
+    }
+    return;
+  }
+
+  // Each video gets its own range of versions above those of the stills
+  size_t videoIndex = index - exhibits.paintings.size();
+  video_overlay::VideoOverlay& video = *exhibits.videos[videoIndex];
+  overlay.image = video.frameAt(displayTime);
+  if (!sameExhibit || overlay.version >> 32 != video.placement().version) {
+    overlay.objectCorners = video.placement().objectCorners;
+  }
+  overlay.tiled.reset();
+  int64_t version =
+    (video.placement().version << 32) + (int64_t)video.frameNumber();
+  bool newFrame = version != overlay.version || overlay.uVideoFrame.empty();
+  overlay.version = version;
+
+  // The upload is skipped while the video holds the same frame
+  if (useOpenCL) {
+    if (newFrame) {
+      overlay.image.copyTo(overlay.uVideoFrame);
+    }
+    overlay.uImage = overlay.uVideoFrame;
+  }
+}
+
+/**
+ * @brief Registers the metrics of the camera reading from source
+ */
+CameraMetrics::CameraMetrics(const string& source)
+  : frames(metrics::registry().counter("augmuseum_frames_total",
+                                       "Frames processed",
+                                       metrics::label("camera", source)))
+  , dropped(metrics::registry().counter("augmuseum_frames_dropped_total",
+                                        "Frames that could not be grabbed "
+                                        "or decoded",
+                                        metrics::label("camera", source)))
+  , framesWithMarkers(
+      metrics::registry().counter("augmuseum_frames_with_markers_total",
+                                  "Frames in which at least one marker was "
+                                  "detected",
+                                  metrics::label("camera", source)))
+  , markersDetected(
+      metrics::registry().counter("augmuseum_markers_detected_total",
+                                  "Marker detections",
+                                  metrics::label("camera", source)))
+  , visibleMarkers(
+      metrics::registry().gauge("augmuseum_visible_markers",
+                                "Markers currently tracked or coasting",
+                                metrics::label("camera", source)))
+  , idle(metrics::registry().gauge("augmuseum_camera_idle",
+                                   "1 while the camera is idle for lack of "
+                                   "markers",
+                                   metrics::label("camera", source)))
+  , prefetched(
+      metrics::registry().counter("augmuseum_prefetched_warps_total",
+                                  "Paintings warped before their marker was "
+                                  "first drawn",
+                                  metrics::label("camera", source)))
+  , latched(
+      metrics::registry().counter("augmuseum_latched_overlays_total",
+                                  "Paintings moved to a predicted position "
+                                  "just before display",
+                                  metrics::label("camera", source)))
+  , recognized(
+      metrics::registry().counter("augmuseum_paintings_recognized_total",
+                                  "Paintings found without a marker on "
+                                  "keyframes",
+                                  metrics::label("camera", source)))
+  , processSeconds(metrics::registry().histogram(
+      "augmuseum_process_seconds",
+      "Time to decode, detect and composite one frame",
+      { 0.005, 0.01, 0.02, 0.033, 0.05, 0.1, 0.25 },
+      metrics::label("camera", source)))
+  , latencySeconds(metrics::registry().histogram(
+      "augmuseum_capture_to_display_seconds",
+      "Time from capture of a frame until it is shown or written",
+      { 0.01, 0.02, 0.033, 0.05, 0.075, 0.1, 0.15, 0.25, 0.5 },
+      metrics::label("camera", source)))
+{
+}
+
+/**
+ * @brief source is a device index ("0") or a file/stream URL. The camera
+ * parameters are read from calibrationFile and the dictionary, marker size
+ * and detector parameters from config. Markers that belong to one of boards
+ * are posed together with the rest of their board. With handleOcclusion,
+ * people in front of a marker are kept in front of its painting. With a
+ * paintingIndex, the paintings in it are also recognized without markers.
+ */
+CameraPipeline::CameraPipeline(
+  const string& source,
+  const string& calibrationFile,
+  const detector_config::DetectorConfig& config,
+  const vector<marker_board::MarkerBoard>& boards,
+  bool useOpenCL,
+  bool handleOcclusion,
+  shared_ptr<const recognition::PaintingIndex> paintingIndex)
+  : source(source)
+  , useOpenCL(useOpenCL)
+  , handleOcclusion(handleOcclusion)
+  , markerLength(config.markerLength)
+  , detector(config.getDictionary(), config.parameters)
+  , boards(boards)
+  , tracker(config.acquireFrames, config.coastFrames)
+  , stats(source)
+  , prefetchCandidates((size_t)max(config.prefetchCandidates, 0))
+  , prefetchCorrectionRate(
+      min(1.0, 2 * config.parameters.errorCorrectionRate))
+  , gate(config.idleAfter, config.idleCheckInterval, config.idleScanInterval)
+{
+  vector<Mat> rotationVectors, translationVectors;
+  cout << "Utilizing calibration file found at " << calibrationFile << endl;
+  ar_utils::loadCalibrationFile(
+    calibrationFile, camMatrix, dCoeffs, rotationVectors, translationVectors);
+
+  objPoints = ar_utils::setCoordinateSystem(markerLength);
+
+  // Occlusion samples a coarser pyramid level for large paintings
+  preprocessor.configure(
+    handleOcclusion ? 3 : 1, config.undistort, camMatrix, dCoeffs);
+  poseCoeffs = preprocessor.undistorts() ? Mat() : dCoeffs;
+
+  if (paintingIndex) {
+    recognizer.reset(
+      new recognition::PaintingRecognizer(paintingIndex,
+                                          config.recognitionInterval,
+                                          config.recognitionInliers));
+  }
+}
+
+/**
+ * @brief Opens the capture source with the requested backend and format
+ */
+bool
+CameraPipeline::open(const capture::CaptureSettings& settings)
+{
+  return capture::openCapture(capture, source, settings);
+}
+
+/**
+ * @brief Grabs the next frame without decoding it
+ */
+bool
+CameraPipeline::grab()
+{
+  grabbed = capture.isOpened() && capture.grab();
+  if (capture.isOpened() && !grabbed) {
+    stats.dropped.add();
+  }
+  if (grabbed) {
+    capturedAt = capture::frameTimestamp(
+      capture, (double)getTickCount() / getTickFrequency());
+  }
+  return grabbed;
+}
+
+/**
+ * @brief Decodes the grabbed frame, detects markers and composites the overlay
+ * into output(). Markers assigned to a painting in exhibits show that painting
+ * instead. Returns the area covered by the overlay. An idle camera only
+ * decodes a few frames a second to look for activity; for the rest hasFrame()
+ * turns false.
+ */
+Rect
+CameraPipeline::process(const OverlayFrame& overlay,
+                        const ExhibitSet& exhibits)
+{
+  if (!grabbed) {
+    return Rect();
+  }
+
+  // An idle camera drops most frames before they are decoded
+  double now = (double)getTickCount() / getTickFrequency();
+  if (gate.idle() && !gate.dueForCheck(now)) {
+    grabbed = false;
+    return Rect();
+  }
+
+  if (!capture.retrieve(frame) || frame.empty()) {
+    grabbed = false;
+    stats.dropped.add();
+    return Rect();
+  }
+  if (gate.idle() && !activityWhileIdle(now)) {
+    return Rect();
+  }
+
+  Rect drawn = compose(overlay, exhibits);
+  gate.update(visibleTracks > 0, now);
+  stats.idle.set(gate.idle() ? 1 : 0);
+  return drawn;
+}
+
+/**
+ * @brief Looks for motion in an idle camera's frame, and now and then for
+ * markers at half resolution. Wakes the camera if either is found; otherwise
+ * shows the frame as it is.
+ */
+bool
+CameraPipeline::activityWhileIdle(double now)
+{
+  bool active = gate.motion(frame);
+  if (!active && gate.dueForScan(now)) {
+    vector<int> markerIds;
+    vector<vector<Point2f>> markerCorners;
+    preprocessor.run(frame);
+    pyrDown(preprocessor.detectionImage(), idleScan);
+    detector.detectMarkers(idleScan, markerCorners, markerIds);
+    active = !markerIds.empty();
+  }
+
+  if (active) {
+    gate.wake(now);
+    stats.idle.set(0);
+    return true;
+  }
+
+  // Nothing is drawn, so there is nothing to copy the frame for
+  if (frame.type() == CV_8UC2) {
+    cvtColor(frame, frameCopy, COLOR_YUV2BGR_YUYV);
+  } else {
+    frameCopy = frame;
+    sharedOutput = true;
+  }
+  stats.frames.add();
+  return false;
+}
+
+/**
+ * @brief Same as process() for a frame that did not come from the capture,
+ * such as one read back from a recorded session. timestamp is when it was
+ * captured, now if 0.
+ */
+Rect
+CameraPipeline::processFrame(const Mat& input,
+                             const OverlayFrame& overlay,
+                             const ExhibitSet& exhibits,
+                             double timestamp)
+{
+  input.copyTo(frame);
+  grabbed = !frame.empty();
+  capturedAt = timestamp > 0 ? timestamp
+                             : (double)getTickCount() / getTickFrequency();
+  return grabbed ? compose(overlay, exhibits) : Rect();
+}
+
+/**
+ * @brief Same as processFrame() but composites into image itself, which must
+ * be CV_8UC3, instead of into a copy. Coasting paintings are latched right
+ * away. The pipeline lets go of image before returning, so input() and
+ * output() are left empty.
+ */
+Rect
+CameraPipeline::processInPlace(Mat& image,
+                               const OverlayFrame& overlay,
+                               const ExhibitSet& exhibits,
+                               double timestamp)
+{
+  if (image.empty() || image.type() != CV_8UC3) {
+    return Rect();
+  }
+
+  // Both buffers are headers on the caller's pixels for this one frame
+  frame = image;
+  frameCopy = image;
+  sharedOutput = false;
+  inPlace = true;
+  grabbed = true;
+  capturedAt = timestamp > 0 ? timestamp
+                             : (double)getTickCount() / getTickFrequency();
+  Rect drawn = compose(overlay, exhibits);
+  latch();
+
+  inPlace = false;
+  grabbed = false;
+  frame.release();
+  frameCopy.release();
+  return drawn;
+}
+
+/**
+ * @brief Detects markers in frame and composites the overlay into frameCopy
+ */
+Rect
+CameraPipeline::compose(const OverlayFrame& overlay,
+                        const ExhibitSet& exhibits)
+{
+  // The output must not share the frame's pixels once it is drawn on
+  if (sharedOutput) {
+    frameCopy = Mat();
+    sharedOutput = false;
+  }
+
+  int64 start = getTickCount();
+  preprocessor.run(frame);
+  times.preprocess = (getTickCount() - start) / getTickFrequency();
+
+  // Raw YUYV has already given detection its luma. The one colour
+  // conversion writes the output frame, which compositing reads as its
+  // source too, since it only ever blends within dest.
+  bool yuyv = frame.type() == CV_8UC2;
+  if (yuyv) {
+    cvtColor(frame, frameCopy, COLOR_YUV2BGR_YUYV);
+  }
+
+  Rect drawn;
+  if (useOpenCL) {
+    if (yuyv) {
+      frameCopy.copyTo(uFrameCopy);
+    } else {
+      frame.copyTo(uFrame);
+      uFrame.copyTo(uFrameCopy);
+    }
+    drawn = detectAndOverlayMarker(yuyv ? uFrameCopy : uFrame,
+                                   uFrameCopy,
+                                   overlay.uImage,
+                                   overlay.objectCorners,
+                                   overlay.version,
+                                   overlay.tiled.get(),
+                                   exhibits);
+    uFrameCopy.copyTo(frameCopy);
+  } else {
+    if (!yuyv && !inPlace) {
+      frame.copyTo(frameCopy);
+    }
+    drawn = detectAndOverlayMarker(yuyv ? frameCopy : frame,
+                                   frameCopy,
+                                   overlay.image,
+                                   overlay.objectCorners,
+                                   overlay.version,
+                                   overlay.tiled.get(),
+                                   exhibits);
+  }
+
+  stats.frames.add();
+  stats.processSeconds.observe((getTickCount() - start) / getTickFrequency());
+  return drawn;
+}
+
+/**
+ * @brief Draws the paintings whose pose is older than the frame, such as
+ * markers coasting through a missed detection, where their motion predicts
+ * them at the frame's capture time. The cached warp is only nudged by a
+ * small homography, so this is cheap enough to run right before display.
+ */
+void
+CameraPipeline::latch()
+{
+  for (int key : pendingLatch) {
+    auto entry = tracker.tracks().find(key);
+    if (entry == tracker.tracks().end()) {
+      continue;
+    }
+    marker_tracker::MarkerTrack& track = entry->second;
+    Point2f corners[4];
+    if (track.predictCorners(capturedAt, maxPrediction, corners) &&
+        compositor::drawCorrected(track.warp, corners, frameCopy).area() > 0) {
+      stats.latched.add();
+    }
+  }
+  pendingLatch.clear();
+}
+
+/**
+ * @brief Writes the output frame to a video file in directory instead of
+ * showing it in a window
+ */
+bool
+CameraPipeline::writeOutput(const string& directory)
+{
+  if (!writer.isOpened()) {
+    string fileName = source;
+    replace_if(
+      fileName.begin(),
+      fileName.end(),
+      [](char c) { return !isalnum(static_cast<unsigned char>(c)); },
+      '_');
+    string path = directory + "/camera_" + fileName + ".avi";
+
+    double fps = capture.get(CAP_PROP_FPS);
+    if (!writer.open(path,
+                     VideoWriter::fourcc('M', 'J', 'P', 'G'),
+                     fps > 0 ? fps : 30,
+                     frameCopy.size())) {
+      cerr << "Failed to open output video: " << path << endl;
+      return false;
+    }
+    cout << "Writing " << source << " to " << path << endl;
+  }
+
+  writer.write(frameCopy);
+  return true;
+}
+
+/**
+ * @brief Records the output frame as shown. Observes the time from capture to
+ * display.
+ */
+void
+CameraPipeline::presented()
+{
+  if (grabbed) {
+    stats.latencySeconds.observe((double)getTickCount() / getTickFrequency() -
+                                 capturedAt);
+  }
+}
+
+/**
+ * @brief Runs OpenCV's logic for detecting ArUco markers and overlays an image
+ * on top of it. This function is intended for only 1 ArUco marker. MatT is
+ * either Mat or UMat depending on whether the OpenCL path is active. corners
+ * place the overlay relative to the marker and tiles is its tiled copy, if
+ * any. Markers listed in
+ * exhibits.markerPaintings get their own painting. Detections go through the
+ * tracker, so a marker missed for a few frames keeps its last placement.
+ * Returns the area of dest covered by the overlay.
+ */
+template<typename MatT>
+Rect
+CameraPipeline::detectAndOverlayMarker(MatT& src,
+                                       MatT& dest,
+                                       const MatT& overlay,
+                                       const vector<Point3f>& corners,
+                                       int64_t overlayVersion,
+                                       const tiled_image::TiledImage* tiles,
+                                       const ExhibitSet& exhibits)
+{
+  // Painting and placement for a marker id, the current exhibit by default
+  auto paintingFor = [&](int markerId,
+                         const MatT*& image,
+                         const vector<Point3f>*& placement,
+                         int64_t& version,
+                         const tiled_image::TiledImage*& tiled) {
+    image = &overlay;
+    placement = &corners;
+    version = overlayVersion;
+    tiled = tiles;
+    const painting::Painting* chosen = nullptr;
+    auto assigned = exhibits.markerPaintings.find(markerId);
+    if (assigned != exhibits.markerPaintings.end()) {
+      chosen = &exhibits.paintings[assigned->second];
+    }
+
+    // Recognized paintings show themselves
+    if (markerId >= recognition::keyBase && recognizer) {
+      auto named = exhibits.namedPaintings.find(
+        recognizer->index().name(markerId - recognition::keyBase));
+      if (named != exhibits.namedPaintings.end()) {
+        chosen = &exhibits.paintings[named->second];
+      }
+    }
+    if (chosen) {
+      const painting::Painting& painting = *chosen;
+      image = &pixelsOf(painting, overlay);
+      placement = &painting.objectCorners;
+      version = painting.version;
+      tiled = painting.tiled.get();
+    }
+  };
+
+  vector<int> markerIds;
+  vector<vector<Point2f>> markerCorners, rejectedCandidates;
+
+  // Detection reads the shared gray image rather than converting src again
+  int64 stageStart = getTickCount();
+  detector.detectMarkers(preprocessor.detectionImage(),
+                         markerCorners,
+                         markerIds,
+                         rejectedCandidates);
+  size_t nMarkers = markerCorners.size();
+
+  // Paintings are only matched on keyframes and followed in between
+  vector<recognition::Recognition> recognized;
+  if (recognizer) {
+    recognized = recognizer->update(preprocessor.detectionImage());
+    if (recognizer->keyframe()) {
+      stats.recognized.add(recognized.size());
+    }
+  }
+  int64 detectEnd = getTickCount();
+  times.detect = (detectEnd - stageStart) / getTickFrequency();
+
+  detected.resize(nMarkers);
+  for (size_t i = 0; i < nMarkers; i++) {
+    detected[i].id = markerIds[i];
+    copy(markerCorners[i].begin(),
+         markerCorners[i].begin() + 4,
+         detected[i].corners);
+  }
+
+  Rect drawn;
+  pendingLatch.clear();
+  tracker.beginFrame();
+  stats.markersDetected.add(nMarkers);
+  if (nMarkers > 0) {
+    stats.framesWithMarkers.add();
+  }
+
+  // Every visible marker of a board feeds a single pose for that board
+  vector<bool> onBoard(nMarkers, false);
+  for (size_t b = 0; b < boards.size(); b++) {
+    Vec3d rvec, tvec;
+    if (marker_board::estimateBoardPose(boards[b],
+                                        markerCorners,
+                                        markerIds,
+                                        camMatrix,
+                                        poseCoeffs,
+                                        rvec,
+                                        tvec,
+                                        onBoard)) {
+      marker_tracker::MarkerTrack& track = tracker.observe(-1 - (int)b);
+      track.rvec = rvec;
+      track.tvec = tvec;
+      track.hasPose = true;
+    }
+  }
+
+  for (size_t i = 0; i < nMarkers; i++) {
+    if (onBoard[i]) {
+      continue;
+    }
+
+    // A second copy of an id in the same frame is drawn but not tracked
+    if (tracker.seenThisFrame(markerIds[i])) {
+      Vec3d rvec, tvec;
+      solvePnP(objPoints,
+               markerCorners[i],
+               camMatrix,
+               poseCoeffs,
+               rvec,
+               tvec,
+               false,
+               SOLVEPNP_ITERATIVE);
+      const MatT* image;
+      const vector<Point3f>* placement;
+      int64_t version;
+      const tiled_image::TiledImage* tiled;
+      paintingFor(markerIds[i], image, placement, version, tiled);
+      drawn |= compositor::overlayImage2(src,
+                                         dest,
+                                         *image,
+                                         *placement,
+                                         rvec,
+                                         tvec,
+                                         camMatrix,
+                                         dCoeffs,
+                                         nullptr,
+                                         tiled);
+      continue;
+    }
+
+    // The previous pose is a good starting point once a marker is tracked
+    marker_tracker::MarkerTrack& track = tracker.observe(markerIds[i]);
+    solvePnP(objPoints,
+             markerCorners[i],
+             camMatrix,
+             poseCoeffs,
+             track.rvec,
+             track.tvec,
+             track.hasPose,
+             SOLVEPNP_ITERATIVE);
+    track.hasPose = true;
+  }
+
+  // A recognized painting is posed from its own corners, which its placement
+  // maps the painting back onto
+  for (const recognition::Recognition& found : recognized) {
+    auto named =
+      exhibits.namedPaintings.find(recognizer->index().name(found.entry));
+    if (named == exhibits.namedPaintings.end()) {
+      continue;
+    }
+    const painting::Painting& painting = exhibits.paintings[named->second];
+    marker_tracker::MarkerTrack& track =
+      tracker.observe(recognition::keyBase + found.entry);
+    vector<Point2f> corners(found.corners, found.corners + 4);
+    solvePnP(painting.objectCorners,
+             corners,
+             camMatrix,
+             poseCoeffs,
+             track.rvec,
+             track.tvec,
+             track.hasPose,
+             SOLVEPNP_ITERATIVE);
+    track.hasPose = true;
+  }
+
+  tracker.endFrame();
+  int64 poseEnd = getTickCount();
+  times.pose = (poseEnd - detectEnd) / getTickFrequency();
+
+  int visible = 0;
+  for (auto& entry : tracker.tracks()) {
+    marker_tracker::MarkerTrack& track = entry.second;
+    if (!track.visible()) {
+      continue;
+    }
+    visible++;
+
+    // A board shows the painting assigned to its first marker
+    int key = entry.first;
+    int markerId = key >= 0 ? key : boards[-1 - key].ids.front();
+    const MatT* image;
+    const vector<Point3f>* placement;
+    int64_t version;
+    const tiled_image::TiledImage* tiled;
+    paintingFor(markerId, image, placement, version, tiled);
+
+    // Coasting markers reuse their last placement unless the painting changed
+    Size paintingSize = compositor::overlaySize(*image, tiled);
+    bool samePainting = track.placement.matches(paintingSize, *placement);
+    if (track.seen || !samePainting) {
+      if (!samePainting) {
+        track.resetMotion();
+      }
+      if (!compositor::placeOverlay(src.size(),
+                                    paintingSize,
+                                    *placement,
+                                    track.rvec,
+                                    track.tvec,
+                                    camMatrix,
+                                    dCoeffs,
+                                    track.placement)) {
+        continue;
+      }
+    }
+    if (track.seen) {
+      track.recordMotion(capturedAt);
+    }
+
+    // A coasting painting is left for latch(), which draws it where the wall
+    // it was last seen on has moved to since. Occluders need the frame as it
+    // was captured, so those are drawn now.
+    if (!track.seen && track.hasMotion && !handleOcclusion) {
+      compositor::prepareWarp(
+        *image, track.placement, track.warp, version, tiled);
+      pendingLatch.push_back(key);
+      drawn |= track.placement.roi;
+      continue;
+    }
+
+    // A marker that holds still reuses its last warp
+    drawn |= compositor::drawOverlay(src,
+                                     dest,
+                                     *image,
+                                     track.placement,
+                                     occluderFor(key),
+                                     &track.warp,
+                                     version,
+                                     tiled);
+  }
+
+  // Paintings about to appear are placed and warped a frame or two early, so
+  // a marker on a wall that comes into view, or out from behind a visitor,
+  // is first drawn from the cache: markers still being acquired, and
+  // rejected candidates that read as an id with a looser bit error budget
+  // than the detector's
+  auto warmUp = [&](int markerId, marker_tracker::MarkerTrack& track) {
+    const MatT* image;
+    const vector<Point3f>* placement;
+    int64_t version;
+    const tiled_image::TiledImage* tiled;
+    paintingFor(markerId, image, placement, version, tiled);
+    if (compositor::placeOverlay(src.size(),
+                                 compositor::overlaySize(*image, tiled),
+                                 *placement,
+                                 track.rvec,
+                                 track.tvec,
+                                 camMatrix,
+                                 dCoeffs,
+                                 track.placement)) {
+      compositor::prepareWarp(
+        *image, track.placement, track.warp, version, tiled);
+      stats.prefetched.add();
+    }
+  };
+  if (prefetchCandidates > 0) {
+    for (auto& entry : tracker.tracks()) {
+      marker_tracker::MarkerTrack& track = entry.second;
+      if (entry.first >= 0 && track.seen &&
+          track.state == marker_tracker::TrackState::Acquiring) {
+        warmUp(entry.first, track);
+      }
+    }
+
+    for (const prefetch::LikelyMarker& likely :
+         prefetch::decodeCandidates(preprocessor.detectionImage(),
+                                    rejectedCandidates,
+                                    detector.getDictionary(),
+                                    detector.getDetectorParameters()
+                                      .markerBorderBits,
+                                    prefetchCorrectionRate,
+                                    prefetchCandidates)) {
+      bool onABoard = any_of(
+        boards.begin(), boards.end(), [&](const marker_board::MarkerBoard& b) {
+          return find(b.ids.begin(), b.ids.end(), likely.id) != b.ids.end();
+        });
+      auto known = tracker.tracks().find(likely.id);
+      if (onABoard || (known != tracker.tracks().end() &&
+                       known->second.state !=
+                         marker_tracker::TrackState::Lost)) {
+        continue;
+      }
+
+      marker_tracker::MarkerTrack& track = tracker.prepare(likely.id);
+      vector<Point2f> corners(likely.corners, likely.corners + 4);
+      solvePnP(objPoints,
+               corners,
+               camMatrix,
+               poseCoeffs,
+               track.rvec,
+               track.tvec,
+               false,
+               SOLVEPNP_ITERATIVE);
+      warmUp(likely.id, track);
+    }
+  }
+
+  trackedPoses.clear();
+  for (const auto& entry : tracker.tracks()) {
+    const marker_tracker::MarkerTrack& track = entry.second;
+    trackedPoses.push_back(
+      { entry.first, (int)track.state, track.rvec, track.tvec });
+  }
+  times.composite = (getTickCount() - poseEnd) / getTickFrequency();
+
+  visibleTracks = visible;
+  stats.visibleMarkers.set(visible);
+  return drawn;
+}
+
+/**
+ * @brief Background model for the marker or board identified by key, or
+ * nullptr when occlusion handling is off
+ */
+occlusion::RegionModel*
+CameraPipeline::occluderFor(int key)
+{
+  if (!handleOcclusion) {
+    return nullptr;
+  }
+  occlusion::RegionModel& model = occlusionRegions[key];
+  model.sampleFrom(&preprocessor.pyramid());
+  return &model;
+}
+
+}
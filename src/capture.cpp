@@ -0,0 +1,170 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Capture backend, format and buffering for camera sources, so a
+ * deployment can ask for the resolution and pixel format it needs instead of
+ * whatever the driver picks.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <opencv2/opencv.hpp>
+
+#include "../include/capture.h"
+
+using namespace std;
+using namespace cv;
+
+namespace capture {
+
+/**
+ * @brief Converts a backend name such as "v4l2" to its cv::VideoCaptureAPIs
+ * value. Returns -1 if the name is unknown.
+ */
+int
+backendFromName(const string& name)
+{
+  static const map<string, int> backends = {
+    { "any", CAP_ANY },
+    { "v4l2", CAP_V4L2 },
+    { "gstreamer", CAP_GSTREAMER },
+    { "ffmpeg", CAP_FFMPEG },
+    { "avfoundation", CAP_AVFOUNDATION },
+    { "msmf", CAP_MSMF },
+    { "dshow", CAP_DSHOW },
+  };
+
+  string lower = name;
+  transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
+    return (char)tolower(c);
+  });
+  auto backend = backends.find(lower);
+  return backend == backends.end() ? -1 : backend->second;
+}
+
+/**
+ * @brief Parses a resolution such as "1280x720". Returns an empty size if text
+ * is empty or malformed.
+ */
+Size
+parseResolution(const string& text)
+{
+  int width = 0, height = 0;
+  char separator = 0;
+  if (sscanf(text.c_str(), "%d%c%d", &width, &separator, &height) != 3 ||
+      (separator != 'x' && separator != 'X') || width <= 0 || height <= 0) {
+    return Size();
+  }
+  return Size(width, height);
+}
+
+/**
+ * @brief Four character code as text, e.g. "MJPG"
+ */
+static string
+fourccName(int code)
+{
+  string name;
+  for (int i = 0; i < 4; i++) {
+    name += (char)((code >> (8 * i)) & 0xff);
+  }
+  return name;
+}
+
+/**
+ * @brief Opens source, a device index ("0") or a file/stream URL, with
+ * settings and prints the format the driver agreed to. YUYV devices on Linux
+ * deliver raw CV_8UC2 frames so the luma plane can go straight to detection.
+ */
+bool
+openCapture(VideoCapture& capture,
+            const string& source,
+            const CaptureSettings& settings)
+{
+  int backend = backendFromName(settings.backend);
+  if (backend < 0) {
+    cerr << "Unknown capture backend " << settings.backend << endl;
+    return false;
+  }
+
+  bool isIndex = !source.empty() &&
+                 all_of(source.begin(), source.end(), [](char c) {
+                   return isdigit(static_cast<unsigned char>(c));
+                 });
+
+  // The pixel format goes first, drivers pick the sizes they offer from it
+  vector<int> params;
+  if (settings.fourcc.size() == 4) {
+    const string& f = settings.fourcc;
+    int code = VideoWriter::fourcc(f[0], f[1], f[2], f[3]);
+    params.insert(params.end(), { CAP_PROP_FOURCC, code });
+  }
+  if (settings.resolution.area() > 0) {
+    params.insert(params.end(),
+                  { CAP_PROP_FRAME_WIDTH,
+                    settings.resolution.width,
+                    CAP_PROP_FRAME_HEIGHT,
+                    settings.resolution.height });
+  }
+  if (settings.fps > 0) {
+    params.insert(params.end(), { CAP_PROP_FPS, cvRound(settings.fps) });
+  }
+
+  if (isIndex) {
+    capture.open(stoi(source), backend, params);
+  } else {
+    capture.open(source, backend, params);
+  }
+  if (!capture.isOpened()) {
+    cerr << "Error opening video stream " << source << "..." << endl;
+    return false;
+  }
+
+  if (isIndex && settings.buffers > 0) {
+    capture.set(CAP_PROP_BUFFERSIZE, settings.buffers);
+  }
+
+  int format = (int)capture.get(CAP_PROP_FOURCC);
+#ifdef __linux__
+  // Raw YUYV skips the driver-side BGR conversion; the pipeline takes the
+  // luma for detection and converts to colour once, into the output frame
+  if (isIndex && fourccName(format) == "YUYV" &&
+      (int)capture.get(CAP_PROP_BACKEND) == CAP_V4L2) {
+    capture.set(CAP_PROP_CONVERT_RGB, 0);
+  }
+#endif
+
+  cout << "Opened " << source << " with " << capture.getBackendName() << ": "
+       << capture.get(CAP_PROP_FRAME_WIDTH) << "x"
+       << capture.get(CAP_PROP_FRAME_HEIGHT) << " at "
+       << capture.get(CAP_PROP_FPS) << " fps, " << fourccName(format)
+       << endl;
+  return true;
+}
+
+/**
+ * @brief Capture time of the frame just grabbed, in seconds on the
+ * getTickCount clock. Uses the driver's buffer timestamp where it is on the
+ * same clock (V4L2), so time spent queued in the driver is included, and
+ * grabTime otherwise.
+ */
+double
+frameTimestamp(const VideoCapture& capture, double grabTime)
+{
+#ifdef __linux__
+  // V4L2 buffers are stamped with CLOCK_MONOTONIC, which getTickCount also
+  // reads on Linux. Anything more than a second off is some other clock.
+  if ((int)capture.get(CAP_PROP_BACKEND) == CAP_V4L2) {
+    double stamped = capture.get(CAP_PROP_POS_MSEC) / 1000.0;
+    if (stamped > 0 && stamped <= grabTime && grabTime - stamped < 1.0) {
+      return stamped;
+    }
+  }
+#endif
+  return grabTime;
+}
+
+}
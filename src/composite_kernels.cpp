@@ -0,0 +1,300 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Inner loops of the CPU compositor, written as templates over the
+ * pixel format of the painting and the frame and over the interpolation, so
+ * each combination compiles to its own loop with no per-pixel type checks.
+ */
+
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "../include/composite_kernels.h"
+
+using namespace std;
+using namespace cv;
+
+namespace composite_kernels {
+
+// Bilinear weights in fixed point, as in tiled_image
+static const int weightBits = 5;
+static const int weightOne = 1 << weightBits;
+
+/**
+ * @brief Pixel formats, by number of interleaved 8-bit channels
+ */
+struct Gray
+{
+  static const int channels = 1;
+};
+
+struct Bgr
+{
+  static const int channels = 3;
+};
+
+struct Bgra
+{
+  static const int channels = 4;
+};
+
+/**
+ * @brief Interpolations
+ */
+struct Nearest
+{
+};
+
+struct Linear
+{
+};
+
+/**
+ * @brief x / 255 rounded, for x up to 255 * 255
+ */
+static inline int
+div255(int x)
+{
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * @brief Writes one painting pixel over one frame pixel. Only the supported
+ * pairs are defined, anything else fails to compile.
+ */
+template<typename Src, typename Dst>
+struct Blender;
+
+template<>
+struct Blender<Bgr, Bgr>
+{
+  static inline void apply(const uchar* px, uchar* out)
+  {
+    out[0] = px[0];
+    out[1] = px[1];
+    out[2] = px[2];
+  }
+};
+
+template<>
+struct Blender<Bgra, Bgr>
+{
+  static inline void apply(const uchar* px, uchar* out)
+  {
+    int alpha = px[3];
+    if (alpha == 255) {
+      out[0] = px[0];
+      out[1] = px[1];
+      out[2] = px[2];
+    } else if (alpha != 0) {
+      for (int c = 0; c < 3; c++) {
+        out[c] = (uchar)div255(px[c] * alpha + out[c] * (255 - alpha));
+      }
+    }
+  }
+};
+
+template<>
+struct Blender<Gray, Gray>
+{
+  static inline void apply(const uchar* px, uchar* out) { out[0] = px[0]; }
+};
+
+/**
+ * @brief Reads overlay at (u, v), which lies within the image
+ */
+template<typename Src>
+static inline void
+sample(const Mat& overlay, double u, double v, Nearest, uchar* px)
+{
+  const uchar* p =
+    overlay.ptr<uchar>(cvRound(v)) + cvRound(u) * Src::channels;
+  for (int c = 0; c < Src::channels; c++) {
+    px[c] = p[c];
+  }
+}
+
+template<typename Src>
+static inline void
+sample(const Mat& overlay, double u, double v, Linear, uchar* px)
+{
+  int ix = (int)u, iy = (int)v;
+  int a = cvRound((u - ix) * weightOne);
+  int b = cvRound((v - iy) * weightOne);
+  int dx = ix + 1 < overlay.cols ? Src::channels : 0;
+  const uchar* p0 = overlay.ptr<uchar>(iy) + ix * Src::channels;
+  const uchar* p1 = iy + 1 < overlay.rows ? p0 + overlay.step[0] : p0;
+  for (int c = 0; c < Src::channels; c++) {
+    int top = p0[c] * (weightOne - a) + p0[c + dx] * a;
+    int bottom = p1[c] * (weightOne - a) + p1[c + dx] * a;
+    px[c] = (uchar)((top * (weightOne - b) + bottom * b +
+                     (1 << (2 * weightBits - 1))) >>
+                    (2 * weightBits));
+  }
+}
+
+/**
+ * @brief Blends warped into dest where mask is set, over a range of rows
+ */
+template<typename Src, typename Dst>
+static void
+blendRows(const Mat& warped, const Mat& mask, Mat& dest, const Range& rows)
+{
+  for (int y = rows.start; y < rows.end; y++) {
+    const uchar* in = warped.ptr<uchar>(y);
+    const uchar* inside = mask.ptr<uchar>(y);
+    uchar* out = dest.ptr<uchar>(y);
+    for (int x = 0; x < dest.cols; x++) {
+      if (inside[x]) {
+        Blender<Src, Dst>::apply(in + x * Src::channels,
+                                 out + x * Dst::channels);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Samples overlay through the inverse of toRoi and blends it into
+ * dest where mask is set, over a range of rows. Coordinates just outside the
+ * painting, from the rounded mask polygon, are clamped to its edge.
+ */
+template<typename Src, typename Dst, typename Interp>
+static void
+compositeRows(const Mat& overlay,
+              const Matx33d& m,
+              const Mat& mask,
+              Mat& dest,
+              const Range& rows)
+{
+  const double lastX = overlay.cols - 1, lastY = overlay.rows - 1;
+  uchar px[Src::channels];
+  for (int y = rows.start; y < rows.end; y++) {
+    const uchar* inside = mask.ptr<uchar>(y);
+    uchar* out = dest.ptr<uchar>(y);
+    double X0 = m(0, 1) * y + m(0, 2);
+    double Y0 = m(1, 1) * y + m(1, 2);
+    double W0 = m(2, 1) * y + m(2, 2);
+
+    for (int x = 0; x < dest.cols; x++) {
+      double W = W0 + m(2, 0) * x;
+      if (!inside[x] || W == 0) {
+        continue;
+      }
+      double X = X0 + m(0, 0) * x, Y = Y0 + m(1, 0) * x;
+      double inverse = 1.0 / W;
+      double u = min(max(X * inverse, 0.0), lastX);
+      double v = min(max(Y * inverse, 0.0), lastY);
+      sample<Src>(overlay, u, v, Interp(), px);
+      Blender<Src, Dst>::apply(px, out + x * Dst::channels);
+    }
+  }
+}
+
+/**
+ * @brief Runs the loops for one combination over OpenCV's thread pool
+ */
+template<typename Src, typename Dst>
+static void
+blendAs(const Mat& warped, const Mat& mask, Mat& dest)
+{
+  parallel_for_(Range(0, dest.rows), [&](const Range& rows) {
+    blendRows<Src, Dst>(warped, mask, dest, rows);
+  });
+}
+
+template<typename Src, typename Dst>
+static bool
+compositeAs(const Mat& overlay,
+            const Matx33d& toRoi,
+            const Mat& mask,
+            int interpolation,
+            Mat& dest)
+{
+  const Matx33d m = toRoi.inv();
+  if (interpolation == INTER_NEAREST) {
+    parallel_for_(Range(0, dest.rows), [&](const Range& rows) {
+      compositeRows<Src, Dst, Nearest>(overlay, m, mask, dest, rows);
+    });
+  } else if (interpolation == INTER_LINEAR) {
+    parallel_for_(Range(0, dest.rows), [&](const Range& rows) {
+      compositeRows<Src, Dst, Linear>(overlay, m, mask, dest, rows);
+    });
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief True if a painting of overlayType can be drawn onto a frame of
+ * destType: CV_8UC3 onto CV_8UC3, CV_8UC4 (alpha) onto CV_8UC3, and CV_8UC1
+ * onto CV_8UC1 for grayscale debug frames
+ */
+bool
+supported(int overlayType, int destType)
+{
+  return (destType == CV_8UC3 &&
+          (overlayType == CV_8UC3 || overlayType == CV_8UC4)) ||
+         (destType == CV_8UC1 && overlayType == CV_8UC1);
+}
+
+/**
+ * @brief Copies warped into dest wherever mask is set, blending by the alpha
+ * channel when warped has one. Returns false, leaving dest untouched, if the
+ * types aren't supported.
+ */
+bool
+blend(const Mat& warped, const Mat& mask, Mat& dest)
+{
+  if (warped.size() != dest.size() || mask.size() != dest.size() ||
+      mask.type() != CV_8UC1 || !supported(warped.type(), dest.type())) {
+    return false;
+  }
+
+  // The format is settled once here, the loops below never check it again
+  switch (warped.type()) {
+    case CV_8UC3:
+      blendAs<Bgr, Bgr>(warped, mask, dest);
+      break;
+    case CV_8UC4:
+      blendAs<Bgra, Bgr>(warped, mask, dest);
+      break;
+    default:
+      blendAs<Gray, Gray>(warped, mask, dest);
+      break;
+  }
+  return true;
+}
+
+/**
+ * @brief Warps overlay with toRoi and blends it into dest in a single pass,
+ * without an intermediate warped image. Only pixels where mask is set are
+ * sampled. interpolation is INTER_NEAREST or INTER_LINEAR. Returns false,
+ * leaving dest untouched, if the types or interpolation aren't supported.
+ */
+bool
+composite(const Mat& overlay,
+          const Matx33d& toRoi,
+          const Mat& mask,
+          int interpolation,
+          Mat& dest)
+{
+  if (overlay.empty() || mask.size() != dest.size() ||
+      mask.type() != CV_8UC1 || !supported(overlay.type(), dest.type())) {
+    return false;
+  }
+
+  switch (overlay.type()) {
+    case CV_8UC3:
+      return compositeAs<Bgr, Bgr>(overlay, toRoi, mask, interpolation, dest);
+    case CV_8UC4:
+      return compositeAs<Bgra, Bgr>(
+        overlay, toRoi, mask, interpolation, dest);
+    default:
+      return compositeAs<Gray, Gray>(
+        overlay, toRoi, mask, interpolation, dest);
+  }
+}
+
+}
@@ -0,0 +1,652 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Warp paintings onto detected ArUco markers and blend them into the
+ * camera frame. Every entry point has a cv::Mat (CPU) and a cv::UMat
+ * (transparent API / OpenCL) overload.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/composite_kernels.h"
+#include "../include/compositor.h"
+#include "../include/metrics.h"
+#include "../include/occlusion.h"
+
+using namespace std;
+using namespace cv;
+
+namespace compositor {
+
+static bool useOpenCL = false;
+
+/**
+ * @brief Enables the OpenCL transparent API path if requested and supported by
+ * the current machine. Returns true when the UMat path is active.
+ */
+bool
+configureOpenCL(bool requested)
+{
+  ocl::setUseOpenCL(requested && ocl::haveOpenCL());
+  useOpenCL = ocl::useOpenCL();
+
+  if (useOpenCL) {
+    cout << "OpenCL enabled on device: " << ocl::Device::getDefault().name()
+         << endl;
+  } else if (requested) {
+    cout << "OpenCL is not available, falling back to CPU" << endl;
+  } else {
+    cout << "OpenCL disabled, using CPU path" << endl;
+  }
+
+  return useOpenCL;
+}
+
+/**
+ * @brief Returns true when frames should be routed through the UMat path
+ */
+bool
+openCLActive()
+{
+  return useOpenCL;
+}
+
+// Largest corner movement, in pixels, for which a cached warp is reused
+static const float staticPoseThreshold = 0.25f;
+
+/**
+ * @brief The cached warp in the same container as the overlay
+ */
+static Mat&
+warpedOf(WarpCache& cache, const Mat&)
+{
+  return cache.warped;
+}
+
+static UMat&
+warpedOf(WarpCache& cache, const UMat&)
+{
+  return cache.uWarped;
+}
+
+/**
+ * @brief Warps overlay into warped with toRoi, from the tiled copy when there
+ * is one that matches
+ */
+static void
+warpInto(const Mat& overlay,
+         const tiled_image::TiledImage* tiled,
+         const Matx33d& toRoi,
+         Size roiSize,
+         Mat& warped)
+{
+  if (tiled && !tiled->empty() &&
+      (overlay.empty() || tiled->size() == overlay.size())) {
+    tiled_image::warpPerspectiveTiled(*tiled, toRoi, roiSize, warped);
+  } else {
+    warpPerspective(overlay, warped, toRoi, roiSize);
+  }
+}
+
+static void
+warpInto(const UMat& overlay,
+         const tiled_image::TiledImage*,
+         const Matx33d& toRoi,
+         Size roiSize,
+         UMat& warped)
+{
+  warpPerspective(overlay, warped, toRoi, roiSize);
+}
+
+/**
+ * @brief Identifies the pixel buffer behind an overlay
+ */
+static const void*
+identity(const Mat& image)
+{
+  return image.data;
+}
+
+static const void*
+identity(const UMat& image)
+{
+  return image.u;
+}
+
+/**
+ * @brief Identifies the painting being drawn: the overlay's pixels or, for a
+ * painting kept only in tiles, the tiles
+ */
+static const void*
+sourceOf(const Mat& overlay, const tiled_image::TiledImage* tiled)
+{
+  return overlay.empty() && tiled ? (const void*)tiled : identity(overlay);
+}
+
+static const void*
+sourceOf(const UMat& overlay, const tiled_image::TiledImage*)
+{
+  return identity(overlay);
+}
+
+/**
+ * @brief True if there is a painting to draw, in overlay or in its tiles.
+ * Only the CPU path reads tiles.
+ */
+static bool
+drawable(const Mat& overlay, const tiled_image::TiledImage* tiled)
+{
+  return !overlay.empty() || (tiled && !tiled->empty());
+}
+
+static bool
+drawable(const UMat& overlay, const tiled_image::TiledImage*)
+{
+  return !overlay.empty();
+}
+
+/**
+ * @brief True if overlay can be warped and blended into a frame like src in
+ * one pass, skipping the intermediate warp. Only the CPU path can.
+ */
+static bool
+fusable(const Mat& overlay, const Mat& src)
+{
+  return composite_kernels::supported(overlay.type(), src.type());
+}
+
+static bool
+fusable(const UMat&, const UMat&)
+{
+  return false;
+}
+
+/**
+ * @brief Copies the painting into dest wherever the mask is set, blended by
+ * its alpha channel if it has one. A fused paste samples overlay straight
+ * into dest through toRoi instead of copying the cached warp.
+ */
+static void
+paste(const Mat& overlay,
+      const Matx33d& toRoi,
+      bool fused,
+      const Mat& mask,
+      bool,
+      WarpCache& cache,
+      Mat& dest)
+{
+  if (fused) {
+    composite_kernels::composite(overlay, toRoi, mask, INTER_LINEAR, dest);
+    return;
+  }
+  const Mat& warped = warpedOf(cache, overlay);
+  if (!composite_kernels::blend(warped, mask, dest)) {
+    warped.copyTo(dest, mask);
+  }
+}
+
+/**
+ * @brief UMat paste, never fused. The mask is drawn on the CPU and uploaded
+ * once per warp unless it changes every frame.
+ */
+static void
+paste(const UMat& overlay,
+      const Matx33d&,
+      bool,
+      const Mat& mask,
+      bool maskChanged,
+      WarpCache& cache,
+      UMat& dest)
+{
+  const UMat& warped = warpedOf(cache, overlay);
+
+  // Alpha blending has no transparent API kernel, it is done in place on the
+  // CPU
+  if (warped.type() == CV_8UC4 && dest.type() == CV_8UC3) {
+    Mat destView = dest.getMat(ACCESS_RW);
+    composite_kernels::blend(warped.getMat(ACCESS_READ), mask, destView);
+    return;
+  }
+  if (maskChanged || cache.uMask.empty()) {
+    mask.copyTo(cache.uMask);
+  }
+  warped.copyTo(dest, cache.uMask);
+}
+
+/**
+ * @brief CPU view of a frame for the occlusion model. The UMat mapping is only
+ * held for the duration of the call it is passed to.
+ */
+static Mat
+readable(const Mat& image)
+{
+  return image;
+}
+
+static Mat
+readable(const UMat& image)
+{
+  return image.getMat(ACCESS_READ);
+}
+
+/**
+ * @brief True if this placement was computed for a painting of overlaySize
+ * placed at objectCorners
+ */
+bool
+Placement::matches(Size overlaySize, const vector<Point3f>& corners) const
+{
+  return roi.area() > 0 && overlaySize == this->overlaySize &&
+         corners.size() == 4 &&
+         std::equal(corners.begin(), corners.end(), objectCorners);
+}
+
+/**
+ * @brief True if the cached warp was made from overlay version of source and
+ * no corner of placement moved by more than a fraction of a pixel since
+ */
+bool
+WarpCache::reusableFor(const Placement& placement,
+                       const void* source,
+                       int64_t version) const
+{
+  if (roi.area() == 0 || source != this->source || version != this->version ||
+      placement.overlaySize != overlaySize) {
+    return false;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    Point2f moved = placement.imageCorners[i] - corners[i];
+    if (std::abs(moved.x) > staticPoseThreshold ||
+        std::abs(moved.y) > staticPoseThreshold) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Projects objectCorners with the marker pose and works out where a
+ * painting of overlaySize lands in a frame of frameSize. Returns false if the
+ * painting is degenerate or entirely outside the frame.
+ */
+bool
+placeOverlay(Size frameSize,
+             Size overlaySize,
+             const vector<Point3f>& objectCorners,
+             const Vec3d& rvec,
+             const Vec3d& tvec,
+             const Mat& camMatrix,
+             const Mat& dCoeffs,
+             Placement& placement)
+{
+  placement.roi = Rect();
+  if (overlaySize.area() == 0 || objectCorners.size() != 4) {
+    return false;
+  }
+
+  // Corners live in the placement so the per-frame path doesn't allocate
+  Mat imagePointsMat(4, 1, CV_32FC2, placement.imageCorners);
+  projectPoints(
+    objectCorners, rvec, tvec, camMatrix, dCoeffs, imagePointsMat);
+
+  float w = static_cast<float>(overlaySize.width);
+  float h = static_cast<float>(overlaySize.height);
+  const Point2f overlayPoints[4] = {
+    Point2f(0, 0), Point2f(w, 0), Point2f(w, h), Point2f(0, h)
+  };
+  Mat homography =
+    getPerspectiveTransform(overlayPoints, placement.imageCorners);
+  if (std::abs(determinant(homography)) < 1e-12) {
+    cerr << "Failed to compute homography matrix." << endl;
+    return false;
+  }
+
+  placement.homography = Matx33d(homography.ptr<double>());
+  placement.overlaySize = overlaySize;
+  for (int i = 0; i < 4; i++) {
+    placement.objectCorners[i] = objectCorners[i];
+    placement.polygon[i] =
+      Point(static_cast<int>(placement.imageCorners[i].x),
+            static_cast<int>(placement.imageCorners[i].y));
+  }
+  placement.roi = boundingRect(Mat(4, 1, CV_32SC2, placement.polygon)) &
+                  Rect(Point(0, 0), frameSize);
+  return placement.roi.area() > 0;
+}
+
+/**
+ * @brief Redraws the cached mask for placement and, unless the painting is
+ * sampled straight into the frame, the cached warp
+ */
+template<typename MatT>
+static void
+refreshWarp(const MatT& overlay,
+            const Placement& placement,
+            const Matx33d& toRoi,
+            WarpCache& warp,
+            int64_t overlayVersion,
+            const tiled_image::TiledImage* tiled,
+            bool fused)
+{
+  const Rect& roi = placement.roi;
+  if (!fused) {
+    warpInto(overlay, tiled, toRoi, roi.size(), warpedOf(warp, overlay));
+  }
+
+  Point polygon[4];
+  for (int i = 0; i < 4; i++) {
+    polygon[i] = placement.polygon[i] - roi.tl();
+    warp.corners[i] = placement.imageCorners[i];
+  }
+  warp.mask.create(roi.size(), CV_8UC1);
+  warp.mask.setTo(Scalar(0));
+  fillConvexPoly(warp.mask, polygon, 4, Scalar(255));
+  warp.uMask.release();
+
+  warp.roi = roi;
+  warp.overlaySize = placement.overlaySize;
+  warp.source = sourceOf(overlay, tiled);
+  warp.version = overlayVersion;
+}
+
+/**
+ * @brief Maps painting pixels to the placement's bounding box
+ */
+static Matx33d
+toRoiOf(const Placement& placement)
+{
+  const Rect& roi = placement.roi;
+  return Matx33d(1, 0, -roi.x, 0, 1, -roi.y, 0, 0, 1) * placement.homography;
+}
+
+/**
+ * @brief Shared implementation of drawOverlay for both Mat and UMat. Only the
+ * warp and the blend touch image data, so those are the calls that get
+ * dispatched to OpenCL when MatT is a UMat. All work is limited to the
+ * placement's bounding box.
+ */
+template<typename MatT>
+static Rect
+drawPlaced(const MatT& src,
+           MatT& dest,
+           const MatT& overlay,
+           const Placement& placement,
+           occlusion::RegionModel* occluder,
+           WarpCache* cache,
+           int64_t overlayVersion,
+           const tiled_image::TiledImage* tiled)
+{
+  if (!drawable(overlay, tiled) || placement.roi.area() == 0) {
+    return Rect();
+  }
+
+  static metrics::Counter& cacheHits = metrics::registry().counter(
+    "augmuseum_warp_cache_hits_total", "Paintings drawn from a cached warp");
+  static metrics::Counter& cacheMisses = metrics::registry().counter(
+    "augmuseum_warp_cache_misses_total", "Paintings that had to be warped");
+
+  WarpCache uncached;
+  WarpCache& warp = cache ? *cache : uncached;
+
+  // Without a cache to keep it in, the warp is sampled straight into dest
+  bool fused = !cache && !overlay.empty() && fusable(overlay, src);
+
+  // A static pose reuses the last warp and mask as they are
+  bool reusable =
+    warp.reusableFor(placement, sourceOf(overlay, tiled), overlayVersion);
+  (reusable ? cacheHits : cacheMisses).add();
+  Matx33d toRoi = toRoiOf(placement);
+  if (!reusable) {
+    refreshWarp(overlay, placement, toRoi, warp, overlayVersion, tiled, fused);
+  }
+
+  // Whatever is in front of the wall stays in front of the painting
+  const Mat* mask = &warp.mask;
+  if (occluder) {
+    warp.mask.copyTo(warp.occludedMask);
+    occluder->apply(readable(src),
+                    warp.corners,
+                    overlaySize(overlay, tiled),
+                    warp.roi,
+                    warp.occludedMask);
+    mask = &warp.occludedMask;
+  }
+
+  // Paste over what is already in dest so several markers can share a frame
+  if (dest.empty() || dest.size() != src.size()) {
+    src.copyTo(dest);
+  }
+  MatT destRoi = dest(warp.roi);
+  paste(overlay, toRoi, fused, *mask, occluder != nullptr, warp, destRoi);
+
+  return warp.roi;
+}
+
+/**
+ * @brief Shared implementation of prepareWarp for both Mat and UMat
+ */
+template<typename MatT>
+static void
+preparePlaced(const MatT& overlay,
+              const Placement& placement,
+              WarpCache& cache,
+              int64_t overlayVersion,
+              const tiled_image::TiledImage* tiled)
+{
+  if (!drawable(overlay, tiled) || placement.roi.area() == 0 ||
+      cache.reusableFor(placement, sourceOf(overlay, tiled), overlayVersion)) {
+    return;
+  }
+  refreshWarp(overlay,
+              placement,
+              toRoiOf(placement),
+              cache,
+              overlayVersion,
+              tiled,
+              false);
+}
+
+/**
+ * @brief Size of the painting in overlay or, when only its tiled copy is kept,
+ * in tiled
+ */
+Size
+overlaySize(const Mat& overlay, const tiled_image::TiledImage* tiled)
+{
+  return overlay.empty() && tiled ? tiled->size() : overlay.size();
+}
+
+/**
+ * @brief Size of the painting in overlay. Tiles are not read by the
+ * transparent API path.
+ */
+Size
+overlaySize(const UMat& overlay, const tiled_image::TiledImage*)
+{
+  return overlay.size();
+}
+
+/**
+ * @brief Warps overlay for a placement into cache without drawing it, so the
+ * frame that first draws a marker can reuse the warp if the marker hasn't
+ * moved since. Does nothing if the cached warp is still usable.
+ */
+void
+prepareWarp(const Mat& overlay,
+            const Placement& placement,
+            WarpCache& cache,
+            int64_t overlayVersion,
+            const tiled_image::TiledImage* tiled)
+{
+  preparePlaced(overlay, placement, cache, overlayVersion, tiled);
+}
+
+/**
+ * @brief Warps overlay for a placement into cache using the transparent API
+ */
+void
+prepareWarp(const UMat& overlay,
+            const Placement& placement,
+            WarpCache& cache,
+            int64_t overlayVersion,
+            const tiled_image::TiledImage* tiled)
+{
+  preparePlaced(overlay, placement, cache, overlayVersion, tiled);
+}
+
+/**
+ * @brief Draws overlay at a placement computed by placeOverlay. When occluder
+ * is given, foreground in front of the marker is kept over the painting. With
+ * a cache, the warp is only redone when the placement moves by more than a
+ * fraction of a pixel or overlayVersion changes. A tiled copy of overlay, if
+ * given, is warped from instead and overlay may then be empty. Returns the
+ * area of dest that was drawn.
+ */
+Rect
+drawOverlay(const Mat& src,
+            Mat& dest,
+            const Mat& overlay,
+            const Placement& placement,
+            occlusion::RegionModel* occluder,
+            WarpCache* cache,
+            int64_t overlayVersion,
+            const tiled_image::TiledImage* tiled)
+{
+  return drawPlaced(
+    src, dest, overlay, placement, occluder, cache, overlayVersion, tiled);
+}
+
+/**
+ * @brief Draws overlay at a placement using the transparent API. tiled is only
+ * used by the CPU path and ignored here.
+ */
+Rect
+drawOverlay(const UMat& src,
+            UMat& dest,
+            const UMat& overlay,
+            const Placement& placement,
+            occlusion::RegionModel* occluder,
+            WarpCache* cache,
+            int64_t overlayVersion,
+            const tiled_image::TiledImage* tiled)
+{
+  return drawPlaced(
+    src, dest, overlay, placement, occluder, cache, overlayVersion, tiled);
+}
+
+/**
+ * @brief Draws the warp in cache with its corners moved to corners, by warping
+ * the cached bounding box instead of the painting. Meant for the small
+ * corrections of a late pose update. Returns the area of dest that was drawn.
+ */
+Rect
+drawCorrected(WarpCache& cache, const Point2f corners[4], Mat& dest)
+{
+  // Only the container of the path that made the warp is filled
+  Mat warped = cache.warped.empty() ? readable(cache.uWarped) : cache.warped;
+  if (warped.empty() || cache.roi.area() == 0 || dest.empty()) {
+    return Rect();
+  }
+
+  Point polygon[4];
+  for (int i = 0; i < 4; i++) {
+    polygon[i] = Point(static_cast<int>(corners[i].x),
+                       static_cast<int>(corners[i].y));
+  }
+  Rect roi = boundingRect(Mat(4, 1, CV_32SC2, polygon)) &
+             Rect(Point(0, 0), dest.size());
+  if (roi.area() == 0) {
+    return Rect();
+  }
+
+  // From the cached bounding box to the new one
+  Matx33d correction(
+    getPerspectiveTransform(cache.corners, corners).ptr<double>());
+  Matx33d roiToRoi = Matx33d(1, 0, -roi.x, 0, 1, -roi.y, 0, 0, 1) *
+                     correction *
+                     Matx33d(1, 0, cache.roi.x, 0, 1, cache.roi.y, 0, 0, 1);
+  warpPerspective(warped, cache.corrected, roiToRoi, roi.size());
+  warpPerspective(
+    cache.mask, cache.correctedMask, roiToRoi, roi.size(), INTER_NEAREST);
+
+  Mat destRoi = dest(roi);
+  if (!composite_kernels::blend(
+        cache.corrected, cache.correctedMask, destRoi)) {
+    cache.corrected.copyTo(destRoi, cache.correctedMask);
+  }
+  return roi;
+}
+
+/**
+ * @brief Overlay a painting onto an ArUco marker. objectCorners are the
+ * painting's corners in marker coordinates (see painting::Painting), matching
+ * the overlay's top-left, top-right, bottom-right and bottom-left. When
+ * occluder is given, foreground in front of the marker is kept over the
+ * painting. A tiled copy of overlay, if given, is warped from instead, and is
+ * all that is needed when overlay is empty. Returns the bounding box of the
+ * painting in dest, or an empty Rect if nothing was drawn.
+ */
+Rect
+overlayImage2(const Mat& src,
+              Mat& dest,
+              const Mat& overlay,
+              const vector<Point3f>& objectCorners,
+              const Vec3d& rvec,
+              const Vec3d& tvec,
+              const Mat& camMatrix,
+              const Mat& dCoeffs,
+              occlusion::RegionModel* occluder,
+              const tiled_image::TiledImage* tiled)
+{
+  Placement placement;
+  if (!drawable(overlay, tiled) || !placeOverlay(src.size(),
+                                                 overlaySize(overlay, tiled),
+                                                 objectCorners,
+                                                 rvec,
+                                                 tvec,
+                                                 camMatrix,
+                                                 dCoeffs,
+                                                 placement)) {
+    return Rect();
+  }
+  return drawOverlay(
+    src, dest, overlay, placement, occluder, nullptr, 0, tiled);
+}
+
+/**
+ * @brief Overlay a painting onto an ArUco marker using the transparent API.
+ * tiled is ignored here.
+ */
+Rect
+overlayImage2(const UMat& src,
+              UMat& dest,
+              const UMat& overlay,
+              const vector<Point3f>& objectCorners,
+              const Vec3d& rvec,
+              const Vec3d& tvec,
+              const Mat& camMatrix,
+              const Mat& dCoeffs,
+              occlusion::RegionModel* occluder,
+              const tiled_image::TiledImage* tiled)
+{
+  Placement placement;
+  if (!drawable(overlay, tiled) || !placeOverlay(src.size(),
+                                                 overlaySize(overlay, tiled),
+                                                 objectCorners,
+                                                 rvec,
+                                                 tvec,
+                                                 camMatrix,
+                                                 dCoeffs,
+                                                 placement)) {
+    return Rect();
+  }
+  return drawOverlay(
+    src, dest, overlay, placement, occluder, nullptr, 0, tiled);
+}
+
+}
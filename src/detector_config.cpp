@@ -0,0 +1,211 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: ArUco dictionary, marker size and detector parameters loaded from a
+ * YAML/XML file, so deployments can tune detection without recompiling.
+ */
+
+#include <iostream>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/detector_config.h"
+
+using namespace std;
+using namespace cv;
+
+namespace detector_config {
+
+static const vector<pair<string, int>> dictionaryNames = {
+  { "DICT_4X4_50", aruco::DICT_4X4_50 },
+  { "DICT_4X4_100", aruco::DICT_4X4_100 },
+  { "DICT_4X4_250", aruco::DICT_4X4_250 },
+  { "DICT_4X4_1000", aruco::DICT_4X4_1000 },
+  { "DICT_5X5_50", aruco::DICT_5X5_50 },
+  { "DICT_5X5_100", aruco::DICT_5X5_100 },
+  { "DICT_5X5_250", aruco::DICT_5X5_250 },
+  { "DICT_5X5_1000", aruco::DICT_5X5_1000 },
+  { "DICT_6X6_50", aruco::DICT_6X6_50 },
+  { "DICT_6X6_100", aruco::DICT_6X6_100 },
+  { "DICT_6X6_250", aruco::DICT_6X6_250 },
+  { "DICT_6X6_1000", aruco::DICT_6X6_1000 },
+  { "DICT_7X7_50", aruco::DICT_7X7_50 },
+  { "DICT_7X7_100", aruco::DICT_7X7_100 },
+  { "DICT_7X7_250", aruco::DICT_7X7_250 },
+  { "DICT_7X7_1000", aruco::DICT_7X7_1000 },
+  { "DICT_ARUCO_ORIGINAL", aruco::DICT_ARUCO_ORIGINAL },
+  { "DICT_APRILTAG_16h5", aruco::DICT_APRILTAG_16h5 },
+  { "DICT_APRILTAG_25h9", aruco::DICT_APRILTAG_25h9 },
+  { "DICT_APRILTAG_36h10", aruco::DICT_APRILTAG_36h10 },
+  { "DICT_APRILTAG_36h11", aruco::DICT_APRILTAG_36h11 },
+};
+
+aruco::Dictionary
+DetectorConfig::getDictionary() const
+{
+  return aruco::getPredefinedDictionary(dictionary);
+}
+
+/**
+ * @brief Converts a dictionary name such as "DICT_6X6_250" to its enum value.
+ * Returns -1 if the name is unknown.
+ */
+int
+dictionaryFromName(const string& name)
+{
+  for (const auto& entry : dictionaryNames) {
+    if (entry.first == name) {
+      return entry.second;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Converts a dictionary enum value to its name
+ */
+string
+dictionaryName(int dictionary)
+{
+  for (const auto& entry : dictionaryNames) {
+    if (entry.second == dictionary) {
+      return entry.first;
+    }
+  }
+  return to_string(dictionary);
+}
+
+/**
+ * @brief Fills config from filePath. Keys that are missing keep their default
+ * values. Returns 0 on success and -1 on failure, like loadCalibrationFile.
+ */
+int
+loadDetectorConfig(string filePath, DetectorConfig& config)
+{
+  cout << "Loading detector configuration from " << filePath << endl;
+  FileStorage fs;
+
+  try {
+    if (!fs.open(filePath, FileStorage::READ)) {
+      cerr << "Failed to open detector configuration: " << filePath << endl;
+      return -1;
+    }
+
+    FileNode dictionaryNode = fs["dictionary"];
+    if (dictionaryNode.isString()) {
+      int dictionary = dictionaryFromName(dictionaryNode.string());
+      if (dictionary < 0) {
+        cerr << "Unknown dictionary: " << dictionaryNode.string() << endl;
+        return -1;
+      }
+      config.dictionary = dictionary;
+    } else if (dictionaryNode.isInt()) {
+      config.dictionary = (int)dictionaryNode;
+    }
+
+    if (!fs["markerLength"].empty()) {
+      config.markerLength = (float)fs["markerLength"];
+    }
+    if (!fs["markerImageSize"].empty()) {
+      config.markerImageSize = (int)fs["markerImageSize"];
+    }
+    if (!fs["acquireFrames"].empty()) {
+      config.acquireFrames = (int)fs["acquireFrames"];
+    }
+    if (!fs["coastFrames"].empty()) {
+      config.coastFrames = (int)fs["coastFrames"];
+    }
+    if (!fs["undistort"].empty()) {
+      config.undistort = (int)fs["undistort"] != 0;
+    }
+    if (!fs["idleAfter"].empty()) {
+      config.idleAfter = (double)fs["idleAfter"];
+    }
+    if (!fs["idleCheckInterval"].empty()) {
+      config.idleCheckInterval = (double)fs["idleCheckInterval"];
+    }
+    if (!fs["idleScanInterval"].empty()) {
+      config.idleScanInterval = (double)fs["idleScanInterval"];
+    }
+    if (!fs["prefetchCandidates"].empty()) {
+      config.prefetchCandidates = (int)fs["prefetchCandidates"];
+    }
+    if (!fs["recognitionInterval"].empty()) {
+      config.recognitionInterval = (int)fs["recognitionInterval"];
+    }
+    if (!fs["recognitionInliers"].empty()) {
+      config.recognitionInliers = (int)fs["recognitionInliers"];
+    }
+
+    FileNode parametersNode = fs["detectorParameters"];
+    if (!parametersNode.empty()) {
+      config.parameters.readDetectorParameters(parametersNode);
+    }
+  } catch (const Exception& e) {
+    cerr << "Error loading detector configuration: " << e.what() << endl;
+    return -1;
+  }
+
+  fs.release();
+
+  cout << "Dictionary: " << dictionaryName(config.dictionary) << endl;
+  cout << "Marker length: " << config.markerLength << endl;
+  cout << "Tracking hysteresis: acquire " << config.acquireFrames
+       << " frames, coast " << config.coastFrames << " frames" << endl;
+  cout << "Undistort before detection: " << (config.undistort ? "yes" : "no")
+       << endl;
+  cout << "Idle after " << config.idleAfter << " s without markers" << endl;
+  cout << "Prefetch candidates per frame: " << config.prefetchCandidates
+       << endl;
+  cout << "Markerless recognition: every " << config.recognitionInterval
+       << " frames, " << config.recognitionInliers << " inliers" << endl;
+  cout << "Adaptive threshold window: "
+       << config.parameters.adaptiveThreshWinSizeMin << "-"
+       << config.parameters.adaptiveThreshWinSizeMax << " step "
+       << config.parameters.adaptiveThreshWinSizeStep << endl;
+  cout << "Corner refinement: " << config.parameters.cornerRefinementMethod
+       << endl;
+  return 0;
+}
+
+/**
+ * @brief Writes config to filePath in the format read by loadDetectorConfig
+ */
+int
+saveDetectorConfig(string filePath, const DetectorConfig& config)
+{
+  FileStorage fs;
+
+  try {
+    if (!fs.open(filePath, FileStorage::WRITE)) {
+      cerr << "Failed to write detector configuration: " << filePath << endl;
+      return -1;
+    }
+
+    fs << "dictionary" << dictionaryName(config.dictionary);
+    fs << "markerLength" << config.markerLength;
+    fs << "markerImageSize" << config.markerImageSize;
+    fs << "acquireFrames" << config.acquireFrames;
+    fs << "coastFrames" << config.coastFrames;
+    fs << "undistort" << (int)config.undistort;
+    fs << "idleAfter" << config.idleAfter;
+    fs << "idleCheckInterval" << config.idleCheckInterval;
+    fs << "idleScanInterval" << config.idleScanInterval;
+    fs << "prefetchCandidates" << config.prefetchCandidates;
+    fs << "recognitionInterval" << config.recognitionInterval;
+    fs << "recognitionInliers" << config.recognitionInliers;
+
+    // writeDetectorParameters is not const
+    aruco::DetectorParameters parameters = config.parameters;
+    parameters.writeDetectorParameters(fs, "detectorParameters");
+  } catch (const Exception& e) {
+    cerr << "Error writing detector configuration: " << e.what() << endl;
+    return -1;
+  }
+
+  fs.release();
+  cout << "Detector configuration saved to " << filePath << endl;
+  return 0;
+}
+
+}
@@ -0,0 +1,206 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: The detection and compositing engine without the application
+ * around it. An Engine holds everything one installation needs, so a host
+ * application can run several side by side and feed them its own frames. The
+ * command line program is one such host.
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include "../include/compositor.h"
+#include "../include/engine.h"
+
+using namespace std;
+using namespace cv;
+
+namespace engine {
+
+/**
+ * @brief Loads the paintings, the boards and the painting index. Returns false
+ * if there are no exhibits or the index could not be built.
+ */
+bool
+Engine::open(const EngineOptions& options)
+{
+  this->options = options;
+  useOpenCL = options.useOpenCL && compositor::openCLActive();
+  cameras.clear();
+  currentExhibit = 0;
+  overlay = camera_pipeline::OverlayFrame();
+  overlaySet.reset();
+
+  // Exhibits are the still paintings followed by the videos
+  library.reset(
+    new exhibit_library::ExhibitLibrary(options.paintingDirectory,
+                                        options.detectorConfig.markerLength,
+                                        useOpenCL,
+                                        options.tilePaintings,
+                                        options.paintingFormat));
+  if (library->load() == 0) {
+    cerr << "No paintings or videos found in " << options.paintingDirectory
+         << endl;
+    return false;
+  }
+
+  boards.clear();
+  if (!options.boardFile.empty()) {
+    boards = marker_board::loadBoardsFromFile(
+      options.boardFile,
+      options.detectorConfig.getDictionary(),
+      options.detectorConfig.markerLength);
+  }
+
+  // Describing a large collection takes a while, so the index is saved for
+  // the next start
+  paintingIndex.reset();
+  if (!options.paintingIndexFile.empty()) {
+    shared_ptr<recognition::PaintingIndex> index =
+      make_shared<recognition::PaintingIndex>();
+    if (!index->load(options.paintingIndexFile)) {
+      cout << "Building painting index " << options.paintingIndexFile << endl;
+      if (!index->build(exhibits()->paintings, options.paintingFeatures)) {
+        return false;
+      }
+      index->save(options.paintingIndexFile);
+    }
+    paintingIndex = index;
+  }
+  return true;
+}
+
+/**
+ * @brief Adds a camera whose parameters are read from calibrationFile. source
+ * names it in the metrics and is the device index or URL that
+ * camera(index).open() captures from. Returns the camera's index.
+ */
+int
+Engine::addCamera(const string& source, const string& calibrationFile)
+{
+  cameras.push_back(unique_ptr<camera_pipeline::CameraPipeline>(
+    new camera_pipeline::CameraPipeline(source,
+                                        calibrationFile,
+                                        options.detectorConfig,
+                                        boards,
+                                        useOpenCL,
+                                        options.handleOcclusion,
+                                        paintingIndex)));
+  return (int)cameras.size() - 1;
+}
+
+/**
+ * @brief Starts picking up changes to the painting directory
+ */
+bool
+Engine::watch()
+{
+  return library->watch();
+}
+
+/**
+ * @brief Grabs the next frame of every camera opened for capture. Returns
+ * false if none had one.
+ */
+bool
+Engine::grab()
+{
+  // All cameras are grabbed before any is decoded so the frames line up
+  bool anyGrabbed = false;
+  for (auto& camera : cameras) {
+    anyGrabbed |= camera->grab();
+  }
+  return anyGrabbed;
+}
+
+/**
+ * @brief Resolves the current exhibit into the frame to draw at displayTime
+ * and returns the exhibits it came from. With every camera idle, videos are
+ * left to pause, but a new selection or a reload is still picked up.
+ */
+shared_ptr<const camera_pipeline::ExhibitSet>
+Engine::beginFrame(double displayTime)
+{
+  // The set stays alive for this frame even if a reload replaces it
+  shared_ptr<const camera_pipeline::ExhibitSet> current = exhibits();
+  if (currentExhibit >= current->size()) {
+    currentExhibit = 0;
+  }
+
+  bool allIdle =
+    !cameras.empty() &&
+    all_of(cameras.begin(),
+           cameras.end(),
+           [](const unique_ptr<camera_pipeline::CameraPipeline>& camera) {
+             return camera->idle();
+           });
+  if (!allIdle || currentExhibit != overlay.exhibit || current != overlaySet) {
+    camera_pipeline::selectExhibit(
+      *current, currentExhibit, displayTime, useOpenCL, overlay);
+    overlaySet = current;
+  }
+  return current;
+}
+
+/**
+ * @brief Composites the current exhibit into the grabbed frame of every
+ * camera, in parallel. drawn receives the area covered in each camera.
+ */
+void
+Engine::process(double displayTime, vector<Rect>& drawn)
+{
+  shared_ptr<const camera_pipeline::ExhibitSet> current =
+    beginFrame(displayTime);
+
+  // Each camera is processed on OpenCV's shared thread pool
+  drawn.assign(cameras.size(), Rect());
+  parallel_for_(Range(0, (int)cameras.size()), [&](const Range& range) {
+    for (int i = range.start; i < range.end; i++) {
+      drawn[i] = cameras[i]->process(overlay, *current);
+    }
+  });
+
+  // A video is decoded at the largest resolution it occupies on screen
+  Size largest;
+  for (size_t i = 0; i < cameras.size(); i++) {
+    if (cameras[i]->hasFrame()) {
+      largest.width = max(largest.width, drawn[i].width);
+      largest.height = max(largest.height, drawn[i].height);
+    }
+  }
+  if (currentExhibit >= (int)current->paintings.size() &&
+      largest.area() > 0) {
+    current->videos[currentExhibit - current->paintings.size()]
+      ->setTargetSize(largest);
+  }
+}
+
+/**
+ * @brief Detects markers in frame, a CV_8UC3 image seen by camera, and draws
+ * the current exhibit into it in place. Nothing is copied and frame is not
+ * kept. timestamp is when it was captured, now if 0. Returns the area drawn.
+ */
+Rect
+Engine::composite(int camera, Mat& frame, double timestamp)
+{
+  if (camera < 0 || camera >= (int)cameras.size()) {
+    cerr << "No camera " << camera << endl;
+    return Rect();
+  }
+  double now = (double)getTickCount() / getTickFrequency();
+  shared_ptr<const camera_pipeline::ExhibitSet> current = beginFrame(now);
+  return cameras[camera]->processInPlace(frame, overlay, *current, timestamp);
+}
+
+/**
+ * @brief Makes the exhibit at index, wrapped around, the one drawn
+ */
+void
+Engine::select(int index)
+{
+  int count = exhibitCount();
+  currentExhibit = count > 0 ? ((index % count) + count) % count : 0;
+}
+
+}
@@ -0,0 +1,402 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Keep the exhibits in sync with the painting directory while the
+ * application runs, so curators can add or swap a painting without a
+ * restart.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "../include/ar_utils.h"
+#include "../include/exhibit_library.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+namespace exhibit_library {
+
+// How often the directory is checked without inotify
+static const chrono::milliseconds pollInterval(500);
+
+// A change is only picked up once the directory has been quiet this long, so
+// a file still being copied is not decoded half written
+static const chrono::milliseconds settleTime(500);
+
+/**
+ * @brief With uploadPaintings, paintings are also uploaded for the OpenCL path
+ * as they are loaded. With tilePaintings, they also get a tiled copy for the
+ * CPU warp. With a Yuv420 paintingFormat, paintings are kept in YUV 4:2:0
+ * tiles only, at half the memory.
+ */
+ExhibitLibrary::ExhibitLibrary(const string& directory,
+                               float markerLength,
+                               bool uploadPaintings,
+                               bool tilePaintings,
+                               tiled_image::PixelFormat paintingFormat)
+  : directory(directory)
+  , markerLength(markerLength)
+  , uploadPaintings(uploadPaintings)
+  , tilePaintings(tilePaintings)
+  , paintingFormat(paintingFormat)
+  , exhibits(make_shared<camera_pipeline::ExhibitSet>())
+  , paintingBytes(metrics::registry().gauge(
+      "augmuseum_painting_bytes",
+      "Memory held by decoded paintings"))
+  , reloads(metrics::registry().counter(
+      "augmuseum_exhibit_reloads_total",
+      "Times the painting directory was reloaded after a change"))
+{
+}
+
+ExhibitLibrary::~ExhibitLibrary()
+{
+  stop();
+}
+
+/**
+ * @brief Loads every painting and video in the directory. Returns the number
+ * of exhibits.
+ */
+int
+ExhibitLibrary::load()
+{
+  shared_ptr<camera_pipeline::ExhibitSet> next =
+    make_shared<camera_pipeline::ExhibitSet>();
+  next->paintings =
+    painting::loadPaintingsFromDirectory(directory, markerLength);
+  next->videos =
+    video_overlay::loadVideosFromDirectory(directory, markerLength);
+  next->indexMarkers();
+  for (painting::Painting& painting : next->paintings) {
+    prepare(painting);
+  }
+
+  publish(next);
+  return next->size();
+}
+
+/**
+ * @brief Builds the copies of a freshly decoded painting that the compositor
+ * reads from
+ */
+void
+ExhibitLibrary::prepare(painting::Painting& painting) const
+{
+  // Paintings are uploaded once so the UMat path doesn't re-upload per frame
+  if (uploadPaintings) {
+    painting.image.copyTo(painting.uImage);
+  }
+  bool compact = paintingFormat == tiled_image::PixelFormat::Yuv420;
+  if (tilePaintings || compact) {
+    shared_ptr<tiled_image::TiledImage> tiled =
+      make_shared<tiled_image::TiledImage>();
+    tiled->build(painting.image, paintingFormat);
+    painting.tiled = tiled;
+
+    // Paintings with an alpha channel can't be tiled and stay as they are
+    if (compact && !tiled->empty()) {
+      painting.image.release();
+    }
+  }
+}
+
+std::shared_ptr<const camera_pipeline::ExhibitSet>
+ExhibitLibrary::current() const
+{
+  return atomic_load(&exhibits);
+}
+
+/**
+ * @brief Makes next the set every reader sees from their next current() on
+ */
+void
+ExhibitLibrary::publish(const shared_ptr<camera_pipeline::ExhibitSet>& next)
+{
+  double bytes = 0;
+  for (const painting::Painting& painting : next->paintings) {
+    bytes += painting.image.total() * painting.image.elemSize();
+    if (painting.tiled) {
+      bytes += painting.tiled->bytes();
+    }
+  }
+  paintingBytes.set(bytes);
+
+  atomic_store(&exhibits,
+               shared_ptr<const camera_pipeline::ExhibitSet>(next));
+}
+
+/**
+ * @brief Starts reloading added, changed and removed files in the background.
+ * Uses inotify on Linux and polls elsewhere.
+ */
+bool
+ExhibitLibrary::watch()
+{
+  if (watcher.joinable()) {
+    return true;
+  }
+  if (!fs::is_directory(directory)) {
+    cerr << "Cannot watch " << directory << ", not a directory" << endl;
+    return false;
+  }
+
+#ifdef __linux__
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd >= 0 &&
+      inotify_add_watch(inotifyFd,
+                        directory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                          IN_DELETE) < 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+#endif
+
+  // The polling fallback compares against the directory as it is now
+  set<string> ignored;
+  if (inotifyFd < 0) {
+    scanForChanges(ignored);
+  }
+
+  stopping = false;
+  watcher = thread(&ExhibitLibrary::watchLoop, this);
+  cout << "Watching " << directory << " for painting changes"
+       << (inotifyFd >= 0 ? " (inotify)" : " (polling)") << endl;
+  return true;
+}
+
+/**
+ * @brief Stops the watch thread
+ */
+void
+ExhibitLibrary::stop()
+{
+  stopping = true;
+  if (watcher.joinable()) {
+    watcher.join();
+  }
+#ifdef __linux__
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+#endif
+}
+
+/**
+ * @brief Watch thread body. Rebuilds the set after every settled change.
+ */
+void
+ExhibitLibrary::watchLoop()
+{
+  set<string> changed;
+  while (waitForChanges(changed)) {
+    rebuild(changed);
+  }
+}
+
+/**
+ * @brief Blocks until files changed and the directory settled, filling
+ * changed with their names. Returns false when stopping.
+ */
+bool
+ExhibitLibrary::waitForChanges(set<string>& changed)
+{
+  changed.clear();
+  while (!stopping) {
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+      pollfd events = { inotifyFd, POLLIN, 0 };
+      int timeout = changed.empty() ? 200 : (int)settleTime.count();
+      int ready = poll(&events, 1, timeout);
+      if (ready > 0) {
+        readEvents(changed);
+      } else if (ready == 0 && !changed.empty()) {
+        return true;
+      }
+      continue;
+    }
+#endif
+
+    this_thread::sleep_for(changed.empty() ? pollInterval : settleTime);
+    size_t before = changed.size();
+    set<string> differences;
+    scanForChanges(differences);
+    changed.insert(differences.begin(), differences.end());
+    if (differences.empty() && before > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Adds the names of files that appeared, disappeared or were modified
+ * since the last scan to changed
+ */
+void
+ExhibitLibrary::scanForChanges(set<string>& changed)
+{
+  map<string, pair<int64_t, uintmax_t>> files;
+  try {
+    for (const auto& file : fs::directory_iterator(directory)) {
+      if (!file.is_regular_file()) {
+        continue;
+      }
+      files[file.path().filename().string()] = make_pair(
+        (int64_t)file.last_write_time().time_since_epoch().count(),
+        file.file_size());
+    }
+  } catch (const fs::filesystem_error& e) {
+    cerr << "Error scanning " << directory << ": " << e.what() << endl;
+    return;
+  }
+
+  for (const auto& file : files) {
+    auto previous = snapshot.find(file.first);
+    if (previous == snapshot.end() || previous->second != file.second) {
+      changed.insert(file.first);
+    }
+  }
+  for (const auto& file : snapshot) {
+    if (files.find(file.first) == files.end()) {
+      changed.insert(file.first);
+    }
+  }
+  snapshot.swap(files);
+}
+
+/**
+ * @brief Adds the file names of pending inotify events to changed
+ */
+void
+ExhibitLibrary::readEvents(set<string>& changed)
+{
+#ifdef __linux__
+  alignas(inotify_event) char buffer[4096];
+  ssize_t length;
+  while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+    for (char* p = buffer; p < buffer + length;) {
+      const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+      if (event->len > 0) {
+        changed.insert(event->name);
+      }
+      p += sizeof(inotify_event) + event->len;
+    }
+  }
+#else
+  (void)changed;
+#endif
+}
+
+/**
+ * @brief Builds a new set from the current one. Only the files in changed are
+ * decoded again; every other painting keeps its pixels and is placed again in
+ * case the layout file changed.
+ */
+void
+ExhibitLibrary::rebuild(const set<string>& changed)
+{
+  ar_utils::printBorder();
+  cout << "Painting directory changed, reloading " << changed.size()
+       << " file(s)" << endl;
+
+  shared_ptr<const camera_pipeline::ExhibitSet> previous = current();
+  shared_ptr<camera_pipeline::ExhibitSet> next =
+    make_shared<camera_pipeline::ExhibitSet>();
+  bool layoutChanged = changed.count(painting::layoutFileName) > 0;
+  map<string, painting::Layout> layouts = painting::loadLayouts(directory);
+
+  try {
+    for (const string& fileName : painting::listPaintingFiles(directory)) {
+      auto kept = find_if(previous->paintings.begin(),
+                          previous->paintings.end(),
+                          [&](const painting::Painting& painting) {
+                            return painting.name == fileName;
+                          });
+
+      if (kept != previous->paintings.end() && !changed.count(fileName)) {
+        Size size = kept->image.empty() && kept->tiled ? kept->tiled->size()
+                                                       : kept->image.size();
+        painting::Painting painting =
+          painting::describePainting(fileName, size, layouts, markerLength);
+        painting.image = kept->image;
+        painting.uImage = kept->uImage;
+        painting.tiled = kept->tiled;
+        painting.version = kept->version;
+        next->paintings.push_back(painting);
+        continue;
+      }
+
+      painting::Painting painting;
+      if (painting::loadPainting(
+            directory, fileName, layouts, markerLength, painting)) {
+        prepare(painting);
+        next->paintings.push_back(painting);
+      }
+    }
+
+    // Videos keep decoding unless their file or their layout changed
+    vector<string> videoFiles;
+    for (const auto& file : fs::directory_iterator(directory)) {
+      if (ar_utils::isVideoFile(file.path().string())) {
+        videoFiles.push_back(file.path().filename().string());
+      }
+    }
+    sort(videoFiles.begin(), videoFiles.end());
+
+    for (const string& fileName : videoFiles) {
+      auto kept = find_if(
+        previous->videos.begin(),
+        previous->videos.end(),
+        [&](const shared_ptr<video_overlay::VideoOverlay>& video) {
+          return video->placement().name == fileName;
+        });
+
+      if (kept != previous->videos.end() && !changed.count(fileName) &&
+          !layoutChanged) {
+        next->videos.push_back(*kept);
+        continue;
+      }
+
+      string filePath = (fs::path(directory) / fileName).string();
+      shared_ptr<video_overlay::VideoOverlay> video =
+        make_shared<video_overlay::VideoOverlay>(
+          filePath, layouts, markerLength);
+      if (video->isOpened()) {
+        cout << "Loaded video: " << filePath << endl;
+        next->videos.push_back(video);
+      }
+    }
+  } catch (const fs::filesystem_error& e) {
+    cerr << "Error reloading " << directory << ": " << e.what() << endl;
+    return;
+  }
+
+  if (next->size() == 0) {
+    cerr << "No paintings or videos left in " << directory
+         << ", keeping the current exhibits" << endl;
+    return;
+  }
+
+  next->indexMarkers();
+  publish(next);
+  reloads.add();
+  cout << "Now showing " << next->paintings.size() << " paintings and "
+       << next->videos.size() << " videos" << endl;
+}
+
+}
@@ -0,0 +1,320 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Publish camera frames, composited frames and what was detected in
+ * them to a POSIX shared-memory ring, so other processes on the kiosk can
+ * read them in place instead of opening the cameras or scraping the window.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/frame_bus.h"
+
+using namespace std;
+using namespace cv;
+
+namespace frame_bus {
+
+static const char busMagic[8] = { 'A', 'M', 'F', 'B', 'U', 'S', '0', '1' };
+
+/**
+ * @brief value rounded up to a multiple of alignment
+ */
+static size_t
+roundUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+FrameBus::~FrameBus()
+{
+  close();
+}
+
+/**
+ * @brief Creates the shared memory called name ("/augmuseum") with slots
+ * slots of up to frameCapacity bytes of pixels each. Fails if the name is
+ * already in use.
+ */
+bool
+FrameBus::open(const string& name, int slots, size_t frameCapacity)
+{
+  close();
+  if (slots < 2 || frameCapacity == 0) {
+    cerr << "The frame bus needs at least 2 slots" << endl;
+    return false;
+  }
+
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t slotsOffset = roundUp(sizeof(BusHeader), page);
+  size_t pixelsOffset = roundUp(sizeof(SlotHeader), 64);
+  size_t slotStride = roundUp(pixelsOffset + frameCapacity, page);
+  size_t total = slotsOffset + slotStride * slots;
+
+  // A name in use may belong to another running kiosk, so it is never
+  // removed here. Only close() removes the bus this process created.
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    cerr << "Frame bus " << name << " is already in use. If no other process "
+         << "publishes to it, it was left behind by a crash; remove it (on "
+         << "Linux, /dev/shm" << name << ") and try again." << endl;
+    return false;
+  }
+  if (fd < 0) {
+    cerr << "Failed to create frame bus " << name << ": " << strerror(errno)
+         << endl;
+    return false;
+  }
+  void* memory = MAP_FAILED;
+  if (ftruncate(fd, (off_t)total) == 0) {
+    memory =
+      mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    cerr << "Failed to map frame bus " << name << ": " << strerror(errno)
+         << endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // Pages are only backed once a frame is written to them
+  header = new (memory) BusHeader();
+  header->version = busVersion;
+  header->slotCount = (uint32_t)slots;
+  header->slotsOffset = slotsOffset;
+  header->slotStride = slotStride;
+  header->pixelsOffset = pixelsOffset;
+  header->frameCapacity = frameCapacity;
+  header->latest.store(0);
+  for (int i = 0; i < slots; i++) {
+    char* slot = (char*)memory + slotsOffset + slotStride * i;
+    new (slot) SlotHeader();
+    ((SlotHeader*)slot)->sequence.store(0);
+  }
+
+  // Readers accept the bus once the magic is there
+  atomic_thread_fence(memory_order_release);
+  memcpy(header->magic, busMagic, sizeof(busMagic));
+
+  this->name = name;
+  mappedBytes = total;
+  sequence = 0;
+  frameNumbers.clear();
+  warnedTooLarge = false;
+  cout << "Publishing frames to shared memory " << name << " (" << slots
+       << " slots of " << frameCapacity / 1024 << " KiB)" << endl;
+  return true;
+}
+
+/**
+ * @brief Unmaps and removes the shared memory
+ */
+void
+FrameBus::close()
+{
+  if (!header) {
+    return;
+  }
+  munmap(header, mappedBytes);
+  shm_unlink(name.c_str());
+  header = nullptr;
+  mappedBytes = 0;
+}
+
+/**
+ * @brief Copies frame and its markers into the next slot. Returns the frame's
+ * sequence number, or 0 if it didn't fit.
+ */
+uint64_t
+FrameBus::publish(int camera,
+                  FrameKind kind,
+                  const Mat& frame,
+                  double timestamp,
+                  const vector<session::MarkerDetection>& detections,
+                  const vector<session::TrackedPose>& poses)
+{
+  if (!header || frame.empty() || camera < 0) {
+    return 0;
+  }
+  size_t rowBytes = frame.cols * frame.elemSize();
+  size_t bytes = rowBytes * frame.rows;
+  if (bytes > header->frameCapacity) {
+    if (!warnedTooLarge) {
+      cerr << "Frame of " << bytes << " bytes does not fit the frame bus, "
+           << "skipping frames that large" << endl;
+      warnedTooLarge = true;
+    }
+    return 0;
+  }
+
+  size_t stream = (size_t)camera * 2 + kind;
+  if (frameNumbers.size() <= stream) {
+    frameNumbers.resize(stream + 1, 0);
+  }
+
+  uint64_t next = ++sequence;
+  char* base = (char*)header + header->slotsOffset +
+               header->slotStride * ((next - 1) % header->slotCount);
+  SlotHeader* slot = (SlotHeader*)base;
+
+  // Readers that catch the slot now see it as in progress
+  slot->sequence.store(0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->camera = (uint32_t)camera;
+  slot->kind = kind;
+  slot->frameNumber = ++frameNumbers[stream];
+  slot->timestamp = timestamp;
+  slot->width = frame.cols;
+  slot->height = frame.rows;
+  slot->type = frame.type();
+  slot->step = (uint32_t)rowBytes;
+  slot->bytes = bytes;
+
+  slot->detectionCount = (uint32_t)min<size_t>(detections.size(), maxMarkers);
+  for (uint32_t i = 0; i < slot->detectionCount; i++) {
+    slot->detections[i].id = detections[i].id;
+    for (int k = 0; k < 4; k++) {
+      slot->detections[i].corners[2 * k] = detections[i].corners[k].x;
+      slot->detections[i].corners[2 * k + 1] = detections[i].corners[k].y;
+    }
+  }
+  slot->poseCount = (uint32_t)min<size_t>(poses.size(), maxMarkers);
+  for (uint32_t i = 0; i < slot->poseCount; i++) {
+    slot->poses[i].key = poses[i].key;
+    slot->poses[i].state = poses[i].state;
+    for (int k = 0; k < 3; k++) {
+      slot->poses[i].rvec[k] = poses[i].rvec[k];
+      slot->poses[i].tvec[k] = poses[i].tvec[k];
+    }
+  }
+
+  char* pixels = base + header->pixelsOffset;
+  if (frame.isContinuous()) {
+    memcpy(pixels, frame.data, bytes);
+  } else {
+    for (int y = 0; y < frame.rows; y++) {
+      memcpy(pixels + rowBytes * y, frame.ptr(y), rowBytes);
+    }
+  }
+
+  slot->sequence.store(next, memory_order_release);
+  header->latest.store(next, memory_order_release);
+  return next;
+}
+
+FrameBusReader::~FrameBusReader()
+{
+  close();
+}
+
+/**
+ * @brief Maps the bus called name read-only
+ */
+bool
+FrameBusReader::open(const string& name)
+{
+  close();
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    cerr << "Failed to open frame bus " << name << ": " << strerror(errno)
+         << endl;
+    return false;
+  }
+  struct stat info;
+  void* memory = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(BusHeader)) {
+    memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    cerr << "Failed to map frame bus " << name << endl;
+    return false;
+  }
+
+  const BusHeader* mapped = (const BusHeader*)memory;
+  bool usable = memcmp(mapped->magic, busMagic, sizeof(busMagic)) == 0;
+  atomic_thread_fence(memory_order_acquire);
+  usable = usable && mapped->version == busVersion &&
+           mapped->slotsOffset + mapped->slotStride * mapped->slotCount <=
+             (uint64_t)info.st_size;
+  if (!usable) {
+    cerr << "Frame bus " << name << " is not ready or from another version"
+         << endl;
+    munmap(memory, info.st_size);
+    return false;
+  }
+
+  header = mapped;
+  mappedBytes = info.st_size;
+  return true;
+}
+
+void
+FrameBusReader::close()
+{
+  if (header) {
+    munmap((void*)header, mappedBytes);
+    header = nullptr;
+    mappedBytes = 0;
+  }
+}
+
+/**
+ * @brief Sequence number of the newest complete frame, 0 if none yet
+ */
+uint64_t
+FrameBusReader::latest() const
+{
+  return header->latest.load(memory_order_acquire);
+}
+
+/**
+ * @brief The slot holding frame sequence, or nullptr if it was already
+ * overwritten or is being written
+ */
+const SlotHeader*
+FrameBusReader::slot(uint64_t sequence) const
+{
+  if (sequence == 0) {
+    return nullptr;
+  }
+  const char* base = (const char*)header + header->slotsOffset +
+                     header->slotStride * ((sequence - 1) % header->slotCount);
+  const SlotHeader* slot = (const SlotHeader*)base;
+  if (slot->sequence.load(memory_order_acquire) != sequence) {
+    return nullptr;
+  }
+  return slot;
+}
+
+/**
+ * @brief True if the slot still holds frame sequence
+ */
+bool
+FrameBusReader::valid(const SlotHeader* slot, uint64_t sequence) const
+{
+  atomic_thread_fence(memory_order_acquire);
+  return slot && slot->sequence.load(memory_order_relaxed) == sequence;
+}
+
+/**
+ * @brief The slot's pixels as a Mat that points into the shared memory
+ */
+Mat
+FrameBusReader::image(const SlotHeader* slot) const
+{
+  const char* pixels = (const char*)slot + header->pixelsOffset;
+  return Mat(slot->height, slot->width, slot->type, (void*)pixels, slot->step);
+}
+
+}
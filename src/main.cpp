@@ -7,23 +7,35 @@
  * displays.
  */
 
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
 #include <opencv2/aruco.hpp>
 #include <opencv2/opencv.hpp>
 
 #include "../include/ar_utils.h"
+#include "../include/autotune.h"
+#include "../include/benchmark.h"
+#include "../include/camera_pipeline.h"
+#include "../include/capture.h"
 #include "../include/cmdparser.hpp"
+#include "../include/compositor.h"
+#include "../include/detector_config.h"
+#include "../include/engine.h"
+#include "../include/frame_bus.h"
+#include "../include/marker_sheet.h"
+#include "../include/metrics.h"
+#include "../include/recognition.h"
+#include "../include/replay.h"
+#include "../include/session.h"
+#include "../include/stream_server.h"
+#include "../include/tiled_image.h"
 
 using namespace std;
 using namespace cv;
 
 namespace fs = std::__fs::filesystem;
 
-Mat camMatrix, dCoeffs;
-vector<Mat> rotationVectors, translationVectors;
-vector<Mat> images;
-
 /**
  * @brief Configures the parameters being passed in through the command line.
  */
@@ -35,7 +47,8 @@ configureParser(cli::Parser& parser)
     "path",
     "bin/paintings",
     "Set path for directory containing images. Defaults to bin/paintings "
-    "directory which contains a handful of assorted artworks.");
+    "directory which contains a handful of assorted artworks. Video files "
+    "(mp4, mov, avi, mkv, webm) in the directory are played as loops.");
 
   parser.set_optional<string>("c",
                               "calibration",
@@ -44,155 +57,258 @@ configureParser(cli::Parser& parser)
 
   parser.set_optional<bool>(
     "a", "aruco", false, "If true, creates an ArUco marker and saves it");
-}
 
-/**
- * @brief Overlay a painting onto an ArUco marker
- */
-void
-overlayImage2(const Mat& src,
-              Mat& dest,
-              const Mat& overlay,
-              const vector<Point2f>& markerCorners,
-              const Vec3d& rvec,
-              const Vec3d& tvec,
-              const Mat& camMatrix,
-              const Mat& dCoeffs)
-{
-  vector<Point3f> objectPoints = { Point3f(-overlay.cols, overlay.rows, 0),
-                                   Point3f(overlay.cols, overlay.rows, 0),
-                                   Point3f(overlay.cols, -overlay.rows, 0),
-                                   Point3f(-overlay.cols, -overlay.rows, 0) };
-
-  vector<Point2f> imagePoints;
-  projectPoints(objectPoints, rvec, tvec, camMatrix, dCoeffs, imagePoints);
-
-  vector<Point2f> overlayPoints = { Point2f(0, 0),
-                                    Point2f(overlay.cols, 0),
-                                    Point2f(overlay.cols, overlay.rows),
-                                    Point2f(0, overlay.rows) };
-  Mat homography = findHomography(overlayPoints, imagePoints);
-  if (homography.empty()) {
-    cerr << "Failed to compute homography matrix." << endl;
-    return;
-  }
+  parser.set_optional<string>(
+    "gm",
+    "generate-markers",
+    "",
+    "Marker ids to generate, e.g. 0-49,60. Renders them onto printable pages "
+    "in --marker-output, assigns them to the paintings in --path and exits.");
+
+  parser.set_optional<int>(
+    "dpi", "dpi", 300, "Print resolution used by --generate-markers");
+
+  parser.set_optional<float>("mm",
+                             "marker-mm",
+                             50,
+                             "Printed marker side in millimetres, used by "
+                             "--generate-markers");
+
+  parser.set_optional<string>("mo",
+                              "marker-output",
+                              "markers",
+                              "Directory --generate-markers writes to");
 
-  Mat warpedOverlay;
-  warpPerspective(
-    overlay,
-    warpedOverlay,
-    homography,
-    src.size()); // This should be the size of the output image instead of src.
-
-  Mat overlayMask = Mat::zeros(src.size(), CV_8UC1);
-  vector<Point> overlayPolygon;
-  for (const Point2f& p : imagePoints) {
-    overlayPolygon.push_back(
-      Point(static_cast<int>(p.x), static_cast<int>(p.y)));
-  }
-  fillConvexPoly(
-    overlayMask, overlayPolygon.data(), overlayPolygon.size(), Scalar(255));
+  parser.set_optional<string>(
+    "dc",
+    "detector-config",
+    "bin/detector_config.yml",
+    "Path to the file holding the ArUco dictionary, marker size and detector "
+    "parameters");
 
-  Mat backgroundMask;
-  bitwise_not(overlayMask, backgroundMask);
+  parser.set_optional<string>(
+    "at",
+    "autotune",
+    "",
+    "Path to a recorded clip. Sweeps the detector parameters over it, prints "
+    "detection rate vs. ms/frame and writes the best set to "
+    "--autotune-output, then exits.");
+
+  parser.set_optional<int>("atf",
+                           "autotune-frames",
+                           100,
+                           "Number of frames of the clip used by --autotune");
 
-  Mat background;
-  src.copyTo(background, backgroundMask);
-  bitwise_and(warpedOverlay, warpedOverlay, overlayMask);
+  parser.set_optional<string>(
+    "ato",
+    "autotune-output",
+    "bin/detector_config.tuned.yml",
+    "Where --autotune writes the best parameter set. Kept apart from "
+    "--detector-config so a tuning run never replaces the settings in use; "
+    "point it at that file to do so.");
 
-  add(background, warpedOverlay, dest);
-}
+  parser.set_optional<bool>(
+    "cpu",
+    "force-cpu",
+    false,
+    "If true, disables the OpenCL (UMat) path even when a device is "
+    "available. Useful for comparing output against the CPU path.");
+
+  parser.set_optional<vector<string>>(
+    "cam",
+    "cameras",
+    vector<string>{ "0" },
+    "Capture sources to process, each a device index or a video file/stream "
+    "URL. Every source runs its own detection and compositing pipeline.");
+
+  parser.set_optional<vector<string>>(
+    "cc",
+    "camera-calibrations",
+    vector<string>(),
+    "Calibration file for each source given to --cameras, in the same "
+    "order. Sources without one use --calibration.");
 
-/**
- * @brief Runs OpenCV's logic for detecting ArUco markers and overlays an image
- * on top of it. This function is intended for only 1 ArUco marker.
- */
-void
-detectAndOverlayMarker(Mat& src, Mat& dest, Mat& overlay, Mat& objPoints)
-{
-  int markerSize = 200;
-  vector<int> markerIds;
-  vector<vector<Point2f>> markerCorners, rejectedCandidates;
+  parser.set_optional<string>(
+    "cb",
+    "capture-backend",
+    "any",
+    "Capture backend for --cameras: any, v4l2, gstreamer, ffmpeg, "
+    "avfoundation, msmf or dshow");
 
-  aruco::Dictionary dictionary =
-    aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
-  aruco::DetectorParameters detectorParams = aruco::DetectorParameters();
-  aruco::ArucoDetector detector(dictionary, detectorParams);
+  parser.set_optional<string>(
+    "res",
+    "resolution",
+    "",
+    "Capture resolution to request, e.g. 1280x720. Empty keeps the driver's "
+    "default.");
 
-  detector.detectMarkers(src, markerCorners, markerIds);
-  size_t nMarkers = markerCorners.size();
-  vector<Vec3d> rvecs(nMarkers), tvecs(nMarkers);
+  parser.set_optional<float>(
+    "fps", "capture-fps", 0, "Capture frame rate to request, 0 for default");
 
-  if (!markerIds.empty()) {
+  parser.set_optional<string>(
+    "fcc",
+    "fourcc",
+    "",
+    "Capture pixel format to request, e.g. MJPG or YUYV. With YUYV on Linux "
+    "the luma goes straight to detection.");
+
+  parser.set_optional<int>(
+    "buf",
+    "capture-buffers",
+    2,
+    "Frames the driver may queue for a device. Fewer buffers mean less "
+    "latency from capture to display.");
 
-    for (size_t i = 0; i < nMarkers; i++) {
-      solvePnP(objPoints,
-               markerCorners.at(i),
-               camMatrix,
-               dCoeffs,
-               rvecs.at(i),
-               tvecs.at(i),
-               SOLVEPNP_ITERATIVE);
-      // drawFrameAxes(
-      //   dest, camMatrix, dCoeffs, rvecs[i], tvecs[i], markerSize * 0.5f);
-      overlayImage2(src,
-                    dest,
-                    overlay,
-                    markerCorners[i],
-                    rvecs[i],
-                    tvecs[i],
-                    camMatrix,
-                    dCoeffs);
-    }
-  }
-}
+  parser.set_optional<string>(
+    "bd",
+    "boards",
+    "",
+    "Path to a marker board file (see bin/boards.yml). Markers on a board "
+    "share one pose and the painting is placed relative to the board.");
 
-/**
- * @brief Runs OpenCV's logic for detecting ArUco markers and overlays an image
- * on top of them. This function is intended for multiple ArUco markers.
- */
-void
-detectAndOverlayMultipleMarkers(Mat& src, Mat& dest, Mat& objPoints)
-{
-  vector<int> markerIds;
-  vector<vector<Point2f>> markerCorners;
-  aruco::Dictionary dictionary =
-    aruco::getPredefinedDictionary(aruco::DICT_6X6_250);
-  aruco::DetectorParameters detectorParams = aruco::DetectorParameters();
-  aruco::ArucoDetector detector(dictionary, detectorParams);
-  detector.detectMarkers(src, markerCorners, markerIds);
-
-  // ====
-  size_t nMarkers = markerCorners.size();
-  vector<Vec3d> rvecs(nMarkers), tvecs(nMarkers);
-  // ====
-
-  for (size_t i = 0; i < markerIds.size(); ++i) {
-    int idx = markerIds[i] % images.size();
-    Mat overlay = images[idx];
-
-    // ====
-    solvePnP(objPoints,
-             markerCorners.at(i),
-             camMatrix,
-             dCoeffs,
-             rvecs.at(i),
-             tvecs.at(i),
-             SOLVEPNP_ITERATIVE);
-    // ====
-
-    vector<Point2f> overlayCorners = { Point2f(0, 0),
-                                       Point2f(overlay.cols, 0),
-                                       Point2f(overlay.cols, overlay.rows),
-                                       Point2f(0, overlay.rows) };
-    Mat homography = findHomography(overlayCorners, markerCorners[i]);
-    warpPerspective(
-      overlay, dest, homography, dest.size(), INTER_LINEAR, BORDER_TRANSPARENT);
-  }
+  parser.set_optional<bool>(
+    "oc",
+    "occlusion",
+    false,
+    "If true, keeps people and objects in front of a marker in front of its "
+    "painting. Learns the wall behind each marker while it is visible.");
+
+  parser.set_optional<bool>(
+    "ml",
+    "markerless",
+    false,
+    "If true, also recognizes the paintings in --path themselves, without a "
+    "marker, using --painting-index. The index is built first if missing.");
+
+  parser.set_optional<string>(
+    "pi",
+    "painting-index",
+    "bin/painting_index.bin",
+    "Feature index of the paintings for --markerless, written by "
+    "--build-index");
+
+  parser.set_optional<bool>(
+    "bi",
+    "build-index",
+    false,
+    "If true, computes the features of every painting in --path into "
+    "--painting-index and exits. Rerun after changing the paintings.");
+
+  parser.set_optional<string>(
+    "pf",
+    "painting-features",
+    "orb",
+    "Features --build-index describes the paintings with: orb, or akaze for "
+    "paintings that are seen at a steep angle");
+
+  parser.set_optional<bool>(
+    "t",
+    "tiled",
+    false,
+    "If true, keeps paintings in 8x8 tiles as well, a third larger than the "
+    "painting, and warps them from those on the CPU path. Faster for rotated "
+    "markers, see --benchmark.");
+
+  parser.set_optional<string>(
+    "fmt",
+    "painting-format",
+    "bgr",
+    "How paintings are kept in memory: bgr, or yuv420 for 8x8 tiles of YUV "
+    "4:2:0 at half the memory, converted to BGR as they are warped. yuv420 "
+    "uses the CPU path.");
+
+  parser.set_optional<bool>(
+    "nw",
+    "no-watch",
+    false,
+    "If true, the painting directory is only read at startup. Otherwise "
+    "added, changed and removed files are picked up while running.");
+
+  parser.set_optional<string>(
+    "o",
+    "output",
+    "",
+    "Directory to write each camera's augmented feed to as a video file. "
+    "When empty the feeds are shown in windows instead.");
+
+  parser.set_optional<int>(
+    "of",
+    "output-frames",
+    0,
+    "Frames to write to --output before exiting. 0 writes until every input "
+    "ends.");
+
+  parser.set_optional<string>(
+    "m",
+    "metrics",
+    "",
+    "Serve Prometheus metrics on this localhost port (e.g. 9100) or Unix "
+    "socket (unix:/path). Disabled when empty.");
+
+  parser.set_optional<string>(
+    "st",
+    "stream",
+    "",
+    "Stream each camera's augmented feed as MJPEG over HTTP on this localhost "
+    "port (e.g. 8080), or host:port to listen on another interface (e.g. "
+    "0.0.0.0:8080). Disabled when empty.");
+
+  parser.set_optional<int>(
+    "sq",
+    "stream-quality",
+    80,
+    "JPEG quality of the --stream frames, from 0 to 100");
+
+  parser.set_optional<string>(
+    "fb",
+    "frame-bus",
+    "",
+    "POSIX shared memory name (e.g. /augmuseum) to publish every camera "
+    "frame, composited frame and its markers to, for other processes on the "
+    "kiosk. Disabled when empty.");
+
+  parser.set_optional<int>(
+    "fbs",
+    "frame-bus-slots",
+    16,
+    "Frames the --frame-bus ring holds before it wraps around");
+
+  parser.set_optional<string>(
+    "r",
+    "record",
+    "",
+    "Path of a session file to record to. Saves every camera frame with the "
+    "markers detected and tracked in it, for --replay.");
+
+  parser.set_optional<string>(
+    "rp",
+    "replay",
+    "",
+    "Path of a recorded session. Runs it through the pipeline without "
+    "cameras or windows, prints per-stage timing and exits.");
+
+  parser.set_optional<string>(
+    "g",
+    "golden",
+    "",
+    "Directory of golden frames for --replay. Frames are compared by PSNR; "
+    "missing ones are written, so the first replay records the baseline.");
+
+  parser.set_optional<float>(
+    "psnr",
+    "min-psnr",
+    40,
+    "Lowest PSNR in dB against a golden frame before --replay fails");
+
+  parser.set_optional<bool>("b",
+                            "benchmark",
+                            false,
+                            "If true, times the compositor on a synthetic "
+                            "frame for the CPU and UMat paths and exits");
 }
 
 /**
- * @brief The main loop of the code which will turn the camera on, attempt to
+ * @brief The main loop of the code which will turn the cameras on, attempt to
  * read ArUco markers and display images when a marker is found.
  */
 int
@@ -209,56 +325,290 @@ main(int argc, char* argv[])
 
   ar_utils::printBorder();
 
-  VideoCapture cap(0);
-  if (!cap.isOpened()) {
-    cerr << "Error opening video stream..." << endl;
-    return -1;
-  }
+  auto calibrationFile = parser.get<string>("c");
 
-  ar_utils::printBorder();
+  // Dictionary, marker size and detector parameters
+  detector_config::DetectorConfig detectorConfig;
+  auto detectorConfigFile = parser.get<string>("dc");
+  detector_config::loadDetectorConfig(detectorConfigFile, detectorConfig);
+
+  auto autotuneClip = parser.get<string>("at");
+  if (!autotuneClip.empty()) {
+    int autotuneFrames = parser.get<int>("atf");
+    if (autotuneFrames < 1) {
+      cerr << "--autotune-frames must be at least 1" << endl;
+      return -1;
+    }
+    int result = autotune::tuneDetector(autotuneClip,
+                                        detectorConfig,
+                                        autotuneFrames,
+                                        parser.get<string>("ato"));
+    ar_utils::printBorder();
+    return result;
+  }
 
-  // Load calibration file
-  auto calibrationFile = parser.get<string>("c");
-  cout << "Utilizing calibration file found at " << calibrationFile << endl;
-  ar_utils::loadCalibrationFile(
-    calibrationFile, camMatrix, dCoeffs, rotationVectors, translationVectors);
+  // Batch generate printable markers and assign them to paintings
+  auto markerIds = parser.get<string>("gm");
+  if (!markerIds.empty()) {
+    marker_sheet::SheetOptions options;
+    options.ids = marker_sheet::parseIdList(markerIds);
+    options.dpi = parser.get<int>("dpi");
+    options.markerMillimetres = parser.get<float>("mm");
+    options.outputDirectory = parser.get<string>("mo");
+    int result = marker_sheet::generateMarkerSheets(
+      options, detectorConfig.getDictionary());
+    if (result == 0) {
+      result = marker_sheet::writeMarkerManifest(parser.get<string>("p"),
+                                                 options.ids);
+    }
+    ar_utils::printBorder();
+    return result;
+  }
 
   // Print ArUco marker
   auto printMarker = parser.get<bool>("a");
   if (printMarker) {
+    aruco::Dictionary dictionary = detectorConfig.getDictionary();
     srand(time(NULL));
-    int random = 1 + (rand() % 250);
-    ar_utils::createArucoMarker(random);
+    int random = rand() % dictionary.bytesList.rows;
+    ar_utils::createArucoMarker(
+      random, dictionary, detectorConfig.markerImageSize);
+  }
+
+  // Paintings kept as YUV tiles are only read by the CPU warp
+  tiled_image::PixelFormat paintingFormat;
+  if (!tiled_image::formatFromName(parser.get<string>("fmt"),
+                                   paintingFormat)) {
+    cerr << "Unknown painting format: " << parser.get<string>("fmt") << endl;
+    return -1;
+  }
+  bool compactPaintings = paintingFormat == tiled_image::PixelFormat::Yuv420;
+
+  // Select CPU or OpenCL compositing
+  bool useOpenCL = compositor::configureOpenCL(!parser.get<bool>("cpu") &&
+                                               !compactPaintings);
+
+  // Paintings, boards and, for recognition without markers, the features of
+  // every painting, shared by every camera. The index is built ahead of time
+  // with --build-index, since describing a large collection takes a while.
+  engine::EngineOptions engineOptions;
+  engineOptions.paintingDirectory = parser.get<string>("p");
+  engineOptions.detectorConfig = detectorConfig;
+  engineOptions.boardFile = parser.get<string>("bd");
+  engineOptions.paintingFeatures = parser.get<string>("pf");
+  engineOptions.useOpenCL = useOpenCL;
+  engineOptions.handleOcclusion = parser.get<bool>("oc");
+  engineOptions.tilePaintings = parser.get<bool>("t");
+  engineOptions.paintingFormat = paintingFormat;
+  auto paintingIndexFile = parser.get<string>("pi");
+  if (parser.get<bool>("ml") && !parser.get<bool>("bi")) {
+    engineOptions.paintingIndexFile = paintingIndexFile;
+  }
+  engine::Engine engine;
+  if (!engine.open(engineOptions)) {
+    return -1;
+  }
+
+  ar_utils::printBorder();
+
+  if (parser.get<bool>("b")) {
+    Mat camMatrix, dCoeffs;
+    vector<Mat> rotationVectors, translationVectors;
+    ar_utils::loadCalibrationFile(
+      calibrationFile, camMatrix, dCoeffs, rotationVectors, translationVectors);
+    benchmark::runCompositorBenchmark(
+      engine.exhibits()->paintings, camMatrix, dCoeffs, 200);
+    ar_utils::printBorder();
+    return 0;
+  }
+
+  if (parser.get<bool>("bi")) {
+    recognition::PaintingIndex index;
+    bool built = index.build(engine.exhibits()->paintings,
+                             parser.get<string>("pf")) &&
+                 index.save(paintingIndexFile);
+    ar_utils::printBorder();
+    return built ? 0 : -1;
+  }
+
+  auto calibrations = parser.get<vector<string>>("cc");
+
+  // Headless replay of a recorded session
+  auto replayFile = parser.get<string>("rp");
+  if (!replayFile.empty()) {
+    replay::ReplayOptions options;
+    options.sessionFile = replayFile;
+    options.goldenDirectory = parser.get<string>("g");
+    options.minPsnr = parser.get<float>("psnr");
+    options.calibrationFile = calibrationFile;
+    options.cameraCalibrations = calibrations;
+    options.useOpenCL = engine.openCL();
+    options.handleOcclusion = engineOptions.handleOcclusion;
+    int result = replay::runReplay(
+      options, engine.config(), engine.markerBoards(), *engine.exhibits());
+    ar_utils::printBorder();
+    return result;
+  }
+
+  // One pipeline per capture source, each with its own calibration
+  auto sources = parser.get<vector<string>>("cam");
+  auto outputDirectory = parser.get<string>("o");
+  auto outputFrames = parser.get<int>("of");
+  if (outputFrames < 0) {
+    cerr << "--output-frames must be 0 or more" << endl;
+    return -1;
   }
+  capture::CaptureSettings captureSettings;
+  captureSettings.backend = parser.get<string>("cb");
+  captureSettings.resolution =
+    capture::parseResolution(parser.get<string>("res"));
+  captureSettings.fps = parser.get<float>("fps");
+  captureSettings.fourcc = parser.get<string>("fcc");
+  captureSettings.buffers = parser.get<int>("buf");
+  vector<string> windowNames;
+
+  for (size_t i = 0; i < sources.size(); i++) {
+    ar_utils::printBorder();
+    string cameraCalibration =
+      i < calibrations.size() ? calibrations[i] : calibrationFile;
+    int camera = engine.addCamera(sources[i], cameraCalibration);
+    if (!engine.camera(camera).open(captureSettings)) {
+      return -1;
+    }
 
-  // Load images
-  auto path = parser.get<string>("p");
-  images = ar_utils::loadImagesFromDirectory(path);
-  int currentImageIndex = 0;
-  Mat overlay = images[currentImageIndex];
+    windowNames.push_back(sources.size() == 1
+                            ? "Main Window"
+                            : "Camera " + to_string(i) + " (" + sources[i] +
+                                ")");
+    if (outputDirectory.empty()) {
+      namedWindow(windowNames.back(), WINDOW_AUTOSIZE);
+    }
+  }
+  int cameraCount = engine.cameraCount();
+
+  // Metrics for fleet monitoring, scraped from a local port or socket
+  metrics::MetricsServer metricsServer(metrics::registry());
+  auto metricsAddress = parser.get<string>("m");
+  if (!metricsAddress.empty()) {
+    ar_utils::printBorder();
+    metricsServer.start(metricsAddress);
+  }
+  metrics::Gauge& loopFps = metrics::registry().gauge(
+    "augmuseum_loop_fps", "Frames per second of the render loop");
+
+  // MJPEG feeds for lobby displays and remote monitors
+  stream_server::StreamServer streamServer(cameraCount, parser.get<int>("sq"));
+  auto streamAddress = parser.get<string>("st");
+  if (!streamAddress.empty()) {
+    ar_utils::printBorder();
+    if (!streamServer.start(streamAddress)) {
+      return -1;
+    }
+  }
 
-  // Set coordinate system
-  int markerLength = 200;
-  Mat objPoints = ar_utils::setCoordinateSystem(markerLength);
+  // Raw and composited frames for other processes on the kiosk. Slots fit a
+  // 1080p frame unless a larger capture resolution was asked for; pages are
+  // only backed as frames are written to them.
+  frame_bus::FrameBus frameBus;
+  auto frameBusName = parser.get<string>("fb");
+  if (!frameBusName.empty()) {
+    ar_utils::printBorder();
+    Size largest(max(captureSettings.resolution.width, 1920),
+                 max(captureSettings.resolution.height, 1080));
+    if (!frameBus.open(
+          frameBusName, parser.get<int>("fbs"), (size_t)largest.area() * 3)) {
+      return -1;
+    }
+  }
+
+  // Paintings added to or changed in the directory show up without a restart
+  if (!parser.get<bool>("nw")) {
+    ar_utils::printBorder();
+    engine.watch();
+  }
+
+  // Session recording for replaying field issues
+  session::SessionWriter recorder;
+  session::FrameRecord record;
+  auto recordFile = parser.get<string>("r");
+  if (!recordFile.empty()) {
+    ar_utils::printBorder();
+    if (!recorder.open(recordFile)) {
+      return -1;
+    }
+  }
 
   ar_utils::printBorder();
 
-  namedWindow("Main Window", WINDOW_AUTOSIZE);
+  vector<Rect> drawn;
+  int64 lastFrameTick = getTickCount();
+  double fps = 0;
+  while (engine.grab()) {
+    // Every camera composites the current exhibit, pulling the due frame if
+    // it is a video
+    double displayTime = (double)getTickCount() / getTickFrequency();
+    engine.process(displayTime, drawn);
+
+    for (int i = 0; i < cameraCount; i++) {
+      camera_pipeline::CameraPipeline& camera = engine.camera(i);
+      if (!camera.hasFrame()) {
+        continue;
+      }
 
-  while (cap.grab()) {
-    Mat frame, frameCopy;
-    cap.retrieve(frame);
-    frame.copyTo(frameCopy);
+      // Paintings that coasted this frame are placed as late as possible
+      camera.latch();
+      if (outputDirectory.empty()) {
+        imshow(windowNames[i], camera.output());
+      } else {
+        camera.writeOutput(outputDirectory);
+      }
+      camera.presented();
+      streamServer.publish(i, camera.output());
+      if (frameBus.isOpened()) {
+        frameBus.publish(i,
+                         frame_bus::RawFrame,
+                         camera.input(),
+                         camera.captureTime(),
+                         camera.detections(),
+                         camera.poses());
+        frameBus.publish(i,
+                         frame_bus::CompositedFrame,
+                         camera.output(),
+                         camera.captureTime(),
+                         camera.detections(),
+                         camera.poses());
+      }
 
-    // if (images.size() == 1) {
-    detectAndOverlayMarker(frame, frameCopy, overlay, objPoints);
-    // } else {
-    // detectAndOverlayMultipleMarkers(frame, frameCopy, objPoints);
-    // }
+      if (recorder.isOpened()) {
+        record.camera = i;
+        record.exhibit = engine.selected();
+        record.timestamp = camera.captureTime();
+        record.frame = camera.input();
+        record.detections = camera.detections();
+        record.poses = camera.poses();
+        recorder.write(record);
+      }
+    }
 
-    imshow("Main Window", frameCopy);
+    // Smoothed over roughly the last second
+    int64 frameTick = getTickCount();
+    double frameSeconds = (frameTick - lastFrameTick) / getTickFrequency();
+    lastFrameTick = frameTick;
+    if (frameSeconds > 0) {
+      fps = fps == 0 ? 1 / frameSeconds : 0.95 * fps + 0.05 / frameSeconds;
+      loopFps.set(fps);
+    }
+
+    // Without windows there is no key to quit with, so a live camera needs
+    // a frame limit to stop writing
+    if (!outputDirectory.empty() && outputFrames > 0 &&
+        --outputFrames == 0) {
+      cout << "Wrote the requested frames to " << outputDirectory << endl;
+      break;
+    }
 
-    char key = (char)waitKey(10);
+    // Only long enough to service the windows, any more is added latency
+    char key = (char)waitKey(1);
     if (key == 'q') { // Quit
       cout << "User terminated program" << endl;
       break;
@@ -266,30 +616,22 @@ main(int argc, char* argv[])
 
     else if (key == 's') { // Screenshot
       ar_utils::printBorder();
-      ar_utils::screenshot(frameCopy);
+      for (int i = 0; i < cameraCount; i++) {
+        Mat shot = engine.camera(i).output();
+        ar_utils::screenshot(shot,
+                             cameraCount == 1 ? "" : "_camera" + to_string(i));
+      }
     }
 
     else if (key == 'a') { // Cycle left
-      if (currentImageIndex > 0) {
-        currentImageIndex--;
-        overlay = images[currentImageIndex];
-      } else {
-        currentImageIndex = images.size() - 1;
-        overlay = images[currentImageIndex];
-      }
+      engine.select(engine.selected() - 1);
     }
 
     else if (key == 'd') { // Cycle right
-      if (currentImageIndex < images.size() - 1) {
-        currentImageIndex++;
-        overlay = images[currentImageIndex];
-      } else {
-        currentImageIndex = 0;
-        overlay = images[currentImageIndex];
-      }
+      engine.select(engine.selected() + 1);
     }
   }
 
   ar_utils::printBorder();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,194 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Groups of ArUco markers laid out on one wall that share a single
+ * pose. Every visible marker of a board feeds one solvePnP, which keeps large
+ * paintings steady at long range.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/marker_board.h"
+
+using namespace std;
+using namespace cv;
+
+namespace marker_board {
+
+/**
+ * @brief Corners of a marker centred at centre, in the same order and
+ * orientation as setCoordinateSystem
+ */
+static vector<Point3f>
+markerCornersAt(Point2f centre, float markerLength)
+{
+  float half = markerLength / 2.f;
+  return { Point3f(centre.x - half, centre.y + half, 0),
+           Point3f(centre.x + half, centre.y + half, 0),
+           Point3f(centre.x + half, centre.y - half, 0),
+           Point3f(centre.x - half, centre.y - half, 0) };
+}
+
+/**
+ * @brief Reads one board entry. Grid boards give markersX/markersY and a
+ * separation, custom boards list the centre of each marker in positions.
+ */
+static bool
+readBoard(const FileNode& node,
+          const aruco::Dictionary& dictionary,
+          float defaultMarkerLength,
+          MarkerBoard& board)
+{
+  node["name"] >> board.name;
+  float markerLength = node["markerLength"].empty()
+                         ? defaultMarkerLength
+                         : static_cast<float>(node["markerLength"]);
+  vector<int> ids;
+  vector<Point2f> centres;
+
+  if (!node["markersX"].empty()) {
+    int markersX = node["markersX"];
+    int markersY = node["markersY"];
+    float separation = node["markerSeparation"];
+    float step = markerLength + separation;
+
+    if (!node["ids"].empty()) {
+      node["ids"] >> ids;
+    } else {
+      int firstId = node["firstId"];
+      for (int i = 0; i < markersX * markersY; i++) {
+        ids.push_back(firstId + i);
+      }
+    }
+
+    // Row 0 is the top row of the grid
+    for (int row = 0; row < markersY; row++) {
+      for (int col = 0; col < markersX; col++) {
+        centres.push_back(Point2f((col - (markersX - 1) / 2.f) * step,
+                                  ((markersY - 1) / 2.f - row) * step));
+      }
+    }
+  } else {
+    vector<float> positions;
+    node["ids"] >> ids;
+    node["positions"] >> positions;
+    for (size_t i = 0; i + 1 < positions.size(); i += 2) {
+      centres.push_back(Point2f(positions[i], positions[i + 1]));
+    }
+  }
+
+  if (ids.empty() || ids.size() != centres.size()) {
+    cerr << "Board " << board.name << " needs one id per marker position"
+         << endl;
+    return false;
+  }
+
+  vector<vector<Point3f>> objPoints;
+  for (const Point2f& centre : centres) {
+    objPoints.push_back(markerCornersAt(centre, markerLength));
+  }
+
+  vector<double> offset;
+  node["paintingOffset"] >> offset;
+  offset.resize(3, 0.0);
+
+  board.ids = ids;
+  board.board = aruco::Board(objPoints, dictionary, ids);
+  board.paintingOffset = Vec3d(offset[0], offset[1], offset[2]);
+  return true;
+}
+
+/**
+ * @brief Loads grid and custom board layouts from a YAML/XML file. Boards that
+ * don't give a markerLength use defaultMarkerLength.
+ */
+vector<MarkerBoard>
+loadBoardsFromFile(string filePath,
+                   const aruco::Dictionary& dictionary,
+                   float defaultMarkerLength)
+{
+  ar_utils::printBorder();
+  cout << "Loading marker boards from " << filePath << endl;
+  vector<MarkerBoard> boards;
+  FileStorage fs;
+
+  try {
+    if (!fs.open(filePath, FileStorage::READ)) {
+      cerr << "Failed to open board file: " << filePath << endl;
+      return boards;
+    }
+
+    FileNode boardNodes = fs["boards"];
+    for (FileNodeIterator n = boardNodes.begin(); n != boardNodes.end(); ++n) {
+      MarkerBoard board;
+      if (readBoard(*n, dictionary, defaultMarkerLength, board)) {
+        cout << "Loaded board " << board.name << " with " << board.ids.size()
+             << " markers" << endl;
+        boards.push_back(board);
+      }
+    }
+  } catch (const Exception& e) {
+    cerr << "Error loading board file: " << e.what() << endl;
+  }
+
+  fs.release();
+  cout << "Number of boards loaded:  " << boards.size() << endl;
+  return boards;
+}
+
+/**
+ * @brief Solves one pose for board from every detected marker that belongs to
+ * it. Markers used are flagged in onBoard. The returned pose is moved to the
+ * painting centre. Returns false if none of the board's markers are visible.
+ */
+bool
+estimateBoardPose(const MarkerBoard& board,
+                  const vector<vector<Point2f>>& markerCorners,
+                  const vector<int>& markerIds,
+                  const Mat& camMatrix,
+                  const Mat& dCoeffs,
+                  Vec3d& rvec,
+                  Vec3d& tvec,
+                  vector<bool>& onBoard)
+{
+  bool found = false;
+  for (size_t i = 0; i < markerIds.size(); i++) {
+    if (find(board.ids.begin(), board.ids.end(), markerIds[i]) !=
+        board.ids.end()) {
+      onBoard[i] = true;
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  Mat objPoints, imgPoints;
+  board.board.matchImagePoints(markerCorners, markerIds, objPoints, imgPoints);
+  if (objPoints.total() < 4) {
+    return false;
+  }
+
+  if (!solvePnP(objPoints,
+                imgPoints,
+                camMatrix,
+                dCoeffs,
+                rvec,
+                tvec,
+                false,
+                SOLVEPNP_ITERATIVE)) {
+    return false;
+  }
+
+  // Move the origin from the board centre to the painting centre
+  Matx33d rotation;
+  Rodrigues(rvec, rotation);
+  tvec += rotation * board.paintingOffset;
+  return true;
+}
+
+}
@@ -0,0 +1,209 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Generate ArUco markers in bulk. Markers are rendered at print
+ * resolution, tiled onto printable pages, and assigned to paintings in the
+ * painting layout file so the runtime knows which marker shows which
+ * painting.
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+
+#include "../include/ar_utils.h"
+#include "../include/marker_sheet.h"
+#include "../include/painting.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+namespace marker_sheet {
+
+static const float millimetresPerInch = 25.4f;
+
+/**
+ * @brief Converts a length in millimetres to pixels at dpi
+ */
+static int
+toPixels(float millimetres, int dpi)
+{
+  return cvRound(millimetres / millimetresPerInch * dpi);
+}
+
+/**
+ * @brief Parses a list of ids and ranges such as "0-9,40,41". Returns an empty
+ * vector if the list is malformed.
+ */
+vector<int>
+parseIdList(const string& spec)
+{
+  vector<int> ids;
+  stringstream stream(spec);
+  string part;
+
+  while (getline(stream, part, ',')) {
+    if (part.empty()) {
+      continue;
+    }
+
+    try {
+      size_t dash = part.find('-', 1);
+      if (dash == string::npos) {
+        ids.push_back(stoi(part));
+        continue;
+      }
+
+      int first = stoi(part.substr(0, dash));
+      int last = stoi(part.substr(dash + 1));
+      for (int id = first; id <= last; id++) {
+        ids.push_back(id);
+      }
+    } catch (const exception&) {
+      cerr << "Invalid marker id list: " << part << endl;
+      return vector<int>();
+    }
+  }
+
+  return ids;
+}
+
+/**
+ * @brief Renders every marker in options.ids in parallel, writes each one as
+ * its own PNG and tiles them onto numbered page images in
+ * options.outputDirectory
+ */
+int
+generateMarkerSheets(const SheetOptions& options,
+                     const aruco::Dictionary& dictionary)
+{
+  ar_utils::printBorder();
+  const vector<int>& ids = options.ids;
+  if (ids.empty()) {
+    cerr << "No marker ids to generate" << endl;
+    return -1;
+  }
+  for (int id : ids) {
+    if (id < 0 || id >= dictionary.bytesList.rows) {
+      cerr << "Marker id " << id << " is not in the dictionary (0-"
+           << dictionary.bytesList.rows - 1 << ")" << endl;
+      return -1;
+    }
+  }
+
+  // Each marker sits in a white quiet zone with its id printed underneath
+  int markerPixels = toPixels(options.markerMillimetres, options.dpi);
+  int quietZone = max(markerPixels / 8, 1);
+  int labelHeight = max(markerPixels / 6, 12);
+  Size cell(markerPixels + 2 * quietZone,
+            markerPixels + 2 * quietZone + labelHeight);
+
+  Size page(toPixels(options.pageMillimetres.width, options.dpi),
+            toPixels(options.pageMillimetres.height, options.dpi));
+  int margin = toPixels(options.marginMillimetres, options.dpi);
+  int columns = (page.width - 2 * margin) / cell.width;
+  int rows = (page.height - 2 * margin) / cell.height;
+  if (columns <= 0 || rows <= 0) {
+    cerr << options.markerMillimetres << " mm markers don't fit on a "
+         << options.pageMillimetres.width << "x"
+         << options.pageMillimetres.height << " mm page" << endl;
+    return -1;
+  }
+
+  try {
+    fs::create_directories(options.outputDirectory);
+  } catch (const exception& e) {
+    cerr << "Failed to create " << options.outputDirectory << ": " << e.what()
+         << endl;
+    return -1;
+  }
+
+  cout << "Generating " << ids.size() << " markers of "
+       << options.markerMillimetres << " mm (" << markerPixels << " px at "
+       << options.dpi << " DPI)" << endl;
+
+  vector<Mat> markers(ids.size());
+  parallel_for_(Range(0, (int)ids.size()), [&](const Range& range) {
+    for (int i = range.start; i < range.end; i++) {
+      aruco::generateImageMarker(
+        dictionary, ids[i], markerPixels, markers[i], 1);
+      string fileName = "aruco_marker_" + to_string(ids[i]) + ".png";
+      imwrite((fs::path(options.outputDirectory) / fileName).string(),
+              markers[i]);
+    }
+  });
+
+  int thickness = max(1, markerPixels / 150);
+  double fontScale =
+    getFontScaleFromHeight(FONT_HERSHEY_SIMPLEX, labelHeight / 2, thickness);
+  int perPage = columns * rows;
+  int pageCount = ((int)ids.size() + perPage - 1) / perPage;
+
+  parallel_for_(Range(0, pageCount), [&](const Range& range) {
+    for (int p = range.start; p < range.end; p++) {
+      Mat sheet(page, CV_8UC1, Scalar(255));
+      int last = min((p + 1) * perPage, (int)ids.size());
+
+      for (int i = p * perPage; i < last; i++) {
+        int slot = i - p * perPage;
+        Point origin(margin + (slot % columns) * cell.width + quietZone,
+                     margin + (slot / columns) * cell.height + quietZone);
+        markers[i].copyTo(sheet(Rect(origin, markers[i].size())));
+        putText(sheet,
+                "id " + to_string(ids[i]),
+                Point(origin.x, origin.y + markerPixels + labelHeight * 3 / 4),
+                FONT_HERSHEY_SIMPLEX,
+                fontScale,
+                Scalar(0),
+                thickness);
+      }
+
+      string fileName = "marker_sheet_" + to_string(p + 1) + ".png";
+      imwrite((fs::path(options.outputDirectory) / fileName).string(), sheet);
+    }
+  });
+
+  cout << "Wrote " << pageCount << " pages (" << columns << "x" << rows
+       << " markers each) to " << options.outputDirectory << endl;
+  cout << "Print at 100% scale and " << options.dpi
+       << " DPI to keep the marker size" << endl;
+  return 0;
+}
+
+/**
+ * @brief Assigns ids to the paintings in paintingDirectory, in file name
+ * order, and records the assignment in its layout file. With more ids than
+ * paintings the assignment wraps around.
+ */
+int
+writeMarkerManifest(const string& paintingDirectory, const vector<int>& ids)
+{
+  ar_utils::printBorder();
+  vector<string> files = painting::listPaintingFiles(paintingDirectory);
+  if (files.empty()) {
+    cerr << "No paintings in " << paintingDirectory << " to assign markers to"
+         << endl;
+    return -1;
+  }
+
+  // Existing placement is kept, only the marker assignment is replaced
+  map<string, painting::Layout> layouts =
+    painting::loadLayouts(paintingDirectory);
+  for (auto& entry : layouts) {
+    entry.second.markerIds.clear();
+  }
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    const string& file = files[i % files.size()];
+    layouts[file].markerIds.push_back(ids[i]);
+    cout << "Marker " << ids[i] << " -> " << file << endl;
+  }
+
+  return painting::saveLayouts(paintingDirectory, layouts);
+}
+
+}
@@ -0,0 +1,188 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Track markers from one frame to the next. Each marker id moves
+ * through acquiring, tracked, coasting and lost with some hysteresis, so a
+ * single missed detection doesn't make its painting flicker.
+ */
+
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "../include/marker_tracker.h"
+
+using namespace std;
+using namespace cv;
+
+namespace marker_tracker {
+
+// Frames a prepared warp waits for its marker before it is dropped
+static const int preparedFrames = 3;
+
+// Seconds between two placements beyond which their difference says little
+// about the current motion, and the weight of each new velocity sample
+static const double maxMotionGap = 0.25;
+static const float motionSmoothing = 0.5f;
+
+/**
+ * @brief Updates the corner velocities from the placement of a frame captured
+ * at time
+ */
+void
+MarkerTrack::recordMotion(double time)
+{
+  double elapsed = time - seenTime;
+  bool measurable = seenTime > 0 && elapsed > 0 && elapsed <= maxMotionGap;
+  for (int i = 0; i < 4; i++) {
+    const Point2f& corner = placement.imageCorners[i];
+    if (measurable) {
+      Point2f velocity = (corner - seenCorners[i]) * (float)(1 / elapsed);
+      cornerVelocity[i] =
+        hasMotion
+          ? cornerVelocity[i] + (velocity - cornerVelocity[i]) * motionSmoothing
+          : velocity;
+    }
+    seenCorners[i] = corner;
+  }
+  hasMotion = measurable;
+  seenTime = time;
+}
+
+/**
+ * @brief Forgets the motion, for when the placement jumps for reasons other
+ * than the marker moving
+ */
+void
+MarkerTrack::resetMotion()
+{
+  seenTime = 0;
+  hasMotion = false;
+}
+
+/**
+ * @brief Where the corners of the last seen placement are predicted to be at
+ * time, looking at most horizon seconds ahead. Returns false if there is no
+ * motion to predict from yet.
+ */
+bool
+MarkerTrack::predictCorners(double time,
+                            double horizon,
+                            Point2f corners[4]) const
+{
+  if (!hasMotion) {
+    return false;
+  }
+  float ahead = (float)min(max(time - seenTime, 0.0), horizon);
+  for (int i = 0; i < 4; i++) {
+    corners[i] = seenCorners[i] + cornerVelocity[i] * ahead;
+  }
+  return true;
+}
+
+/**
+ * @brief A marker is drawn once it was seen acquireFrames frames in a row and
+ * keeps being drawn for coastFrames frames after it was last seen
+ */
+MarkerTracker::MarkerTracker(int acquireFrames, int coastFrames)
+  : acquireFrames(max(acquireFrames, 1))
+  , coastFrames(max(coastFrames, 0))
+{
+}
+
+/**
+ * @brief Starts a new frame. Every track is unseen until observed.
+ */
+void
+MarkerTracker::beginFrame()
+{
+  for (auto& entry : table) {
+    entry.second.seen = false;
+  }
+}
+
+/**
+ * @brief Records that key was detected this frame and returns its track
+ */
+MarkerTrack&
+MarkerTracker::observe(int key)
+{
+  MarkerTrack& track = table[key];
+  track.seen = true;
+  track.misses = 0;
+  track.hits++;
+  track.prefetchFrames = 0;
+
+  // A coasting marker picks up where it left off, a new one has to prove
+  // itself for a few frames first
+  if (track.state == TrackState::Lost) {
+    track.state = TrackState::Acquiring;
+    track.hits = 1;
+  }
+  if (track.state == TrackState::Coasting ||
+      (track.state == TrackState::Acquiring && track.hits >= acquireFrames)) {
+    track.state = TrackState::Tracked;
+  }
+  return track;
+}
+
+/**
+ * @brief Returns the track of key without observing it, so its painting can
+ * be prepared before the marker is detected. A lost track keeps what is
+ * prepared for a few frames.
+ */
+MarkerTrack&
+MarkerTracker::prepare(int key)
+{
+  MarkerTrack& track = table[key];
+  if (track.state == TrackState::Lost) {
+    track.prefetchFrames = preparedFrames;
+  }
+  return track;
+}
+
+/**
+ * @brief True if key was already observed this frame
+ */
+bool
+MarkerTracker::seenThisFrame(int key) const
+{
+  auto track = table.find(key);
+  return track != table.end() && track->second.seen;
+}
+
+/**
+ * @brief Moves the tracks that weren't observed this frame towards lost
+ */
+void
+MarkerTracker::endFrame()
+{
+  for (auto& entry : table) {
+    MarkerTrack& track = entry.second;
+    if (track.state == TrackState::Lost && track.prefetchFrames > 0 &&
+        --track.prefetchFrames == 0) {
+      track.placement = compositor::Placement();
+      track.warp = compositor::WarpCache();
+    }
+    if (track.seen || track.state == TrackState::Lost) {
+      continue;
+    }
+
+    track.misses++;
+    bool wasVisible = track.state == TrackState::Tracked ||
+                      track.state == TrackState::Coasting;
+    if (wasVisible && track.misses <= coastFrames) {
+      track.state = TrackState::Coasting;
+      continue;
+    }
+
+    // Acquiring markers that drop out are treated as false positives
+    track.state = TrackState::Lost;
+    track.hits = 0;
+    track.hasPose = false;
+    track.placement = compositor::Placement();
+    track.warp = compositor::WarpCache();
+    track.resetMotion();
+  }
+}
+
+}
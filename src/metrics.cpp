@@ -0,0 +1,450 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Runtime metrics for monitoring kiosks. Counters, gauges and
+ * histograms are plain atomics that the render loop updates without locking,
+ * and a small HTTP server exposes them in the Prometheus text format on a
+ * local port or Unix socket.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/metrics.h"
+
+using namespace std;
+
+namespace metrics {
+
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+// A scraper that stops reading gives up its response after this long
+static const int sendTimeoutSeconds = 2;
+
+Histogram::Histogram(const vector<double>& bounds)
+  : bounds(bounds)
+  , buckets(new atomic<uint64_t>[bounds.size()])
+{
+  for (size_t i = 0; i < bounds.size(); i++) {
+    buckets[i].store(0, memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Adds v to the first bucket whose upper bound it doesn't exceed
+ */
+void
+Histogram::observe(double v)
+{
+  for (size_t i = 0; i < bounds.size(); i++) {
+    if (v <= bounds[i]) {
+      buckets[i].fetch_add(1, memory_order_relaxed);
+      break;
+    }
+  }
+  total.fetch_add(1, memory_order_relaxed);
+
+  double current = valueSum.load(memory_order_relaxed);
+  while (!valueSum.compare_exchange_weak(
+    current, current + v, memory_order_relaxed)) {
+  }
+}
+
+uint64_t
+Histogram::bucketCount(size_t bucket) const
+{
+  return buckets[bucket].load(memory_order_relaxed);
+}
+
+/**
+ * @brief Index of the metric called name with labels in the storage for type.
+ * created is set when it didn't exist yet. Called with registryMutex held.
+ */
+size_t
+Registry::find(const string& name,
+               const string& help,
+               Type type,
+               const string& labels,
+               bool& created)
+{
+  created = false;
+  Family* family = nullptr;
+  for (Family& f : families) {
+    if (f.name == name) {
+      family = &f;
+      break;
+    }
+  }
+  if (!family) {
+    families.push_back(Family{ name, help, type, {} });
+    family = &families.back();
+  }
+
+  for (const Entry& entry : family->entries) {
+    if (entry.labels == labels) {
+      return entry.index;
+    }
+  }
+
+  size_t index = type == Type::Counter ? counters.size()
+                 : type == Type::Gauge ? gauges.size()
+                                       : histograms.size();
+  family->entries.push_back(Entry{ labels, index });
+  created = true;
+  return index;
+}
+
+/**
+ * @brief Returns the metric called name with labels (e.g. camera="0"),
+ * creating it on first use
+ */
+Counter&
+Registry::counter(const string& name, const string& help, const string& labels)
+{
+  lock_guard<mutex> lock(registryMutex);
+  bool created;
+  size_t index = find(name, help, Type::Counter, labels, created);
+  if (created) {
+    counters.emplace_back();
+  }
+  return counters[index];
+}
+
+Gauge&
+Registry::gauge(const string& name, const string& help, const string& labels)
+{
+  lock_guard<mutex> lock(registryMutex);
+  bool created;
+  size_t index = find(name, help, Type::Gauge, labels, created);
+  if (created) {
+    gauges.emplace_back();
+  }
+  return gauges[index];
+}
+
+Histogram&
+Registry::histogram(const string& name,
+                    const string& help,
+                    const vector<double>& bounds,
+                    const string& labels)
+{
+  lock_guard<mutex> lock(registryMutex);
+  bool created;
+  size_t index = find(name, help, Type::Histogram, labels, created);
+  if (created) {
+    histograms.emplace_back(bounds);
+  }
+  return histograms[index];
+}
+
+/**
+ * @brief Writes name{labels} value, merging extra into the label set
+ */
+static void
+writeSample(ostringstream& out,
+            const string& name,
+            const string& labels,
+            const string& extra,
+            double value)
+{
+  out << name;
+  if (!labels.empty() || !extra.empty()) {
+    out << "{" << labels << (!labels.empty() && !extra.empty() ? "," : "")
+        << extra << "}";
+  }
+  out << " " << value << "\n";
+}
+
+/**
+ * @brief Every metric in the Prometheus text exposition format
+ */
+string
+Registry::render() const
+{
+  // Only the scraper and registration take the lock, never the hot path
+  lock_guard<mutex> lock(registryMutex);
+  ostringstream out;
+  out << setprecision(12);
+
+  for (const Family& family : families) {
+    const char* type = family.type == Type::Counter ? "counter"
+                       : family.type == Type::Gauge ? "gauge"
+                                                    : "histogram";
+    out << "# HELP " << family.name << " " << family.help << "\n";
+    out << "# TYPE " << family.name << " " << type << "\n";
+
+    for (const Entry& entry : family.entries) {
+      if (family.type == Type::Counter) {
+        writeSample(out,
+                    family.name,
+                    entry.labels,
+                    "",
+                    (double)counters[entry.index].get());
+      } else if (family.type == Type::Gauge) {
+        writeSample(
+          out, family.name, entry.labels, "", gauges[entry.index].get());
+      } else {
+        const Histogram& histogram = histograms[entry.index];
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < histogram.upperBounds().size(); i++) {
+          cumulative += histogram.bucketCount(i);
+          ostringstream bound;
+          bound << histogram.upperBounds()[i];
+          writeSample(out,
+                      family.name + "_bucket",
+                      entry.labels,
+                      "le=\"" + bound.str() + "\"",
+                      (double)cumulative);
+        }
+        writeSample(out,
+                    family.name + "_bucket",
+                    entry.labels,
+                    "le=\"+Inf\"",
+                    (double)histogram.count());
+        writeSample(
+          out, family.name + "_sum", entry.labels, "", histogram.sum());
+        writeSample(out,
+                    family.name + "_count",
+                    entry.labels,
+                    "",
+                    (double)histogram.count());
+      }
+    }
+  }
+
+  return out.str();
+}
+
+/**
+ * @brief The process-wide registry
+ */
+Registry&
+registry()
+{
+  static Registry instance;
+  return instance;
+}
+
+/**
+ * @brief Formats a label for Registry, escaping the value
+ */
+string
+label(const string& name, const string& value)
+{
+  string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+    }
+    if (c == '\n') {
+      escaped += "\\n";
+      continue;
+    }
+    escaped += c;
+  }
+  return name + "=\"" + escaped + "\"";
+}
+
+MetricsServer::MetricsServer(Registry& registry)
+  : source(registry)
+  , maxResident(registry.gauge("augmuseum_process_max_resident_bytes",
+                               "Peak resident set size of the process"))
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+  stop();
+}
+
+/**
+ * @brief Starts listening on address, a TCP port on localhost ("9100") or a
+ * Unix socket path prefixed with "unix:". Returns false if the socket can't
+ * be opened.
+ */
+bool
+MetricsServer::start(const string& address)
+{
+  const string unixPrefix = "unix:";
+  if (address.compare(0, unixPrefix.size(), unixPrefix) == 0) {
+    socketPath = address.substr(unixPrefix.size());
+    sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    if (socketPath.empty() || socketPath.size() >= sizeof(local.sun_path)) {
+      cerr << "Invalid metrics socket path: " << socketPath << endl;
+      return false;
+    }
+    local.sun_family = AF_UNIX;
+    strncpy(local.sun_path, socketPath.c_str(), sizeof(local.sun_path) - 1);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listenFd < 0 ||
+        ::bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) {
+      cerr << "Failed to bind metrics socket " << socketPath << ": "
+           << strerror(errno) << endl;
+      stop();
+      return false;
+    }
+  } else {
+    int port = 0;
+    try {
+      port = stoi(address);
+    } catch (const exception&) {
+    }
+    if (port <= 0 || port > 65535) {
+      cerr << "Invalid metrics port: " << address << endl;
+      return false;
+    }
+
+    // Only local scrapers, the kiosk isn't meant to be reachable from outside
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons((uint16_t)port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (listenFd >= 0) {
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+    if (listenFd < 0 ||
+        ::bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) {
+      cerr << "Failed to bind metrics port " << port << ": "
+           << strerror(errno) << endl;
+      stop();
+      return false;
+    }
+  }
+
+  if (listen(listenFd, 4) != 0) {
+    cerr << "Failed to listen for metrics scrapes: " << strerror(errno)
+         << endl;
+    stop();
+    return false;
+  }
+
+  stopping = false;
+  worker = thread(&MetricsServer::serve, this);
+  cout << "Serving metrics on " << address << endl;
+  return true;
+}
+
+/**
+ * @brief Stops the server thread and closes the socket
+ */
+void
+MetricsServer::stop()
+{
+  stopping = true;
+  if (worker.joinable()) {
+    worker.join();
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+  if (!socketPath.empty()) {
+    unlink(socketPath.c_str());
+    socketPath.clear();
+  }
+}
+
+/**
+ * @brief Server thread body. Handles one scrape at a time and checks for stop
+ * a few times a second.
+ */
+void
+MetricsServer::serve()
+{
+  while (!stopping) {
+    pollfd listener = { listenFd, POLLIN, 0 };
+    if (poll(&listener, 1, 200) <= 0) {
+      continue;
+    }
+
+    int client = accept(listenFd, nullptr, nullptr);
+    if (client < 0) {
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int noSignal = 1;
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+    timeval sendTimeout = { sendTimeoutSeconds, 0 };
+    setsockopt(
+      client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    respond(client);
+    close(client);
+  }
+}
+
+/**
+ * @brief Answers a single HTTP request with the current metrics
+ */
+void
+MetricsServer::respond(int client)
+{
+  // Wait briefly for the request line, scrapers send it right away
+  char request[1024];
+  pollfd incoming = { client, POLLIN, 0 };
+  ssize_t received = 0;
+  if (poll(&incoming, 1, 1000) > 0) {
+    received = recv(client, request, sizeof(request) - 1, 0);
+  }
+  request[max<ssize_t>(received, 0)] = '\0';
+
+  // Memory is sampled per scrape rather than from the render loop
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    maxResident.set((double)usage.ru_maxrss);
+#else
+    maxResident.set((double)usage.ru_maxrss * 1024);
+#endif
+  }
+
+  string body, status = "200 OK";
+  if (strncmp(request, "GET /metrics", 12) == 0 ||
+      strncmp(request, "GET / ", 6) == 0) {
+    body = source.render();
+  } else {
+    status = "404 Not Found";
+    body = "Metrics are served at /metrics\n";
+  }
+
+  string response = "HTTP/1.0 " + status +
+                    "\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " +
+                    to_string(body.size()) + "\r\nConnection: close\r\n\r\n" +
+                    body;
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t n =
+      send(client, response.data() + sent, response.size() - sent, sendFlags);
+    if (n <= 0) {
+      break;
+    }
+    sent += (size_t)n;
+  }
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Idle mode for cameras that have not seen a marker in a while. An
+ * idle camera only looks at a few tiny frames a second for motion, plus an
+ * occasional low resolution marker scan, until something shows up.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../include/motion_gate.h"
+
+using namespace std;
+using namespace cv;
+
+namespace motion_gate {
+
+// Width in pixels of the frame compared for motion
+static const int tinyWidth = 160;
+
+// Gray level change that counts a tiny pixel as moving, and the share of
+// moving pixels that wakes the camera. Low enough for a visitor walking in at
+// the edge of the frame, high enough to ignore sensor noise.
+static const double motionThreshold = 25;
+static const double motionFraction = 0.005;
+
+MotionGate::MotionGate(double idleAfter,
+                       double checkInterval,
+                       double scanInterval)
+  : idleAfter(idleAfter)
+  , checkInterval(checkInterval)
+  , scanInterval(scanInterval)
+{
+}
+
+/**
+ * @brief Reports whether markers were visible in the frame processed at now.
+ * The gate goes idle after idleAfter seconds without any.
+ */
+void
+MotionGate::update(bool markersVisible, double now)
+{
+  if (lastActive < 0 || markersVisible) {
+    lastActive = now;
+  }
+  if (!isIdle && idleAfter > 0 && now - lastActive >= idleAfter) {
+    isIdle = true;
+    previous.release();
+    lastScan = now;
+    cout << "No markers for " << idleAfter << " s, going idle" << endl;
+  }
+}
+
+/**
+ * @brief While idle, whether the frame grabbed at now should be looked at at
+ * all. Every other frame is dropped without being decoded.
+ */
+bool
+MotionGate::dueForCheck(double now)
+{
+  if (now - lastCheck < checkInterval) {
+    return false;
+  }
+  lastCheck = now;
+  return true;
+}
+
+/**
+ * @brief While idle, whether the frame at now should also get a low resolution
+ * marker scan
+ */
+bool
+MotionGate::dueForScan(double now)
+{
+  if (now - lastScan < scanInterval) {
+    return false;
+  }
+  lastScan = now;
+  return true;
+}
+
+/**
+ * @brief Compares a tiny copy of frame (BGR, raw YUYV or gray) with the
+ * previous one. Returns true if enough of it changed.
+ */
+bool
+MotionGate::motion(const Mat& frame)
+{
+  // Nearest neighbour only reads the pixels it keeps, and the blur takes out
+  // most of the noise that skipping the rest lets through
+  Size tinySize(tinyWidth,
+                max(1, cvRound((double)frame.rows * tinyWidth / frame.cols)));
+  resize(frame, tiny, tinySize, 0, 0, INTER_NEAREST);
+  if (tiny.channels() == 3) {
+    cvtColor(tiny, tinyGray, COLOR_BGR2GRAY);
+  } else if (tiny.channels() == 2) {
+    extractChannel(tiny, tinyGray, 0);
+  } else {
+    tiny.copyTo(tinyGray);
+  }
+  GaussianBlur(tinyGray, tinyGray, Size(5, 5), 0);
+
+  if (previous.empty() || previous.size() != tinyGray.size()) {
+    tinyGray.copyTo(previous);
+    return false;
+  }
+
+  absdiff(tinyGray, previous, difference);
+  tinyGray.copyTo(previous);
+  threshold(difference, difference, motionThreshold, 255, THRESH_BINARY);
+  return countNonZero(difference) > motionFraction * difference.total();
+}
+
+/**
+ * @brief Leaves idle mode, e.g. after motion or a marker was found
+ */
+void
+MotionGate::wake(double now)
+{
+  if (isIdle) {
+    cout << "Activity in front of the camera, resuming" << endl;
+  }
+  isIdle = false;
+  lastActive = now;
+}
+
+}
@@ -0,0 +1,134 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Keep visitors in front of the painting. A small background model of
+ * the wall behind each marker is kept in the painting's own plane, and pixels
+ * that differ from it are left out when the painting is blended in.
+ */
+
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "../include/occlusion.h"
+
+using namespace std;
+using namespace cv;
+
+namespace occlusion {
+
+// Longest side of the rectified background model in pixels
+static const int modelSide = 128;
+
+// Difference from the background, in gray levels, that counts as foreground
+static const double foregroundThreshold = 30;
+
+// Background pixels follow lighting changes quickly. Foreground pixels are
+// blended in slowly so anything left in front of the marker is absorbed.
+static const double backgroundRate = 0.05;
+static const double foregroundRate = 0.005;
+
+/**
+ * @brief Samples frame inside the painting outlined by imageCorners (top-left,
+ * top-right, bottom-right, bottom-left), updates the background and clears
+ * every foreground pixel from mask, which covers roi of the frame. overlaySize
+ * gives the painting's aspect ratio.
+ */
+void
+RegionModel::apply(const Mat& frame,
+                   const Point2f imageCorners[4],
+                   Size overlaySize,
+                   Rect roi,
+                   Mat& mask)
+{
+  if (roi.area() == 0 || overlaySize.area() == 0) {
+    return;
+  }
+
+  // The coarsest pyramid level that still resolves the model
+  const Mat* source = &frame;
+  Point2f sourceCorners[4];
+  copy(imageCorners, imageCorners + 4, sourceCorners);
+  if (pyramid && !pyramid->empty()) {
+    size_t level = 0;
+    int side = max(roi.width, roi.height);
+    while (level + 1 < pyramid->size() && (side >> (level + 1)) >= modelSide) {
+      level++;
+    }
+    source = &(*pyramid)[level];
+    float levelScale = 1.f / (float)(1 << level);
+    for (int i = 0; i < 4; i++) {
+      sourceCorners[i] = imageCorners[i] * levelScale;
+    }
+  }
+
+  double scale =
+    (double)modelSide / max(overlaySize.width, overlaySize.height);
+  Size planeSize(max(1, cvRound(overlaySize.width * scale)),
+                 max(1, cvRound(overlaySize.height * scale)));
+  if (background.size() != planeSize ||
+      background.channels() != source->channels()) {
+    background.release();
+  }
+
+  float w = static_cast<float>(planeSize.width);
+  float h = static_cast<float>(planeSize.height);
+  const Point2f planeCorners[4] = {
+    Point2f(0, 0), Point2f(w, 0), Point2f(w, h), Point2f(0, h)
+  };
+  Mat planeToImage = getPerspectiveTransform(planeCorners, sourceCorners);
+
+  // Only the pixels under the painting are read from the frame
+  warpPerspective(*source,
+                  plane,
+                  planeToImage,
+                  planeSize,
+                  INTER_LINEAR | WARP_INVERSE_MAP,
+                  BORDER_REPLICATE);
+
+  // The first sighting becomes the background
+  if (background.empty()) {
+    plane.convertTo(background, CV_32F);
+    return;
+  }
+
+  background.convertTo(background8u, CV_8U);
+  absdiff(plane, background8u, difference);
+  if (difference.channels() == 3) {
+    cvtColor(difference, differenceGray, COLOR_BGR2GRAY);
+  } else {
+    difference.copyTo(differenceGray);
+  }
+  threshold(
+    differenceGray, foreground, foregroundThreshold, 255, THRESH_BINARY);
+
+  // Drop speckles from pose jitter, then grow the rest to cover edges
+  static const Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
+  morphologyEx(foreground, foreground, MORPH_OPEN, kernel);
+  dilate(foreground, foreground, kernel);
+
+  bitwise_not(foreground, backgroundMask);
+  accumulateWeighted(plane, background, backgroundRate, backgroundMask);
+  accumulateWeighted(plane, background, foregroundRate, foreground);
+
+  if (countNonZero(foreground) == 0) {
+    return;
+  }
+
+  // Map the foreground back onto the frame, only within roi
+  Point2f roiCorners[4];
+  for (int i = 0; i < 4; i++) {
+    roiCorners[i] = imageCorners[i] - Point2f(roi.tl());
+  }
+  Mat planeToRoi = getPerspectiveTransform(planeCorners, roiCorners);
+  warpPerspective(foreground,
+                  roiForeground,
+                  planeToRoi,
+                  roi.size(),
+                  INTER_NEAREST,
+                  BORDER_CONSTANT,
+                  Scalar(0));
+
+  mask.setTo(Scalar(0), roiForeground);
+}
+
+}
@@ -0,0 +1,297 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-painting descriptors. The physical size and anchor of every
+ * painting are worked out once at load time so the compositor only has to
+ * project four precomputed corners per frame.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/painting.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+namespace painting {
+
+const string layoutFileName = "paintings.yml";
+const int maxPaintingSide = 1024;
+
+// Versions handed out so far, shared by the loader and the reload thread
+static atomic<int64_t> lastVersion(0);
+
+// Default painting height in marker lengths. Matches the 560x720 placement
+// used before paintings kept their aspect ratio.
+static const float defaultHeightInMarkers = 7.2f;
+
+/**
+ * @brief Decodes an image file as BGR, or as BGRA if it is a format that can
+ * carry transparency and any pixel is not fully opaque. Other formats go
+ * through the default decode, which also applies EXIF orientation.
+ */
+static Mat
+readPaintingImage(const string& filePath)
+{
+  string extension = fs::path(filePath).extension().string();
+  transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension != ".png" && extension != ".webp" && extension != ".tif" &&
+      extension != ".tiff") {
+    return imread(filePath);
+  }
+
+  Mat image = imread(filePath, IMREAD_UNCHANGED);
+  if (image.empty()) {
+    return image;
+  }
+  if (image.depth() != CV_8U) {
+    image.convertTo(image, CV_8U, image.depth() == CV_16U ? 1 / 256.0 : 1);
+  }
+  if (image.channels() == 1) {
+    cvtColor(image, image, COLOR_GRAY2BGR);
+  } else if (image.channels() == 4) {
+    // Opaque images stay on the plain copy path
+    Mat alpha;
+    extractChannel(image, alpha, 3);
+    double minAlpha = 0;
+    minMaxLoc(alpha, &minAlpha);
+    if (minAlpha == 255) {
+      cvtColor(image, image, COLOR_BGRA2BGR);
+    }
+  }
+  return image;
+}
+
+/**
+ * @brief Reads the layout file in directory, keyed by file name. Returns an
+ * empty map if there is no layout file.
+ */
+map<string, Layout>
+loadLayouts(string directory)
+{
+  map<string, Layout> layouts;
+  string filePath = (fs::path(directory) / layoutFileName).string();
+  if (!fs::exists(filePath)) {
+    return layouts;
+  }
+
+  FileStorage fs;
+  try {
+    fs.open(filePath, FileStorage::READ);
+    FileNode paintingNodes = fs["paintings"];
+    for (FileNodeIterator n = paintingNodes.begin(); n != paintingNodes.end();
+         ++n) {
+      FileNode node = *n;
+      string file;
+      node["file"] >> file;
+
+      Layout layout;
+      if (!node["height"].empty()) {
+        layout.height = (float)node["height"];
+      }
+      vector<float> offset;
+      node["anchorOffset"] >> offset;
+      if (offset.size() >= 2) {
+        layout.anchorOffset = Point2f(offset[0], offset[1]);
+      }
+      node["markers"] >> layout.markerIds;
+      layouts[file] = layout;
+    }
+  } catch (const Exception& e) {
+    cerr << "Error loading painting layout: " << e.what() << endl;
+  }
+
+  fs.release();
+  cout << "Loaded layout for " << layouts.size() << " paintings from "
+       << filePath << endl;
+  return layouts;
+}
+
+/**
+ * @brief Writes layouts to the layout file in directory, replacing it
+ */
+int
+saveLayouts(string directory, const map<string, Layout>& layouts)
+{
+  string filePath = (fs::path(directory) / layoutFileName).string();
+  FileStorage fs;
+
+  try {
+    if (!fs.open(filePath, FileStorage::WRITE)) {
+      cerr << "Failed to open painting layout for writing: " << filePath
+           << endl;
+      return -1;
+    }
+
+    fs << "paintings" << "[";
+    for (const auto& entry : layouts) {
+      const Layout& layout = entry.second;
+      fs << "{" << "file" << entry.first;
+      if (layout.height > 0) {
+        fs << "height" << layout.height;
+      }
+      if (layout.anchorOffset != Point2f()) {
+        fs << "anchorOffset"
+           << vector<float>{ layout.anchorOffset.x, layout.anchorOffset.y };
+      }
+      if (!layout.markerIds.empty()) {
+        fs << "markers" << layout.markerIds;
+      }
+      fs << "}";
+    }
+    fs << "]";
+  } catch (const Exception& e) {
+    cerr << "Error saving painting layout: " << e.what() << endl;
+    return -1;
+  }
+
+  fs.release();
+  cout << "Painting layout saved to " << filePath << endl;
+  return 0;
+}
+
+/**
+ * @brief Names of the files in directory with an extension imread reads,
+ * sorted. Video files, the layout file and anything else are left out.
+ */
+vector<string>
+listPaintingFiles(string directory)
+{
+  vector<string> files;
+  for (const auto& file : fs::directory_iterator(directory)) {
+    string fileName = file.path().filename().string();
+    if (!file.is_regular_file() ||
+        !ar_utils::isImageFile(file.path().string())) {
+      continue;
+    }
+    files.push_back(fileName);
+  }
+  sort(files.begin(), files.end());
+  return files;
+}
+
+/**
+ * @brief Builds the descriptor for a painting of pixelSize. The painting keeps
+ * its aspect ratio; its height comes from layouts or defaults to a fixed
+ * multiple of markerLength.
+ */
+Painting
+describePainting(const string& name,
+                 Size pixelSize,
+                 const map<string, Layout>& layouts,
+                 float markerLength)
+{
+  Painting painting;
+  painting.name = name;
+
+  float height = defaultHeightInMarkers * markerLength;
+  auto layout = layouts.find(name);
+  if (layout != layouts.end()) {
+    if (layout->second.height > 0) {
+      height = layout->second.height;
+    }
+    painting.anchorOffset = layout->second.anchorOffset;
+    painting.markerIds = layout->second.markerIds;
+  }
+
+  float aspect = pixelSize.height > 0
+                   ? (float)pixelSize.width / (float)pixelSize.height
+                   : 1.f;
+  painting.physicalSize = Size2f(height * aspect, height);
+
+  float halfWidth = painting.physicalSize.width / 2.f;
+  float halfHeight = painting.physicalSize.height / 2.f;
+  Point2f c = painting.anchorOffset;
+  painting.objectCorners = { Point3f(c.x - halfWidth, c.y + halfHeight, 0),
+                             Point3f(c.x + halfWidth, c.y + halfHeight, 0),
+                             Point3f(c.x + halfWidth, c.y - halfHeight, 0),
+                             Point3f(c.x - halfWidth, c.y - halfHeight, 0) };
+  return painting;
+}
+
+/**
+ * @brief A version number no painting has used yet
+ */
+int64_t
+nextVersion()
+{
+  return ++lastVersion;
+}
+
+/**
+ * @brief Decodes fileName in directory into painting, downscaled to
+ * maxPaintingSide and placed according to layouts. Returns false if the file
+ * is not a readable image.
+ */
+bool
+loadPainting(const string& directory,
+             const string& fileName,
+             const map<string, Layout>& layouts,
+             float markerLength,
+             Painting& painting)
+{
+  string filePath = (fs::path(directory) / fileName).string();
+
+  try {
+    Mat image = readPaintingImage(filePath);
+    if (image.empty()) {
+      cerr << "Failed to load image: " << filePath << endl;
+      return false;
+    }
+
+    // Keep the aspect ratio, only limit the resolution
+    int longestSide = max(image.cols, image.rows);
+    if (longestSide > maxPaintingSide) {
+      double scale = (double)maxPaintingSide / longestSide;
+      resize(image, image, Size(), scale, scale, INTER_AREA);
+    }
+
+    painting = describePainting(fileName, image.size(), layouts, markerLength);
+    painting.image = image;
+    painting.version = nextVersion();
+    cout << "Loaded image: " << filePath << " (" << image.cols << "x"
+         << image.rows << ")" << endl;
+    return true;
+
+  } catch (const Exception& e) {
+    cerr << e.what() << endl;
+    return false;
+  }
+}
+
+/**
+ * @brief Load the images in a directory as paintings. Video files and the
+ * layout file are skipped.
+ */
+vector<Painting>
+loadPaintingsFromDirectory(string path, float markerLength)
+{
+  ar_utils::printBorder();
+  cout << "Loading images from " << path << endl;
+  vector<Painting> paintings;
+  map<string, Layout> layouts = loadLayouts(path);
+
+  for (const string& fileName : listPaintingFiles(path)) {
+    Painting painting;
+    if (loadPainting(path, fileName, layouts, markerLength, painting)) {
+      paintings.push_back(painting);
+    }
+  }
+
+  if (paintings.empty()) {
+    cerr << "Unable to load images" << endl;
+    return paintings;
+  }
+
+  cout << "Number of images loaded:  " << paintings.size() << endl;
+  return paintings;
+}
+
+}
@@ -0,0 +1,115 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Guess which markers are about to be detected from the candidates
+ * the detector rejected, so their paintings can be prepared a frame or two
+ * before they are first drawn.
+ */
+
+#include <algorithm>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/prefetch.h"
+
+using namespace std;
+using namespace cv;
+
+namespace prefetch {
+
+// Pixels per bit of the rectified candidate
+static const int cellSide = 6;
+
+// Candidates flatter than this can't hold a black and white pattern
+static const double minContrast = 10;
+
+/**
+ * @brief Reads the bits of the maxCandidates largest quads in rejected and
+ * matches them to ids of dictionary. maxCorrectionRate is the fraction of the
+ * dictionary's correctable bits that may be wrong, as in
+ * DetectorParameters::errorCorrectionRate; passing more than the detector
+ * uses catches markers that are blurred, partly covered or still small.
+ */
+vector<LikelyMarker>
+decodeCandidates(const Mat& gray,
+                 const vector<vector<Point2f>>& rejected,
+                 const aruco::Dictionary& dictionary,
+                 int borderBits,
+                 double maxCorrectionRate,
+                 size_t maxCandidates)
+{
+  vector<LikelyMarker> likely;
+  if (gray.empty() || gray.type() != CV_8UC1 || maxCandidates == 0) {
+    return likely;
+  }
+
+  // The largest quads are the closest and the most likely to be read
+  vector<pair<double, size_t>> order;
+  for (size_t i = 0; i < rejected.size(); i++) {
+    if (rejected[i].size() == 4) {
+      order.push_back({ -arcLength(rejected[i], true), i });
+    }
+  }
+  sort(order.begin(), order.end());
+  order.resize(min(order.size(), maxCandidates));
+
+  const int markerSize = dictionary.markerSize;
+  const int cells = markerSize + 2 * borderBits;
+  const int side = cells * cellSide;
+  const int borderCells = cells * cells - markerSize * markerSize;
+  const Point2f square[4] = { Point2f(0, 0),
+                              Point2f((float)side, 0),
+                              Point2f((float)side, (float)side),
+                              Point2f(0, (float)side) };
+
+  Mat canonical, binary, bits(markerSize, markerSize, CV_8UC1);
+  for (const auto& entry : order) {
+    const vector<Point2f>& quad = rejected[entry.second];
+    Mat toSquare = getPerspectiveTransform(quad.data(), square);
+    warpPerspective(
+      gray, canonical, toSquare, Size(side, side), INTER_NEAREST);
+
+    Scalar mean, stddev;
+    meanStdDev(canonical, mean, stddev);
+    if (stddev[0] < minContrast) {
+      continue;
+    }
+    threshold(canonical, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+
+    // Each bit is read from the middle of its cell, away from blurred edges
+    int borderErrors = 0;
+    for (int y = 0; y < cells; y++) {
+      for (int x = 0; x < cells; x++) {
+        Mat cell = binary(Rect(
+          x * cellSide + 1, y * cellSide + 1, cellSide - 2, cellSide - 2));
+        bool white = countNonZero(cell) * 2 > (int)cell.total();
+        bool border = x < borderBits || y < borderBits ||
+                      x >= cells - borderBits || y >= cells - borderBits;
+        if (border) {
+          borderErrors += white;
+        } else {
+          bits.at<uchar>(y - borderBits, x - borderBits) = white;
+        }
+      }
+    }
+    if (borderErrors * 4 > borderCells) {
+      continue;
+    }
+
+    int id, rotation;
+    if (!dictionary.identify(bits, id, rotation, maxCorrectionRate)) {
+      continue;
+    }
+
+    // Same corner order as detectMarkers gives the identified marker
+    LikelyMarker marker;
+    marker.id = id;
+    for (int k = 0; k < 4; k++) {
+      marker.corners[k] = quad[(k + 4 - rotation) % 4];
+    }
+    likely.push_back(marker);
+  }
+  return likely;
+}
+
+}
@@ -0,0 +1,76 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Per-frame preprocessing shared by every stage of a camera's
+ * pipeline, so the frame is converted to gray once however many stages read
+ * it.
+ */
+
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "../include/preprocess.h"
+
+using namespace std;
+using namespace cv;
+
+namespace preprocess {
+
+/**
+ * @brief levels is the number of pyramid levels, counting the full resolution
+ * gray image. With undistort, detectionImage() is corrected for the lens
+ * described by camMatrix and dCoeffs.
+ */
+void
+FramePreprocessor::configure(int levels,
+                             bool undistort,
+                             const Mat& camMatrix,
+                             const Mat& dCoeffs)
+{
+  this->levels.resize(max(1, levels));
+  this->undistort = undistort && !camMatrix.empty();
+  this->camMatrix = camMatrix;
+  this->dCoeffs = dCoeffs;
+  mapSize = Size();
+}
+
+/**
+ * @brief Derives every image from frame, which is BGR, BGRA, raw YUYV
+ * (CV_8UC2) or gray
+ */
+void
+FramePreprocessor::run(const Mat& frame)
+{
+  if (frame.channels() == 3) {
+    cvtColor(frame, levels[0], COLOR_BGR2GRAY);
+  } else if (frame.channels() == 4) {
+    cvtColor(frame, levels[0], COLOR_BGRA2GRAY);
+  } else if (frame.channels() == 2) {
+    // Every other byte of YUYV is luma, which is the gray image as is
+    extractChannel(frame, levels[0], 0);
+  } else {
+    frame.copyTo(levels[0]);
+  }
+
+  for (size_t i = 1; i < levels.size(); i++) {
+    pyrDown(levels[i - 1], levels[i]);
+  }
+
+  if (undistort) {
+    // Fixed point maps make the per-frame remap noticeably cheaper
+    if (mapSize != frame.size()) {
+      initUndistortRectifyMap(camMatrix,
+                              dCoeffs,
+                              Mat(),
+                              camMatrix,
+                              frame.size(),
+                              CV_16SC2,
+                              mapX,
+                              mapY);
+      mapSize = frame.size();
+    }
+    remap(levels[0], undistorted, mapX, mapY, INTER_LINEAR);
+  }
+}
+
+}
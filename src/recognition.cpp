@@ -0,0 +1,517 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Recognize the paintings themselves, without a printed marker. The
+ * features of the whole collection are computed once into an on-disk index;
+ * cameras match against it on keyframes only and follow what they found
+ * with optical flow in between.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <opencv2/flann.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/recognition.h"
+
+using namespace std;
+using namespace cv;
+
+namespace recognition {
+
+// File layout: the header, the feature type, the painting count, then per
+// painting its name, size and feature count, followed by every keypoint and
+// every descriptor row, all in host byte order. The hash tables are saved by
+// flann next to it, in path + tablesSuffix.
+static const char fileHeader[8] = { 'A', 'M', 'P', 'I', 'D', 'X', '0', '1' };
+static const string tablesSuffix = ".lsh";
+
+// Features kept per painting, and looked for per keyframe
+static const int featuresPerPainting = 500;
+static const int featuresPerFrame = 1000;
+
+// Hash tables, bits per hash key and neighbouring buckets probed. More tables
+// find more true matches for more memory; probing further finds a few more
+// for several times the search time.
+static const int lshTables = 12;
+static const int lshKeyBits = 20;
+static const int lshProbes = 1;
+
+// A match must be clearly better than the best one from another painting,
+// and within a quarter of the descriptor's bits
+static const float ratio = 0.8f;
+static const float maxDistanceRate = 0.25f;
+
+// Paintings with the most matches checked with a homography per keyframe
+static const size_t maxVerified = 3;
+
+// Pixels a feature may be off the homography and still agree with it
+static const double ransacThreshold = 5;
+
+// Features followed below which a painting is dropped until the next
+// keyframe, and the smallest area in pixels it may cover
+static const size_t minFollowed = 8;
+static const double minArea = 32 * 32;
+
+/**
+ * @brief Detector and descriptor for features ("orb" or "akaze"), or null if
+ * the name is unknown
+ */
+static Ptr<Feature2D>
+createExtractor(const string& features, int maxFeatures)
+{
+  if (features == "orb") {
+    return ORB::create(maxFeatures);
+  }
+  if (features == "akaze") {
+    return AKAZE::create();
+  }
+  return Ptr<Feature2D>();
+}
+
+/**
+ * @brief The maxFeatures strongest features of gray
+ */
+static void
+extract(Feature2D& extractor,
+        const Mat& gray,
+        int maxFeatures,
+        vector<KeyPoint>& points,
+        Mat& descriptors)
+{
+  extractor.detect(gray, points);
+  KeyPointsFilter::retainBest(points, maxFeatures);
+  extractor.compute(gray, points, descriptors);
+}
+
+/**
+ * @brief Appends the bytes of a plain value to out
+ */
+template<typename T>
+static void
+put(ofstream& out, const T& value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool
+take(ifstream& in, T& value)
+{
+  return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+static void
+putString(ofstream& out, const string& value)
+{
+  put(out, (uint32_t)value.size());
+  out.write(value.data(), value.size());
+}
+
+static bool
+takeString(ifstream& in, string& value)
+{
+  uint32_t size;
+  if (!take(in, size) || size > 4096) {
+    return false;
+  }
+  value.resize(size);
+  return (bool)in.read(&value[0], size);
+}
+
+/**
+ * @brief Computes the features of paintings with features ("orb" or "akaze")
+ * and indexes them. Returns false if none had any features.
+ */
+bool
+PaintingIndex::build(const vector<painting::Painting>& paintings,
+                     const string& features)
+{
+  Ptr<Feature2D> extractor = createExtractor(features, featuresPerPainting);
+  if (!extractor) {
+    cerr << "Unknown feature type: " << features << " (orb or akaze)" << endl;
+    return false;
+  }
+
+  featureType = features;
+  names.clear();
+  sizes.clear();
+  keypoints.clear();
+  owner.clear();
+
+  vector<Mat> rows;
+  Mat decoded, gray;
+  for (const painting::Painting& painting : paintings) {
+    // Paintings kept only in tiles are decoded one at a time
+    const Mat* image = &painting.image;
+    if (image->empty() && painting.tiled) {
+      painting.tiled->copyTo(decoded);
+      image = &decoded;
+    }
+    if (image->empty()) {
+      continue;
+    }
+    cvtColor(*image,
+             gray,
+             image->channels() == 4 ? COLOR_BGRA2GRAY : COLOR_BGR2GRAY);
+    vector<KeyPoint> points;
+    Mat paintingDescriptors;
+    extract(*extractor, gray, featuresPerPainting, points, paintingDescriptors);
+    if (points.empty()) {
+      cerr << "No features found in " << painting.name << endl;
+      continue;
+    }
+
+    for (const KeyPoint& point : points) {
+      keypoints.push_back(point.pt);
+      owner.push_back((int)names.size());
+    }
+    names.push_back(painting.name);
+    sizes.push_back(image->size());
+    rows.push_back(paintingDescriptors);
+  }
+
+  if (rows.empty()) {
+    cerr << "None of the paintings have features to recognize" << endl;
+    return false;
+  }
+  vconcat(rows, descriptors);
+  cout << "Indexed " << keypoints.size() << " " << featureType
+       << " features of " << names.size() << " paintings" << endl;
+  return buildTables();
+}
+
+/**
+ * @brief Hashes descriptors into the lookup tables
+ */
+bool
+PaintingIndex::buildTables()
+{
+  try {
+    lock_guard<mutex> lock(tablesMutex);
+    tables.build(descriptors,
+                 flann::LshIndexParams(lshTables, lshKeyBits, lshProbes),
+                 cvflann::FLANN_DIST_HAMMING);
+  } catch (const Exception& e) {
+    cerr << "Failed to build the painting index: " << e.what() << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes the features to path and the hash tables next to it
+ */
+bool
+PaintingIndex::save(const string& path) const
+{
+  ofstream out(path, ios::binary | ios::trunc);
+  if (!out.is_open() || descriptors.empty()) {
+    cerr << "Failed to write painting index: " << path << endl;
+    return false;
+  }
+
+  out.write(fileHeader, sizeof(fileHeader));
+  putString(out, featureType);
+  put(out, (uint32_t)names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    putString(out, names[i]);
+    put(out, (int32_t)sizes[i].width);
+    put(out, (int32_t)sizes[i].height);
+    put(out, (uint32_t)count(owner.begin(), owner.end(), (int)i));
+  }
+  put(out, (uint32_t)descriptors.cols);
+  for (const Point2f& point : keypoints) {
+    put(out, point.x);
+    put(out, point.y);
+  }
+  for (int y = 0; y < descriptors.rows; y++) {
+    out.write(descriptors.ptr<char>(y), descriptors.cols);
+  }
+  if (!out.good()) {
+    cerr << "Failed to write painting index: " << path << endl;
+    return false;
+  }
+
+  try {
+    lock_guard<mutex> lock(tablesMutex);
+    tables.save(path + tablesSuffix);
+  } catch (const Exception& e) {
+    cerr << "Failed to write the index hash tables: " << e.what() << endl;
+    return false;
+  }
+  cout << "Painting index saved to " << path << endl;
+  return true;
+}
+
+/**
+ * @brief Reads an index written by save. The hash tables are rebuilt if their
+ * file is missing or stale.
+ */
+bool
+PaintingIndex::load(const string& path)
+{
+  ifstream in(path, ios::binary);
+  char header[sizeof(fileHeader)];
+  string features;
+  uint32_t paintings = 0;
+  if (!in.is_open() || !in.read(header, sizeof(header)) ||
+      memcmp(header, fileHeader, sizeof(fileHeader)) != 0 ||
+      !takeString(in, features) || !createExtractor(features, 1) ||
+      !take(in, paintings)) {
+    cerr << "Not a painting index: " << path << endl;
+    return false;
+  }
+
+  vector<string> indexNames(paintings);
+  vector<Size> indexSizes(paintings);
+  vector<int> indexOwner;
+  for (uint32_t i = 0; i < paintings; i++) {
+    int32_t width, height;
+    uint32_t count;
+    if (!takeString(in, indexNames[i]) || !take(in, width) ||
+        !take(in, height) || !take(in, count)) {
+      cerr << "Truncated painting index: " << path << endl;
+      return false;
+    }
+    indexSizes[i] = Size(width, height);
+    indexOwner.insert(indexOwner.end(), count, (int)i);
+  }
+
+  uint32_t descriptorBytes;
+  vector<Point2f> indexKeypoints(indexOwner.size());
+  if (!take(in, descriptorBytes) || descriptorBytes == 0 ||
+      indexOwner.empty()) {
+    cerr << "Truncated painting index: " << path << endl;
+    return false;
+  }
+  Mat indexDescriptors((int)indexOwner.size(), (int)descriptorBytes, CV_8U);
+  for (Point2f& point : indexKeypoints) {
+    take(in, point.x);
+    take(in, point.y);
+  }
+  in.read(indexDescriptors.ptr<char>(), indexDescriptors.total());
+  if (!in) {
+    cerr << "Truncated painting index: " << path << endl;
+    return false;
+  }
+
+  featureType = features;
+  names = indexNames;
+  sizes = indexSizes;
+  owner = indexOwner;
+  keypoints = indexKeypoints;
+  descriptors = indexDescriptors;
+
+  // flann checks that the tables were built from the same descriptors
+  bool loaded = false;
+  try {
+    lock_guard<mutex> lock(tablesMutex);
+    loaded = tables.load(descriptors, path + tablesSuffix);
+  } catch (const Exception& e) {
+    loaded = false;
+  }
+  if (!loaded && !buildTables()) {
+    return false;
+  }
+  cout << "Loaded " << featureType << " index of " << names.size()
+       << " paintings (" << keypoints.size() << " features) from " << path
+       << endl;
+  return true;
+}
+
+/**
+ * @brief Paintings in gray with at least minInliers features agreeing on where
+ * they are, best first
+ */
+vector<Recognition>
+PaintingIndex::recognize(const Mat& gray, int minInliers) const
+{
+  vector<Recognition> found;
+  if (descriptors.empty() || gray.empty()) {
+    return found;
+  }
+
+  // Extractors are cheap to create and keep cameras from sharing one
+  Ptr<Feature2D> extractor = createExtractor(featureType, featuresPerFrame);
+  vector<KeyPoint> points;
+  Mat frameDescriptors;
+  extract(*extractor, gray, featuresPerFrame, points, frameDescriptors);
+  if ((int)points.size() < minInliers) {
+    return found;
+  }
+
+  Mat indices, distances;
+  {
+    lock_guard<mutex> lock(tablesMutex);
+    tables.knnSearch(frameDescriptors, indices, distances, 2);
+  }
+  distances.convertTo(distances, CV_32F);
+
+  // Every frame feature votes for the painting of its nearest neighbour. The
+  // ratio test only compares against other paintings, since a painting's
+  // own repeated patterns are no reason to doubt a match.
+  float maxDistance = maxDistanceRate * descriptors.cols * 8;
+  map<int, vector<pair<int, int>>> votes;
+  for (int q = 0; q < indices.rows; q++) {
+    int best = indices.at<int>(q, 0);
+    int second = indices.at<int>(q, 1);
+    if (best < 0 || best >= (int)owner.size() ||
+        distances.at<float>(q, 0) > maxDistance) {
+      continue;
+    }
+    if (second >= 0 && second < (int)owner.size() &&
+        owner[second] != owner[best] &&
+        distances.at<float>(q, 0) > ratio * distances.at<float>(q, 1)) {
+      continue;
+    }
+    votes[owner[best]].push_back({ q, best });
+  }
+
+  vector<pair<size_t, int>> ranked;
+  for (const auto& entry : votes) {
+    if ((int)entry.second.size() >= minInliers) {
+      ranked.push_back({ entry.second.size(), entry.first });
+    }
+  }
+  sort(ranked.rbegin(), ranked.rend());
+  ranked.resize(min(ranked.size(), maxVerified));
+
+  for (const auto& candidate : ranked) {
+    const vector<pair<int, int>>& matches = votes[candidate.second];
+    vector<Point2f> from, to;
+    for (const auto& match : matches) {
+      from.push_back(keypoints[match.second]);
+      to.push_back(points[match.first].pt);
+    }
+    Mat inliers;
+    Mat homography = findHomography(from, to, RANSAC, ransacThreshold, inliers);
+    if (homography.empty() || countNonZero(inliers) < minInliers) {
+      continue;
+    }
+
+    Size size = sizes[candidate.second];
+    vector<Point2f> imageCorners = { Point2f(0, 0),
+                                     Point2f((float)size.width, 0),
+                                     Point2f((float)size.width,
+                                             (float)size.height),
+                                     Point2f(0, (float)size.height) };
+    vector<Point2f> frameCorners;
+    perspectiveTransform(imageCorners, frameCorners, homography);
+    if (!isContourConvex(frameCorners) || contourArea(frameCorners) < minArea) {
+      continue;
+    }
+
+    Recognition recognition;
+    recognition.entry = candidate.second;
+    copy(frameCorners.begin(), frameCorners.end(), recognition.corners);
+    for (size_t i = 0; i < to.size(); i++) {
+      if (inliers.at<uchar>((int)i)) {
+        recognition.points.push_back(to[i]);
+      }
+    }
+    found.push_back(recognition);
+  }
+
+  sort(found.begin(),
+       found.end(),
+       [](const Recognition& a, const Recognition& b) {
+         return a.points.size() > b.points.size();
+       });
+  return found;
+}
+
+PaintingRecognizer::PaintingRecognizer(shared_ptr<const PaintingIndex> index,
+                                       int keyframeInterval,
+                                       int minInliers)
+  : paintings(index)
+  , keyframeInterval(max(keyframeInterval, 1))
+  , minInliers(max(minInliers, 4))
+  , framesSinceKeyframe(max(keyframeInterval, 1) - 1)
+{
+}
+
+/**
+ * @brief Paintings in this frame's gray image
+ */
+const vector<Recognition>&
+PaintingRecognizer::update(const Mat& gray)
+{
+  matched = false;
+  if (!found.empty() && previous.size() == gray.size()) {
+    follow(gray);
+  } else {
+    found.clear();
+  }
+
+  // A fresh match replaces what was followed of the same painting, the rest
+  // keep being followed
+  if (++framesSinceKeyframe >= keyframeInterval) {
+    framesSinceKeyframe = 0;
+    matched = true;
+    for (Recognition& recognition : paintings->recognize(gray, minInliers)) {
+      auto same = find_if(
+        found.begin(), found.end(), [&](const Recognition& followed) {
+          return followed.entry == recognition.entry;
+        });
+      if (same != found.end()) {
+        *same = recognition;
+      } else {
+        found.push_back(recognition);
+      }
+    }
+  }
+
+  gray.copyTo(previous);
+  return found;
+}
+
+/**
+ * @brief Moves every painting found so far with the optical flow of its
+ * features from the previous frame
+ */
+void
+PaintingRecognizer::follow(const Mat& gray)
+{
+  for (auto it = found.begin(); it != found.end();) {
+    Recognition& recognition = *it;
+    bool kept = false;
+    calcOpticalFlowPyrLK(
+      previous, gray, recognition.points, next, status, error);
+
+    vector<Point2f> from, to;
+    for (size_t i = 0; i < next.size(); i++) {
+      if (status[i]) {
+        from.push_back(recognition.points[i]);
+        to.push_back(next[i]);
+      }
+    }
+
+    if (from.size() >= minFollowed) {
+      Mat inliers;
+      Mat motion = findHomography(from, to, RANSAC, ransacThreshold, inliers);
+      vector<Point2f> corners(recognition.corners, recognition.corners + 4);
+      vector<Point2f> moved;
+      if (!motion.empty()) {
+        perspectiveTransform(corners, moved, motion);
+        recognition.points.clear();
+        for (size_t i = 0; i < to.size(); i++) {
+          if (inliers.at<uchar>((int)i)) {
+            recognition.points.push_back(to[i]);
+          }
+        }
+        kept = recognition.points.size() >= minFollowed &&
+               isContourConvex(moved) && contourArea(moved) >= minArea;
+      }
+      if (kept) {
+        copy(moved.begin(), moved.end(), recognition.corners);
+      }
+    }
+    it = kept ? it + 1 : found.erase(it);
+  }
+}
+
+}
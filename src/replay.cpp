@@ -0,0 +1,215 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Replay a recorded session through the pipeline without a camera or
+ * window and compare the result against golden frames, so a change to the
+ * hot path can be checked for both output and speed.
+ */
+
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+
+#include "../include/ar_utils.h"
+#include "../include/replay.h"
+#include "../include/session.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+namespace replay {
+
+// Corners may move this far in pixels before detections count as changed
+static const float cornerTolerance = 0.5f;
+
+/**
+ * @brief Total and worst time of one stage over the replay
+ */
+struct StageTotals
+{
+  double total = 0;
+  double worst = 0;
+
+  void add(double seconds)
+  {
+    total += seconds;
+    worst = max(worst, seconds);
+  }
+};
+
+/**
+ * @brief Prints one line of the timing table
+ */
+static void
+printStage(const string& label, const StageTotals& stage, int frames)
+{
+  cout << left << setw(16) << label << right << fixed << setprecision(3)
+       << setw(10) << 1000.0 * stage.total / frames << " ms/frame"
+       << setw(10) << 1000.0 * stage.worst << " ms worst" << endl;
+}
+
+/**
+ * @brief True if the pipeline found the same markers as the recording
+ */
+static bool
+sameDetections(const vector<session::MarkerDetection>& recorded,
+               const vector<session::MarkerDetection>& replayed)
+{
+  if (recorded.size() != replayed.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < recorded.size(); i++) {
+    if (recorded[i].id != replayed[i].id) {
+      return false;
+    }
+    for (int c = 0; c < 4; c++) {
+      Point2f offset = recorded[i].corners[c] - replayed[i].corners[c];
+      if (abs(offset.x) > cornerTolerance || abs(offset.y) > cornerTolerance) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Golden frame path for the frame at index of camera
+ */
+static string
+goldenPath(const string& directory, int index, int camera)
+{
+  ostringstream name;
+  name << "frame_" << setw(6) << setfill('0') << index << "_camera" << camera
+       << ".png";
+  return (fs::path(directory) / name.str()).string();
+}
+
+/**
+ * @brief Feeds every frame of the session through a pipeline per recorded
+ * camera and prints per-stage timing. Composited frames are compared by PSNR
+ * against the golden frame of the same name; missing golden frames are
+ * written instead, so the first run records the baseline. Returns 1 if any
+ * frame falls below minPsnr, -1 if the session cannot be read and 0
+ * otherwise.
+ */
+int
+runReplay(const ReplayOptions& options,
+          const detector_config::DetectorConfig& config,
+          const vector<marker_board::MarkerBoard>& boards,
+          const camera_pipeline::ExhibitSet& exhibits)
+{
+  ar_utils::printBorder();
+  session::SessionReader reader;
+  if (!reader.open(options.sessionFile)) {
+    return -1;
+  }
+  if (!options.goldenDirectory.empty()) {
+    fs::create_directories(options.goldenDirectory);
+  }
+
+  vector<unique_ptr<camera_pipeline::CameraPipeline>> cameras;
+  camera_pipeline::OverlayFrame overlay;
+  session::FrameRecord record;
+  StageTotals preprocess, detect, pose, composite, total;
+  int frames = 0, changedDetections = 0, compared = 0, written = 0;
+  int belowThreshold = 0;
+  double worstPsnr = numeric_limits<double>::infinity(), psnrTotal = 0;
+
+  while (reader.read(record)) {
+    if (record.camera < 0) {
+      continue;
+    }
+
+    // Pipelines are created as their cameras first appear in the session
+    while ((int)cameras.size() <= record.camera) {
+      size_t i = cameras.size();
+      string calibration = i < options.cameraCalibrations.size()
+                             ? options.cameraCalibrations[i]
+                             : options.calibrationFile;
+      cameras.push_back(unique_ptr<camera_pipeline::CameraPipeline>(
+        new camera_pipeline::CameraPipeline("replay" + to_string(i),
+                                            calibration,
+                                            config,
+                                            boards,
+                                            options.useOpenCL,
+                                            options.handleOcclusion)));
+    }
+    camera_pipeline::CameraPipeline& camera = *cameras[record.camera];
+
+    camera_pipeline::selectExhibit(exhibits,
+                                   record.exhibit % exhibits.size(),
+                                   record.timestamp,
+                                   options.useOpenCL,
+                                   overlay);
+
+    int64 start = getTickCount();
+    camera.processFrame(record.frame, overlay, exhibits, record.timestamp);
+    camera.latch();
+    total.add((getTickCount() - start) / getTickFrequency());
+    preprocess.add(camera.stageTimes().preprocess);
+    detect.add(camera.stageTimes().detect);
+    pose.add(camera.stageTimes().pose);
+    composite.add(camera.stageTimes().composite);
+
+    if (!sameDetections(record.detections, camera.detections())) {
+      changedDetections++;
+    }
+
+    if (!options.goldenDirectory.empty()) {
+      string path = goldenPath(options.goldenDirectory, frames, record.camera);
+      Mat golden = imread(path, IMREAD_UNCHANGED);
+      if (golden.empty()) {
+        imwrite(path, camera.output());
+        written++;
+      } else {
+        double psnr = golden.size() == camera.output().size() &&
+                          golden.type() == camera.output().type()
+                        ? PSNR(golden, camera.output())
+                        : 0;
+        compared++;
+        psnrTotal += psnr;
+        worstPsnr = min(worstPsnr, psnr);
+        if (psnr < options.minPsnr) {
+          belowThreshold++;
+          cerr << "Frame " << frames << " of camera " << record.camera
+               << " differs from " << path << ": " << psnr << " dB" << endl;
+        }
+      }
+    }
+    frames++;
+  }
+
+  if (frames == 0) {
+    cerr << "No frames in session " << options.sessionFile << endl;
+    return -1;
+  }
+
+  cout << "Replayed " << frames << " frames from " << cameras.size()
+       << " camera(s) of " << options.sessionFile << endl;
+  printStage("preprocess", preprocess, frames);
+  printStage("detect", detect, frames);
+  printStage("pose", pose, frames);
+  printStage("composite", composite, frames);
+  printStage("total", total, frames);
+  cout << changedDetections << " frames detected different markers than "
+       << "when recorded" << endl;
+
+  if (written > 0) {
+    cout << "Wrote " << written << " golden frames to "
+         << options.goldenDirectory << endl;
+  }
+  if (compared > 0) {
+    cout << "PSNR against golden frames: " << setprecision(2)
+         << psnrTotal / compared << " dB mean, " << worstPsnr
+         << " dB worst, " << belowThreshold << " of " << compared
+         << " frames below " << options.minPsnr << " dB" << endl;
+  }
+  return belowThreshold > 0 ? 1 : 0;
+}
+
+}
@@ -0,0 +1,228 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Recorded sessions for reproducing field issues. Every processed
+ * camera frame is appended to a stream file together with what was detected
+ * and tracked in it, so the session can be replayed later without a camera.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../include/session.h"
+
+using namespace std;
+using namespace cv;
+
+namespace session {
+
+// File layout: the header, then one record per frame. A record is a uint32
+// size followed by camera, exhibit, timestamp, the PNG encoded frame, the
+// detections and the tracked poses, all in host byte order.
+static const char fileHeader[8] = { 'A', 'M', 'S', 'E', 'S', 'S', '0', '1' };
+
+// Fast PNG compression keeps recording close to camera rate while staying
+// lossless, which replay needs to be deterministic
+static const int pngCompression = 1;
+
+// Bytes each detection and pose takes in a record, used to reject counts
+// that a corrupt record couldn't hold before allocating for them
+static const size_t detectionBytes = sizeof(int32_t) + 8 * sizeof(float);
+static const size_t poseBytes = 2 * sizeof(int32_t) + 6 * sizeof(double);
+
+/**
+ * @brief Appends the bytes of a plain value to buffer
+ */
+template<typename T>
+static void
+put(vector<char>& buffer, const T& value)
+{
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+/**
+ * @brief Reads a plain value from buffer at offset. Returns false if the
+ * buffer is too short.
+ */
+template<typename T>
+static bool
+take(const vector<char>& buffer, size_t& offset, T& value)
+{
+  if (offset + sizeof(T) > buffer.size()) {
+    return false;
+  }
+  memcpy(&value, buffer.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+bool
+SessionWriter::open(const string& path)
+{
+  out.open(path, ios::binary | ios::trunc);
+  if (!out.is_open()) {
+    cerr << "Failed to open session file for recording: " << path << endl;
+    return false;
+  }
+  out.write(fileHeader, sizeof(fileHeader));
+  cout << "Recording session to " << path << endl;
+  return true;
+}
+
+/**
+ * @brief Appends record to the session and flushes it so it survives a crash
+ */
+bool
+SessionWriter::write(const FrameRecord& record)
+{
+  if (!out.is_open() || record.frame.empty()) {
+    return false;
+  }
+
+  // Raw YUYV camera frames are stored as colour
+  const Mat* image = &record.frame;
+  if (record.frame.type() == CV_8UC2) {
+    cvtColor(record.frame, converted, COLOR_YUV2BGR_YUYV);
+    image = &converted;
+  }
+
+  imencode(".png",
+           *image,
+           encoded,
+           { IMWRITE_PNG_COMPRESSION, pngCompression });
+
+  payload.clear();
+  put(payload, (int32_t)record.camera);
+  put(payload, (int32_t)record.exhibit);
+  put(payload, record.timestamp);
+  put(payload, (uint32_t)encoded.size());
+  payload.insert(payload.end(), encoded.begin(), encoded.end());
+
+  put(payload, (uint32_t)record.detections.size());
+  for (const MarkerDetection& detection : record.detections) {
+    put(payload, (int32_t)detection.id);
+    for (const Point2f& corner : detection.corners) {
+      put(payload, corner.x);
+      put(payload, corner.y);
+    }
+  }
+
+  put(payload, (uint32_t)record.poses.size());
+  for (const TrackedPose& pose : record.poses) {
+    put(payload, (int32_t)pose.key);
+    put(payload, (int32_t)pose.state);
+    for (int i = 0; i < 3; i++) {
+      put(payload, pose.rvec[i]);
+      put(payload, pose.tvec[i]);
+    }
+  }
+
+  uint32_t size = (uint32_t)payload.size();
+  out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.write(payload.data(), payload.size());
+  out.flush();
+  return out.good();
+}
+
+void
+SessionWriter::close()
+{
+  if (out.is_open()) {
+    out.close();
+  }
+}
+
+bool
+SessionReader::open(const string& path)
+{
+  in.open(path, ios::binary);
+  char header[sizeof(fileHeader)];
+  if (!in.is_open() || !in.read(header, sizeof(header)) ||
+      memcmp(header, fileHeader, sizeof(fileHeader)) != 0) {
+    cerr << "Not a recorded session: " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the next record. Returns false at the end of the session or on
+ * a truncated record.
+ */
+bool
+SessionReader::read(FrameRecord& record)
+{
+  uint32_t size;
+  if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+    return false;
+  }
+  payload.resize(size);
+  if (!in.read(payload.data(), size)) {
+    cerr << "Session ends with a truncated frame" << endl;
+    return false;
+  }
+
+  size_t offset = 0;
+  int32_t camera, exhibit;
+  uint32_t encodedSize;
+  if (!take(payload, offset, camera) || !take(payload, offset, exhibit) ||
+      !take(payload, offset, record.timestamp) ||
+      !take(payload, offset, encodedSize) ||
+      offset + encodedSize > payload.size()) {
+    return false;
+  }
+  record.camera = camera;
+  record.exhibit = exhibit;
+
+  Mat encoded(1, (int)encodedSize, CV_8UC1, payload.data() + offset);
+  record.frame = imdecode(encoded, IMREAD_UNCHANGED);
+  offset += encodedSize;
+
+  uint32_t count;
+  if (!take(payload, offset, count) ||
+      count > (payload.size() - offset) / detectionBytes) {
+    cerr << "Session record has a corrupt detection count" << endl;
+    return false;
+  }
+  record.detections.resize(count);
+  for (MarkerDetection& detection : record.detections) {
+    int32_t id;
+    if (!take(payload, offset, id)) {
+      return false;
+    }
+    detection.id = id;
+    for (Point2f& corner : detection.corners) {
+      if (!take(payload, offset, corner.x) ||
+          !take(payload, offset, corner.y)) {
+        return false;
+      }
+    }
+  }
+
+  if (!take(payload, offset, count) ||
+      count > (payload.size() - offset) / poseBytes) {
+    cerr << "Session record has a corrupt pose count" << endl;
+    return false;
+  }
+  record.poses.resize(count);
+  for (TrackedPose& pose : record.poses) {
+    int32_t key, state;
+    if (!take(payload, offset, key) || !take(payload, offset, state)) {
+      return false;
+    }
+    pose.key = key;
+    pose.state = state;
+    for (int i = 0; i < 3; i++) {
+      if (!take(payload, offset, pose.rvec[i]) ||
+          !take(payload, offset, pose.tvec[i])) {
+        return false;
+      }
+    }
+  }
+
+  return !record.frame.empty();
+}
+
+}
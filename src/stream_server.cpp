@@ -0,0 +1,496 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Stream the augmented feeds as MJPEG over HTTP for lobby displays
+ * and remote monitors. Each frame is JPEG-encoded once on a worker thread and
+ * the same buffer is sent to every client watching that camera.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../include/stream_server.h"
+
+using namespace std;
+using namespace cv;
+
+namespace stream_server {
+
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;
+#else
+static const int sendFlags = 0;
+#endif
+
+// Beyond this new connections are closed straight away
+static const size_t maxClients = 32;
+
+static const char* const streamHeader =
+  "HTTP/1.0 200 OK\r\n"
+  "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+  "Cache-Control: no-cache\r\n"
+  "Connection: close\r\n\r\n";
+
+static const char* const notFound =
+  "HTTP/1.0 404 Not Found\r\n"
+  "Content-Type: text/plain\r\n"
+  "Connection: close\r\n\r\n"
+  "Streams are served at /stream/<camera>\n";
+
+/**
+ * @brief Makes fd non-blocking
+ */
+static bool
+setNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/**
+ * @brief Camera requested by a GET line, or -1 if it isn't a stream
+ */
+static int
+requestedCamera(const string& request, int cameras)
+{
+  if (request.compare(0, 4, "GET ") != 0) {
+    return -1;
+  }
+  size_t end = request.find(' ', 4);
+  string path = request.substr(4, end == string::npos ? end : end - 4);
+  if (path == "/" || path == "/stream" || path == "/stream/") {
+    return 0;
+  }
+  if (path.compare(0, 8, "/stream/") != 0 || path.size() == 8) {
+    return -1;
+  }
+
+  int camera = 0;
+  for (size_t i = 8; i < path.size(); i++) {
+    if (!isdigit((unsigned char)path[i]) || camera > cameras) {
+      return -1;
+    }
+    camera = camera * 10 + (path[i] - '0');
+  }
+  return camera < cameras ? camera : -1;
+}
+
+/**
+ * @brief Serves cameras streams, each JPEG-encoded at quality (0-100)
+ */
+StreamServer::StreamServer(int cameras, int quality)
+  : quality(quality)
+  , clientCount(metrics::registry().gauge("augmuseum_stream_clients",
+                                          "Clients watching an MJPEG stream"))
+{
+  for (int i = 0; i < cameras; i++) {
+    channels.push_back(unique_ptr<Channel>(new Channel()));
+    auto camera = metrics::label("camera", to_string(i));
+    channels.back()->encoded = &metrics::registry().counter(
+      "augmuseum_stream_frames_encoded_total",
+      "Frames JPEG-encoded for the MJPEG stream",
+      camera);
+    channels.back()->skipped = &metrics::registry().counter(
+      "augmuseum_stream_frames_skipped_total",
+      "Encoded frames a slow stream client never received",
+      camera);
+  }
+}
+
+StreamServer::~StreamServer()
+{
+  stop();
+}
+
+/**
+ * @brief Starts listening on address and the encoder and server threads.
+ * Returns false if the socket could not be set up.
+ */
+bool
+StreamServer::start(const string& address)
+{
+  stop();
+
+  // A bare port stays on localhost, other interfaces have to be asked for
+  string host = "127.0.0.1", portText = address;
+  size_t colon = address.rfind(':');
+  if (colon != string::npos) {
+    host = address.substr(0, colon);
+    portText = address.substr(colon + 1);
+  }
+
+  int port = 0;
+  try {
+    port = stoi(portText);
+  } catch (const exception&) {
+  }
+  sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons((uint16_t)max(port, 0));
+  if (port <= 0 || port > 65535 ||
+      inet_pton(AF_INET, host.c_str(), &local.sin_addr) != 1) {
+    cerr << "Invalid stream address: " << address << endl;
+    return false;
+  }
+
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  if (listenFd >= 0) {
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  }
+  if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0 ||
+      listen(listenFd, 8) != 0 || !setNonBlocking(listenFd)) {
+    cerr << "Failed to listen for stream clients on " << address << ": "
+         << strerror(errno) << endl;
+    stop();
+    return false;
+  }
+
+  // The encoder wakes the server through a pipe when a new frame is ready
+  if (pipe(wakeFds) != 0 || !setNonBlocking(wakeFds[0]) ||
+      !setNonBlocking(wakeFds[1])) {
+    cerr << "Failed to create the stream wake pipe: " << strerror(errno)
+         << endl;
+    stop();
+    return false;
+  }
+
+  stopping = false;
+  encoder = thread(&StreamServer::encode, this);
+  worker = thread(&StreamServer::serve, this);
+  cout << "Streaming MJPEG on http://" << host << ":" << port
+       << "/stream/<camera>" << endl;
+  return true;
+}
+
+/**
+ * @brief Stops both threads and disconnects every client
+ */
+void
+StreamServer::stop()
+{
+  {
+    lock_guard<mutex> lock(encodeMutex);
+    stopping = true;
+  }
+  encodeReady.notify_all();
+  if (encoder.joinable()) {
+    encoder.join();
+  }
+  if (worker.joinable()) {
+    worker.join();
+  }
+
+  for (auto& client : clients) {
+    drop(client);
+  }
+  clients.clear();
+  for (int& fd : wakeFds) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+}
+
+/**
+ * @brief Offers the composited frame of a camera for streaming. Copies it
+ * only when a client is watching and the encoder has taken the previous one,
+ * otherwise returns straight away.
+ */
+void
+StreamServer::publish(int camera, const Mat& frame)
+{
+  if (listenFd < 0 || camera < 0 || camera >= (int)channels.size() ||
+      frame.empty()) {
+    return;
+  }
+  Channel& channel = *channels[camera];
+  if (channel.clients.load(memory_order_relaxed) == 0) {
+    return;
+  }
+
+  unique_lock<mutex> lock(encodeMutex, try_to_lock);
+  if (!lock.owns_lock() || channel.hasPending) {
+    return;
+  }
+  frame.copyTo(channel.pending);
+  channel.hasPending = true;
+  lock.unlock();
+  encodeReady.notify_one();
+}
+
+/**
+ * @brief Encoder thread body. Takes pending frames round robin across
+ * cameras, encodes each once and publishes it as the latest frame.
+ */
+void
+StreamServer::encode()
+{
+  vector<int> params = { IMWRITE_JPEG_QUALITY, quality };
+  Mat frame;
+  size_t next = 0;
+  unique_lock<mutex> lock(encodeMutex);
+  while (true) {
+    encodeReady.wait(lock, [&] {
+      return stopping ||
+             any_of(channels.begin(),
+                    channels.end(),
+                    [](const unique_ptr<Channel>& c) { return c->hasPending; });
+    });
+    if (stopping) {
+      return;
+    }
+
+    size_t camera = next;
+    while (!channels[camera]->hasPending) {
+      camera = (camera + 1) % channels.size();
+    }
+    next = (camera + 1) % channels.size();
+
+    // Swapping hands the last encoded buffer back to publish() for reuse
+    Channel& channel = *channels[camera];
+    swap(frame, channel.pending);
+    channel.hasPending = false;
+    uint64_t sequence = ++channel.sequence;
+    lock.unlock();
+
+    auto encoded = make_shared<EncodedFrame>();
+    encoded->sequence = sequence;
+    if (imencode(".jpg", frame, encoded->jpeg, params)) {
+      atomic_store(&channel.latest,
+                   shared_ptr<const EncodedFrame>(move(encoded)));
+      channel.encoded->add();
+      char wake = 1;
+      if (write(wakeFds[1], &wake, 1) < 0) {
+        // Pipe already full, the server is awake anyway
+      }
+    }
+
+    lock.lock();
+  }
+}
+
+/**
+ * @brief Server thread body. Multiplexes the listener and every client with
+ * poll, so a client that can't keep up only ever delays itself.
+ */
+void
+StreamServer::serve()
+{
+  vector<pollfd> fds;
+  while (!stopping) {
+    fds.clear();
+    fds.push_back({ listenFd, POLLIN, 0 });
+    fds.push_back({ wakeFds[0], POLLIN, 0 });
+    for (auto& client : clients) {
+      short events = POLLIN;
+      if (!client.head.empty()) {
+        events |= POLLOUT;
+      }
+      fds.push_back({ client.fd, events, 0 });
+    }
+    if (poll(fds.data(), fds.size(), 200) <= 0) {
+      continue;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(wakeFds[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+
+    for (size_t i = 0; i < clients.size(); i++) {
+      Client& client = clients[i];
+      short ready = fds[i + 2].revents;
+      bool alive = !(ready & (POLLERR | POLLHUP | POLLNVAL));
+      if (alive && (ready & POLLIN)) {
+        alive = readRequest(client);
+      }
+      if (alive && client.head.empty() && client.camera >= 0) {
+        startPart(client);
+      }
+      if (alive && !client.head.empty()) {
+        alive = sendPending(client);
+      }
+      if (!alive) {
+        drop(client);
+      }
+    }
+    clients.erase(remove_if(clients.begin(),
+                            clients.end(),
+                            [](const Client& c) { return c.fd < 0; }),
+                  clients.end());
+
+    if (fds[0].revents & POLLIN) {
+      acceptClient();
+    }
+  }
+}
+
+/**
+ * @brief Accepts every waiting connection
+ */
+void
+StreamServer::acceptClient()
+{
+  while (true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    if (clients.size() >= maxClients || !setNonBlocking(fd)) {
+      close(fd);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    int noSignal = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+    Client client;
+    client.fd = fd;
+    clients.push_back(client);
+  }
+}
+
+/**
+ * @brief Reads the request of a client and queues the response once the
+ * headers are in. Returns false if the client went away.
+ */
+bool
+StreamServer::readRequest(Client& client)
+{
+  char buffer[1024];
+  ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+  if (received == 0) {
+    return false;
+  }
+  if (received < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+
+  // Anything sent once the stream has started is ignored
+  if (client.camera >= 0 || client.closing) {
+    return true;
+  }
+  client.request.append(buffer, (size_t)received);
+  if (client.request.find("\r\n\r\n") == string::npos &&
+      client.request.find("\n\n") == string::npos) {
+    return client.request.size() < 8192;
+  }
+
+  int camera = requestedCamera(client.request, (int)channels.size());
+  client.request.clear();
+  if (camera < 0) {
+    client.head = notFound;
+    client.closing = true;
+    return true;
+  }
+
+  client.camera = camera;
+  client.head = streamHeader;
+  channels[camera]->clients++;
+  clientCount.set(clientCount.get() + 1);
+  return true;
+}
+
+/**
+ * @brief Queues the newest frame of the client's camera if it hasn't been
+ * sent yet. Frames encoded while the previous part was going out are
+ * skipped.
+ */
+bool
+StreamServer::startPart(Client& client)
+{
+  Channel& channel = *channels[client.camera];
+  shared_ptr<const EncodedFrame> latest = atomic_load(&channel.latest);
+  if (!latest || latest->sequence == client.lastSequence) {
+    return false;
+  }
+  if (client.lastSequence != 0 &&
+      latest->sequence > client.lastSequence + 1) {
+    channel.skipped->add(latest->sequence - client.lastSequence - 1);
+  }
+
+  client.head = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+                to_string(latest->jpeg.size()) + "\r\n\r\n";
+  client.frame = latest;
+  client.offset = 0;
+  client.lastSequence = latest->sequence;
+  return true;
+}
+
+/**
+ * @brief Sends as much of the queued data as the socket takes without
+ * blocking. Returns false if the client went away or is done.
+ */
+bool
+StreamServer::sendPending(Client& client)
+{
+  static const char trailer[] = "\r\n";
+  size_t headSize = client.head.size();
+  size_t bodySize = client.frame ? client.frame->jpeg.size() : 0;
+  size_t total = headSize + (client.frame ? bodySize + 2 : 0);
+
+  while (client.offset < total) {
+    const char* data;
+    size_t size;
+    if (client.offset < headSize) {
+      data = client.head.data() + client.offset;
+      size = headSize - client.offset;
+    } else if (client.offset < headSize + bodySize) {
+      size_t done = client.offset - headSize;
+      data = (const char*)client.frame->jpeg.data() + done;
+      size = bodySize - done;
+    } else {
+      size_t done = client.offset - headSize - bodySize;
+      data = trailer + done;
+      size = 2 - done;
+    }
+
+    ssize_t sent = send(client.fd, data, size, sendFlags);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    client.offset += (size_t)sent;
+  }
+
+  client.head.clear();
+  client.frame.reset();
+  client.offset = 0;
+  return !client.closing;
+}
+
+/**
+ * @brief Closes the connection of a client
+ */
+void
+StreamServer::drop(Client& client)
+{
+  if (client.fd < 0) {
+    return;
+  }
+  close(client.fd);
+  client.fd = -1;
+  client.frame.reset();
+  if (client.camera >= 0) {
+    channels[client.camera]->clients--;
+    clientCount.set(clientCount.get() - 1);
+  }
+}
+
+}
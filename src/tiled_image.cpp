@@ -0,0 +1,469 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Paintings stored in small square tiles instead of rows, with a
+ * warp that fills the destination a tile at a time. A rotated painting is
+ * read along slanted lines; in tiles those reads stay within a few cache
+ * lines whatever the angle.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <opencv2/opencv.hpp>
+
+#include "../include/tiled_image.h"
+
+using namespace std;
+using namespace cv;
+
+namespace tiled_image {
+
+// Bilinear weights in fixed point, as in OpenCV's own remap
+static const int weightBits = 5;
+static const int weightOne = 1 << weightBits;
+
+// Painting positions in 16.16 fixed point. Destination pixels mapping
+// further out than maxCoordinate are black, which keeps them in range.
+static const int fixedBits = 16;
+static const int fixedOne = 1 << fixedBits;
+static const int fractionShift = fixedBits - weightBits;
+static const double maxCoordinate = 1 << 13;
+
+// YCrCb to BGR in 14 bit fixed point, with the coefficients of OpenCV's
+// COLOR_YCrCb2BGR
+static const int colourBits = 14;
+static const int crToR = 22987;
+static const int crToG = -11698;
+static const int cbToG = -5636;
+static const int cbToB = 29049;
+
+/**
+ * @brief Converts a format name ("bgr" or "yuv420") to its value. Returns
+ * false if the name is unknown.
+ */
+bool
+formatFromName(const string& name, PixelFormat& format)
+{
+  if (name == "bgr") {
+    format = PixelFormat::Bgr;
+    return true;
+  }
+  if (name == "yuv420") {
+    format = PixelFormat::Yuv420;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Copies image, which must be CV_8UC3, into tiles of format. Leaves the
+ * tiled image empty for any other type.
+ */
+void
+TiledImage::build(const Mat& image, PixelFormat format)
+{
+  data.clear();
+  imageSize = Size();
+  tilesPerRow = 0;
+  pixelFormat = format;
+  if (image.empty() || image.type() != CV_8UC3) {
+    return;
+  }
+
+  imageSize = image.size();
+  tilesPerRow = (image.cols + tileSide - 1) / tileSide;
+  int tileRows = (image.rows + tileSide - 1) / tileSide;
+  size_t tileBytes = format == PixelFormat::Bgr ? bgrTileBytes : 64 + 2 * 16;
+  data.assign((size_t)tilesPerRow * tileRows * tileBytes, 0);
+
+  // Each tile takes runs of up to 9 pixels from 9 rows, overlapping its
+  // neighbours by one; what falls past the image stays black
+  if (format == PixelFormat::Bgr) {
+    for (int y0 = 0; y0 < image.rows; y0 += tileSide) {
+      int rows = min(tileSide + 1, image.rows - y0);
+      for (int x0 = 0; x0 < image.cols; x0 += tileSide) {
+        int run = min(tileSide + 1, image.cols - x0);
+        uchar* tile = data.data() + offset(x0, y0);
+        for (int row = 0; row < rows; row++) {
+          memcpy(tile + row * bgrRowStride,
+                 image.ptr<uchar>(y0 + row) + x0 * 3,
+                 run * 3);
+        }
+      }
+    }
+    return;
+  }
+
+  // Chroma is averaged over each 2x2 block, as video encoders do
+  Mat ycrcb, planes[3], cr, cb;
+  cvtColor(image, ycrcb, COLOR_BGR2YCrCb);
+  split(ycrcb, planes);
+  Size chromaSize((image.cols + 1) / 2, (image.rows + 1) / 2);
+  resize(planes[1], cr, chromaSize, 0, 0, INTER_AREA);
+  resize(planes[2], cb, chromaSize, 0, 0, INTER_AREA);
+
+  for (int y = 0; y < image.rows; y++) {
+    const uchar* row = planes[0].ptr<uchar>(y);
+    for (int x = 0; x < image.cols; x += tileSide) {
+      int run = min(tileSide, image.cols - x);
+      memcpy(data.data() + lumaOffset(x, y), row + x, run);
+    }
+  }
+  const int chromaSide = tileSide / 2;
+  for (int cy = 0; cy < chromaSize.height; cy++) {
+    for (int cx = 0; cx < chromaSize.width; cx += chromaSide) {
+      int run = min(chromaSide, chromaSize.width - cx);
+      uchar* sample = data.data() + chromaOffset(cx, cy);
+      memcpy(sample, cb.ptr<uchar>(cy) + cx, run);
+      memcpy(sample + 16, cr.ptr<uchar>(cy) + cx, run);
+    }
+  }
+}
+
+/**
+ * @brief Converts the tiles back to a BGR image
+ */
+void
+TiledImage::copyTo(Mat& image) const
+{
+  if (empty()) {
+    image.release();
+    return;
+  }
+
+  image.create(imageSize, CV_8UC3);
+  if (pixelFormat == PixelFormat::Bgr) {
+    for (int y = 0; y < imageSize.height; y++) {
+      uchar* row = image.ptr<uchar>(y);
+      for (int x = 0; x < imageSize.width; x += tileSide) {
+        int run = min(tileSide, imageSize.width - x);
+        memcpy(row + x * 3, at(x, y), run * 3);
+      }
+    }
+    return;
+  }
+
+  // Chroma is upsampled with the same sample positions the warp uses
+  Size chromaSize((imageSize.width + 1) / 2, (imageSize.height + 1) / 2);
+  Mat planes[3] = { Mat(imageSize, CV_8UC1),
+                    Mat(chromaSize, CV_8UC1),
+                    Mat(chromaSize, CV_8UC1) };
+  for (int y = 0; y < imageSize.height; y++) {
+    uchar* row = planes[0].ptr<uchar>(y);
+    for (int x = 0; x < imageSize.width; x++) {
+      row[x] = luma(x, y);
+    }
+  }
+  for (int cy = 0; cy < chromaSize.height; cy++) {
+    for (int cx = 0; cx < chromaSize.width; cx++) {
+      planes[2].at<uchar>(cy, cx) = chroma(cx, cy)[0];
+      planes[1].at<uchar>(cy, cx) = chroma(cx, cy)[16];
+    }
+  }
+  resize(planes[1], planes[1], imageSize, 0, 0, INTER_LINEAR);
+  resize(planes[2], planes[2], imageSize, 0, 0, INTER_LINEAR);
+  Mat ycrcb;
+  merge(planes, 3, ycrcb);
+  cvtColor(ycrcb, image, COLOR_YCrCb2BGR);
+}
+
+/**
+ * @brief Painting position of destination pixel (x, y) under m. Returns false
+ * where the painting is behind the camera or too far off to be drawn.
+ */
+static bool
+project(const Matx33d& m, double x, double y, double& u, double& v)
+{
+  double W = m(2, 0) * x + m(2, 1) * y + m(2, 2);
+  if (W <= 0) {
+    return false;
+  }
+  u = (m(0, 0) * x + m(0, 1) * y + m(0, 2)) / W;
+  v = (m(1, 0) * x + m(1, 1) * y + m(1, 2)) / W;
+  return std::abs(u) < maxCoordinate && std::abs(v) < maxCoordinate;
+}
+
+/**
+ * @brief A painting coordinate in fixed point, rounded to the bilinear
+ * weights' precision
+ */
+static inline int
+toFixed(double u)
+{
+  return cvRound(u * fixedOne) + (1 << (fractionShift - 1));
+}
+
+/**
+ * @brief Calls pixel(u, v, out) for the pixels of block in warped, stepping
+ * from fixed point positions at the corners of the square of side it was cut
+ * from: top-left, top-right, bottom-left, bottom-right
+ */
+template<typename Pixel>
+static inline void
+stepBlock(Mat& warped,
+          const Rect& block,
+          int side,
+          const int* u,
+          const int* v,
+          const Pixel& pixel)
+{
+  int ul = u[0], vl = v[0];
+  int dul = (u[2] - u[0]) / side, dvl = (v[2] - v[0]) / side;
+  int dur = (u[3] - u[1]) / side, dvr = (v[3] - v[1]) / side;
+  int du = (u[1] - u[0]) / side, dv = (v[1] - v[0]) / side;
+  for (int y = block.y; y < block.y + block.height; y++) {
+    uchar* out = warped.ptr<uchar>(y) + block.x * 3;
+    int uq = ul, vq = vl;
+    for (int x = 0; x < block.width; x++, out += 3) {
+      pixel(uq, vq, out);
+      uq += du;
+      vq += dv;
+    }
+    ul += dul;
+    vl += dvl;
+    du += (dur - dul) / side;
+    dv += (dvr - dvl) / side;
+  }
+}
+
+/**
+ * @brief Fills warped block by block. sample(u, v, out) writes the three BGR
+ * bytes of the painting at fixed point (u, v), which is always inside the
+ * painting; pixels past its edges are faded to black here.
+ */
+template<typename Sample>
+static void
+warpTiles(const TiledImage& painting,
+          const Matx33d& toRoi,
+          Size roiSize,
+          Mat& warped,
+          const Sample& sample)
+{
+  // The sign of m is chosen so the painting itself is in front
+  Matx33d m = toRoi.inv();
+  Size size = painting.size();
+  Vec3d centre = toRoi * Vec3d(size.width / 2.0, size.height / 2.0, 1);
+  if (centre[2] < 0) {
+    m = -m;
+  }
+  const int maxU = (size.width - 1) << fixedBits;
+  const int maxV = (size.height - 1) << fixedBits;
+  const int side = TiledImage::tileSide;
+  int blockRows = (roiSize.height + side - 1) / side;
+  int blockCols = (roiSize.width + side - 1) / side;
+
+  auto draw = [&](int u, int v, uchar* out) {
+    int cu = min(max(u, 0), maxU), cv = min(max(v, 0), maxV);
+    int wx = weightOne - std::abs((u >> fractionShift) - (cu >> fractionShift));
+    int wy = weightOne - std::abs((v >> fractionShift) - (cv >> fractionShift));
+    if (wx <= 0 || wy <= 0) {
+      out[0] = out[1] = out[2] = 0;
+      return;
+    }
+    sample(cu, cv, out);
+    if (wx < weightOne || wy < weightOne) {
+      int coverage = wx * wy, half = 1 << (2 * weightBits - 1);
+      for (int c = 0; c < 3; c++) {
+        out[c] = (uchar)((out[c] * coverage + half) >> (2 * weightBits));
+      }
+    }
+  };
+
+  // Steps positions from the corners of the block of length at (x0, y0), if
+  // the perspective divide is close enough to linear over it, judged at its
+  // centre
+  auto fillLinear = [&](int x0, int y0, int length) {
+    double u[5], v[5];
+    for (int i = 0; i < 5; i++) {
+      int dx = i < 4 ? (i & 1) * length : length / 2;
+      int dy = i < 4 ? (i >> 1) * length : length / 2;
+      if (!project(m, x0 + dx, y0 + dy, u[i], v[i])) {
+        return false;
+      }
+    }
+    const double tolerance = 1.0 / weightOne;
+    if (std::abs((u[0] + u[1] + u[2] + u[3]) / 4 - u[4]) > tolerance ||
+        std::abs((v[0] + v[1] + v[2] + v[3]) / 4 - v[4]) > tolerance) {
+      return false;
+    }
+
+    // A block lies wholly in the painting if its corners do, and wholly
+    // outside if they are all past the same edge
+    int uq[4], vq[4];
+    bool inside = true, left = true, right = true, above = true, below = true;
+    for (int i = 0; i < 4; i++) {
+      uq[i] = toFixed(u[i]);
+      vq[i] = toFixed(v[i]);
+      inside = inside && uq[i] >= 0 && vq[i] >= 0 && uq[i] <= maxU &&
+               vq[i] <= maxV;
+      left = left && uq[i] <= -fixedOne;
+      right = right && uq[i] >= maxU + fixedOne;
+      above = above && vq[i] <= -fixedOne;
+      below = below && vq[i] >= maxV + fixedOne;
+    }
+    Rect block(x0, y0, length, length);
+    block &= Rect(0, 0, roiSize.width, roiSize.height);
+    if (left || right || above || below) {
+      for (int y = block.y; y < block.y + block.height; y++) {
+        memset(warped.ptr<uchar>(y) + block.x * 3, 0, block.width * 3);
+      }
+    } else if (inside) {
+      stepBlock(warped, block, length, uq, vq, sample);
+    } else {
+      stepBlock(warped, block, length, uq, vq, draw);
+    }
+    return true;
+  };
+
+  // Strong perspective is followed in quarter blocks, then pixel by pixel
+  auto fillBlock = [&](int bx, int by) {
+    const int half = side / 2;
+    if (fillLinear(bx * side, by * side, side)) {
+      return;
+    }
+    for (int i = 0; i < 4; i++) {
+      int x0 = bx * side + (i & 1) * half, y0 = by * side + (i >> 1) * half;
+      if (x0 >= roiSize.width || y0 >= roiSize.height ||
+          fillLinear(x0, y0, half)) {
+        continue;
+      }
+      int x1 = min(x0 + half, roiSize.width);
+      int y1 = min(y0 + half, roiSize.height);
+      for (int y = y0; y < y1; y++) {
+        uchar* out = warped.ptr<uchar>(y) + x0 * 3;
+        double X = m(0, 0) * x0 + m(0, 1) * y + m(0, 2);
+        double Y = m(1, 0) * x0 + m(1, 1) * y + m(1, 2);
+        double W = m(2, 0) * x0 + m(2, 1) * y + m(2, 2);
+        for (int x = x0; x < x1; x++, out += 3) {
+          double inverse = W > 0 ? 1.0 / W : 0;
+          double pu = X * inverse, pv = Y * inverse;
+          X += m(0, 0);
+          Y += m(1, 0);
+          W += m(2, 0);
+          if (inverse > 0 && std::abs(pu) < maxCoordinate &&
+              std::abs(pv) < maxCoordinate) {
+            draw(toFixed(pu), toFixed(pv), out);
+          } else {
+            out[0] = out[1] = out[2] = 0;
+          }
+        }
+      }
+    }
+  };
+
+  // Blocks are taken in the order that reads the tiles closest to memory
+  // order, down the columns when the painting is turned on its side
+  bool byColumns = std::abs(m(1, 0)) > std::abs(m(0, 0));
+  int lines = byColumns ? blockCols : blockRows;
+  int blocksPerLine = byColumns ? blockRows : blockCols;
+  parallel_for_(Range(0, lines), [&](const Range& range) {
+    for (int line = range.start; line < range.end; line++) {
+      for (int i = 0; i < blocksPerLine; i++) {
+        if (byColumns) {
+          fillBlock(line, i);
+        } else {
+          fillBlock(i, line);
+        }
+      }
+    }
+  });
+}
+
+/**
+ * @brief Interpolates between four samples with fixed point weights a
+ * (horizontal) and b (vertical)
+ */
+static inline int
+bilinear(int s00, int s10, int s01, int s11, int a, int b)
+{
+  int top = s00 * (weightOne - a) + s10 * a;
+  int bottom = s01 * (weightOne - a) + s11 * a;
+  return (top * (weightOne - b) + bottom * b + (1 << (2 * weightBits - 1))) >>
+         (2 * weightBits);
+}
+
+/**
+ * @brief cv::warpPerspective with INTER_LINEAR and a constant black border,
+ * reading from a tiled painting. Pixels that fall less than a pixel past the
+ * painting's edge are blended with black as warpPerspective does, so the result
+ * matches it to within rounding. Positions are stepped in fixed point across
+ * each 8x8 destination block where that stays within 1/32 pixel of the
+ * perspective divide, which is done per pixel elsewhere. toRoi maps painting
+ * pixels to warped, which is created with roiSize as CV_8UC3 whatever the
+ * painting's format. Blocks are spread over OpenCV's thread pool.
+ */
+void
+warpPerspectiveTiled(const TiledImage& painting,
+                     const Matx33d& toRoi,
+                     Size roiSize,
+                     Mat& warped)
+{
+  warped.create(roiSize, CV_8UC3);
+  if (painting.empty() || roiSize.area() == 0) {
+    warped.setTo(Scalar::all(0));
+    return;
+  }
+
+  // The right and lower neighbours are in the tile's apron, so the four
+  // samples are read at fixed strides from one pointer
+  if (painting.format() == PixelFormat::Bgr) {
+    warpTiles(painting, toRoi, roiSize, warped, [&](int u, int v, uchar* out) {
+      int a = (u >> fractionShift) & (weightOne - 1);
+      int b = (v >> fractionShift) & (weightOne - 1);
+      const uchar* p = painting.at(u >> fixedBits, v >> fixedBits);
+      const uchar* q = p + TiledImage::bgrRowStride;
+      int w11 = a * b, w10 = (a << weightBits) - w11;
+      int w01 = (b << weightBits) - w11;
+      int w00 = weightOne * weightOne - w10 - w01 - w11;
+      const int half = 1 << (2 * weightBits - 1);
+      for (int c = 0; c < 3; c++) {
+        out[c] = (uchar)((p[c] * w00 + p[c + 3] * w10 + q[c] * w01 +
+                          q[c + 3] * w11 + half) >>
+                         (2 * weightBits));
+      }
+    });
+    return;
+  }
+
+  // Luma is interpolated at full resolution and chroma at half, whose
+  // samples sit between the pixels they cover. Only then is the pixel
+  // converted to BGR. Yuv420 tiles have no apron, which would cost a third
+  // more memory, so neighbours are looked up one by one.
+  const int lastX = painting.size().width - 1;
+  const int lastY = painting.size().height - 1;
+  const int lastCx = (painting.size().width + 1) / 2 - 1;
+  const int lastCy = (painting.size().height + 1) / 2 - 1;
+  warpTiles(painting, toRoi, roiSize, warped, [&](int u, int v, uchar* out) {
+    int ix = u >> fixedBits, iy = v >> fixedBits;
+    int a = (u >> fractionShift) & (weightOne - 1);
+    int b = (v >> fractionShift) & (weightOne - 1);
+    int nx = min(ix + 1, lastX), ny = min(iy + 1, lastY);
+    int luma = bilinear(painting.luma(ix, iy),
+                        painting.luma(nx, iy),
+                        painting.luma(ix, ny),
+                        painting.luma(nx, ny),
+                        a,
+                        b);
+
+    int cu = min(max((u - fixedOne / 2) >> 1, 0), lastCx << fixedBits);
+    int cv = min(max((v - fixedOne / 2) >> 1, 0), lastCy << fixedBits);
+    int jx = cu >> fixedBits, jy = cv >> fixedBits;
+    int ca = (cu >> fractionShift) & (weightOne - 1);
+    int cb = (cv >> fractionShift) & (weightOne - 1);
+    int njx = min(jx + 1, lastCx), njy = min(jy + 1, lastCy);
+    const uchar* c00 = painting.chroma(jx, jy);
+    const uchar* c10 = painting.chroma(njx, jy);
+    const uchar* c01 = painting.chroma(jx, njy);
+    const uchar* c11 = painting.chroma(njx, njy);
+    int dCb = bilinear(c00[0], c10[0], c01[0], c11[0], ca, cb) - 128;
+    int dCr = bilinear(c00[16], c10[16], c01[16], c11[16], ca, cb) - 128;
+
+    const int half = 1 << (colourBits - 1);
+    out[0] = saturate_cast<uchar>(luma + ((cbToB * dCb + half) >> colourBits));
+    out[1] = saturate_cast<uchar>(
+      luma + ((crToG * dCr + cbToG * dCb + half) >> colourBits));
+    out[2] = saturate_cast<uchar>(luma + ((crToR * dCr + half) >> colourBits));
+  });
+}
+
+}
@@ -0,0 +1,239 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Play short video loops on markers. Each video is decoded on its own
+ * background thread into a small ring of frames that the render loop pulls
+ * from according to the display clock.
+ */
+
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../include/ar_utils.h"
+#include "../include/video_overlay.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+namespace video_overlay {
+
+// Largest step the playback clock may take between two displayed frames, so a
+// video that was off screen resumes where it left off instead of skipping
+static const double maxPlaybackStep = 0.1;
+
+// How long a video keeps decoding after it was last displayed
+static const chrono::seconds visibleTimeout(1);
+
+/**
+ * @brief Opens the video at path. Its placement on the marker is worked out
+ * from the native aspect ratio and layouts, independent of the resolution it
+ * is decoded at.
+ */
+VideoOverlay::VideoOverlay(const string& path,
+                           const map<string, painting::Layout>& layouts,
+                           float markerLength,
+                           size_t ringSize)
+  : path(path)
+  , ring(max<size_t>(ringSize, 2))
+{
+  if (!capture.open(path) || !capture.read(decoded)) {
+    cerr << "Failed to open video: " << path << endl;
+    return;
+  }
+
+  double reportedFps = capture.get(CAP_PROP_FPS);
+  if (reportedFps > 0) {
+    fps = reportedFps;
+  }
+
+  nativeSize = decoded.size();
+  descriptor = painting::describePainting(
+    fs::path(path).filename().string(), nativeSize, layouts, markerLength);
+  descriptor.version = painting::nextVersion();
+
+  // Until the first placement is known, decode at most at painting resolution
+  int longestSide = max(nativeSize.width, nativeSize.height);
+  double scale = min(1.0, (double)painting::maxPaintingSide / longestSide);
+  decodeSize = Size(cvRound(nativeSize.width * scale),
+                    cvRound(nativeSize.height * scale));
+  resize(decoded, current, decodeSize, 0, 0, INTER_AREA);
+  frameIndex = 1;
+
+  lastRequest = chrono::steady_clock::now() - visibleTimeout;
+  opened = true;
+  decoder = thread(&VideoOverlay::decodeLoop, this);
+}
+
+VideoOverlay::~VideoOverlay()
+{
+  {
+    lock_guard<mutex> lock(ringMutex);
+    stopping = true;
+  }
+  ringChanged.notify_all();
+  if (decoder.joinable()) {
+    decoder.join();
+  }
+}
+
+/**
+ * @brief Returns the frame that should be on screen at displayTime (in
+ * seconds). The reference stays valid until the next call.
+ */
+const Mat&
+VideoOverlay::frameAt(double displayTime)
+{
+  if (lastDisplayTime >= 0) {
+    playbackTime +=
+      min(max(displayTime - lastDisplayTime, 0.0), maxPlaybackStep);
+  }
+  lastDisplayTime = displayTime;
+
+  {
+    lock_guard<mutex> lock(ringMutex);
+    lastRequest = chrono::steady_clock::now();
+
+    // Drop every frame that is already due and keep the newest one
+    while (count > 0 && ring[head].pts <= playbackTime) {
+      cv::swap(current, ring[head].frame);
+      head = (head + 1) % ring.size();
+      count--;
+      shownFrames++;
+    }
+  }
+  ringChanged.notify_one();
+
+  return current;
+}
+
+/**
+ * @brief Tells the decoder how large the video currently is on screen so it
+ * can decode at a matching resolution.
+ */
+void
+VideoOverlay::setTargetSize(Size onScreen)
+{
+  if (!opened || onScreen.area() <= 0) {
+    return;
+  }
+
+  double scale = max(onScreen.width / (double)nativeSize.width,
+                     onScreen.height / (double)nativeSize.height);
+
+  // Quantise to eighths so small pose changes don't resize every frame
+  scale = min(1.0, max(1.0 / 8, ceil(scale * 8) / 8));
+
+  lock_guard<mutex> lock(ringMutex);
+  decodeSize = Size(cvRound(nativeSize.width * scale),
+                    cvRound(nativeSize.height * scale));
+}
+
+/**
+ * @brief True if the render loop asked for a frame recently. Hidden videos
+ * stop decoding once their ring is full. Called with ringMutex held.
+ */
+bool
+VideoOverlay::isVisible() const
+{
+  return chrono::steady_clock::now() - lastRequest < visibleTimeout;
+}
+
+/**
+ * @brief Decodes the next frame, looping back to the start at the end of the
+ * file, and scales it to target.
+ */
+bool
+VideoOverlay::decodeNext(Size target, Mat& frame, double& pts)
+{
+  if (!capture.read(decoded)) {
+    loopOffset += frameIndex / fps;
+    frameIndex = 0;
+    capture.set(CAP_PROP_POS_FRAMES, 0);
+    if (!capture.read(decoded)) {
+      return false;
+    }
+  }
+
+  pts = loopOffset + frameIndex / fps;
+  frameIndex++;
+
+  if (decoded.size() == target) {
+    decoded.copyTo(frame);
+  } else {
+    resize(decoded, frame, target, 0, 0, INTER_AREA);
+  }
+  return true;
+}
+
+/**
+ * @brief Background thread body. Fills free ring slots while the video is
+ * visible and sleeps otherwise.
+ */
+void
+VideoOverlay::decodeLoop()
+{
+  while (true) {
+    size_t writeIndex;
+    Size target;
+    {
+      unique_lock<mutex> lock(ringMutex);
+      ringChanged.wait_for(lock, chrono::milliseconds(100), [this] {
+        return stopping || (count < ring.size() && isVisible());
+      });
+      if (stopping) {
+        return;
+      }
+      if (count == ring.size() || !isVisible()) {
+        continue;
+      }
+
+      // Slots past head + count belong to the decoder until published
+      writeIndex = (head + count) % ring.size();
+      target = decodeSize;
+    }
+
+    Slot& slot = ring[writeIndex];
+    if (!decodeNext(target, slot.frame, slot.pts)) {
+      cerr << "Stopped decoding video: " << path << endl;
+      return;
+    }
+
+    lock_guard<mutex> lock(ringMutex);
+    count++;
+  }
+}
+
+/**
+ * @brief Opens every video found in a directory as a looping exhibit
+ */
+vector<shared_ptr<VideoOverlay>>
+loadVideosFromDirectory(string path, float markerLength)
+{
+  vector<shared_ptr<VideoOverlay>> videos;
+  map<string, painting::Layout> layouts = painting::loadLayouts(path);
+
+  for (const auto& file : fs::directory_iterator(path)) {
+    string filePath = file.path().string();
+    if (!ar_utils::isVideoFile(filePath)) {
+      continue;
+    }
+
+    shared_ptr<VideoOverlay> video =
+      make_shared<VideoOverlay>(filePath, layouts, markerLength);
+    if (video->isOpened()) {
+      cout << "Loaded video: " << filePath << endl;
+      videos.push_back(video);
+    }
+  }
+
+  if (!videos.empty()) {
+    cout << "Number of videos loaded:  " << videos.size() << endl;
+  }
+  return videos;
+}
+
+}
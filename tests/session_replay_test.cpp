@@ -0,0 +1,237 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Records a generated clip of a moving marker into a session, reads
+ * it back and replays it against golden frames. Run with `make test`.
+ */
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "../include/camera_pipeline.h"
+#include "../include/detector_config.h"
+#include "../include/painting.h"
+#include "../include/replay.h"
+#include "../include/session.h"
+
+using namespace std;
+using namespace cv;
+
+namespace fs = std::__fs::filesystem;
+
+// Calibration the clip is posed with, relative to the repository root
+static const string calibrationFile = "bin/calibration.xml";
+
+static const int clipFrames = 12;
+static const int clipMarkerId = 23;
+static const Size clipSize(640, 480);
+
+static int failures = 0;
+
+/**
+ * @brief Reports a failed expectation and keeps going
+ */
+static void
+expect(bool condition, const string& what)
+{
+  if (!condition) {
+    cerr << "FAILED: " << what << endl;
+    failures++;
+  }
+}
+
+/**
+ * @brief Frame index of the clip: a marker with a white margin sliding right
+ * over a grey wall
+ */
+static Mat
+clipFrame(const aruco::Dictionary& dictionary, int index)
+{
+  Mat marker, frame(clipSize, CV_8UC3, Scalar(128, 128, 128));
+  aruco::generateImageMarker(dictionary, clipMarkerId, 120, marker, 1);
+  cvtColor(marker, marker, COLOR_GRAY2BGR);
+  copyMakeBorder(
+    marker, marker, 20, 20, 20, 20, BORDER_CONSTANT, Scalar::all(255));
+  marker.copyTo(frame(Rect(120 + 12 * index, 160, marker.cols, marker.rows)));
+  return frame;
+}
+
+/**
+ * @brief A single generated painting, a colour gradient so a misplaced warp
+ * shows up in the PSNR
+ */
+static camera_pipeline::ExhibitSet
+generatedExhibits(float markerLength)
+{
+  Mat image(240, 180, CV_8UC3);
+  for (int y = 0; y < image.rows; y++) {
+    for (int x = 0; x < image.cols; x++) {
+      image.at<Vec3b>(y, x) = Vec3b((uchar)x, (uchar)y, (uchar)(x + y));
+    }
+  }
+
+  camera_pipeline::ExhibitSet exhibits;
+  painting::Painting generated =
+    painting::describePainting("gradient.png",
+                               image.size(),
+                               map<string, painting::Layout>(),
+                               markerLength);
+  generated.image = image;
+  generated.version = painting::nextVersion();
+  exhibits.paintings.push_back(generated);
+  exhibits.indexMarkers();
+  return exhibits;
+}
+
+/**
+ * @brief Runs the clip through a pipeline and records every frame to path
+ */
+static int
+recordClip(const string& path,
+           const detector_config::DetectorConfig& config,
+           const camera_pipeline::ExhibitSet& exhibits)
+{
+  session::SessionWriter writer;
+  if (!writer.open(path)) {
+    return -1;
+  }
+  camera_pipeline::CameraPipeline camera("record",
+                                         calibrationFile,
+                                         config,
+                                         vector<marker_board::MarkerBoard>(),
+                                         false);
+  camera_pipeline::OverlayFrame overlay;
+  session::FrameRecord record;
+  int framesWithMarker = 0;
+
+  for (int i = 0; i < clipFrames; i++) {
+    double timestamp = 1 + i / 30.0;
+    camera_pipeline::selectExhibit(exhibits, 0, timestamp, false, overlay);
+    camera.processFrame(
+      clipFrame(config.getDictionary(), i), overlay, exhibits, timestamp);
+    camera.latch();
+
+    record.camera = 0;
+    record.exhibit = 0;
+    record.timestamp = timestamp;
+    record.frame = camera.input();
+    record.detections = camera.detections();
+    record.poses = camera.poses();
+    if (!writer.write(record)) {
+      return -1;
+    }
+    if (!record.detections.empty()) {
+      framesWithMarker++;
+    }
+  }
+  writer.close();
+  return framesWithMarker;
+}
+
+/**
+ * @brief Checks that every recorded frame reads back unchanged
+ */
+static void
+checkReadBack(const string& path, const aruco::Dictionary& dictionary)
+{
+  session::SessionReader reader;
+  expect(reader.open(path), "session opens");
+  session::FrameRecord record;
+  int frames = 0;
+  while (reader.read(record)) {
+    Mat expected = clipFrame(dictionary, frames);
+    expect(record.frame.size() == expected.size() &&
+             norm(record.frame, expected, NORM_INF) == 0,
+           "frame " + to_string(frames) + " reads back losslessly");
+    expect(record.timestamp == 1 + frames / 30.0,
+           "frame " + to_string(frames) + " keeps its timestamp");
+    for (const session::MarkerDetection& detection : record.detections) {
+      expect(detection.id == clipMarkerId,
+             "frame " + to_string(frames) + " reads back its marker id");
+    }
+    frames++;
+  }
+  expect(frames == clipFrames, "every recorded frame reads back");
+}
+
+/**
+ * @brief Checks that a record claiming more detections than it holds is
+ * rejected instead of allocated
+ */
+static void
+checkCorruptCount(const string& path, const string& corruptPath)
+{
+  ifstream in(path, ios::binary);
+  vector<char> bytes((istreambuf_iterator<char>(in)),
+                     istreambuf_iterator<char>());
+
+  // The detection count follows the header, the record size, camera,
+  // exhibit, timestamp, PNG size and the PNG itself
+  size_t offset = 8 + 4 + 4 + 4 + 8;
+  uint32_t encodedSize;
+  memcpy(&encodedSize, bytes.data() + offset, sizeof(encodedSize));
+  offset += sizeof(encodedSize) + encodedSize;
+  uint32_t hugeCount = 0x40000000;
+  memcpy(bytes.data() + offset, &hugeCount, sizeof(hugeCount));
+
+  ofstream out(corruptPath, ios::binary | ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  out.close();
+
+  session::SessionReader reader;
+  session::FrameRecord record;
+  expect(reader.open(corruptPath), "corrupt session opens");
+  expect(!reader.read(record), "corrupt detection count is rejected");
+}
+
+int
+main()
+{
+  fs::path directory = fs::temp_directory_path() / "augmuseum_replay_test";
+  fs::remove_all(directory);
+  fs::create_directories(directory);
+  string sessionFile = (directory / "clip.session").string();
+
+  detector_config::DetectorConfig config;
+  camera_pipeline::ExhibitSet exhibits = generatedExhibits(config.markerLength);
+
+  int framesWithMarker = recordClip(sessionFile, config, exhibits);
+  expect(framesWithMarker == clipFrames, "marker detected in every frame");
+  checkReadBack(sessionFile, config.getDictionary());
+  checkCorruptCount(sessionFile, (directory / "corrupt.session").string());
+
+  // The first replay writes the golden frames, the second must match them
+  replay::ReplayOptions options;
+  options.sessionFile = sessionFile;
+  options.goldenDirectory = (directory / "golden").string();
+  options.calibrationFile = calibrationFile;
+  vector<marker_board::MarkerBoard> boards;
+  expect(replay::runReplay(options, config, boards, exhibits) == 0,
+         "first replay records golden frames");
+  expect(replay::runReplay(options, config, boards, exhibits) == 0,
+         "replay matches its golden frames");
+
+  // A golden frame that no longer matches must fail the replay
+  string golden = (directory / "golden" / "frame_000005_camera0.png").string();
+  Mat changed = imread(golden);
+  expect(!changed.empty(), "golden frame written");
+  if (!changed.empty()) {
+    bitwise_not(changed, changed);
+    imwrite(golden, changed);
+    expect(replay::runReplay(options, config, boards, exhibits) == 1,
+           "replay reports a changed golden frame");
+  }
+
+  fs::remove_all(directory);
+  if (failures > 0) {
+    cerr << failures << " check(s) failed" << endl;
+    return 1;
+  }
+  cout << "Session replay test passed" << endl;
+  return 0;
+}
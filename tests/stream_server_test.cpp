@@ -0,0 +1,167 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Connects to the MJPEG server over loopback, reads the multipart
+ * header and one JPEG part and checks it decodes to the published frame. Run
+ * with `make test`.
+ */
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <opencv2/opencv.hpp>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../include/stream_server.h"
+
+using namespace std;
+using namespace cv;
+
+// Ports tried in turn in case one is taken on the test machine
+static const int firstPort = 18730;
+static const int portAttempts = 10;
+
+// How long to wait for the first part before failing
+static const double timeoutSeconds = 5;
+
+static int failures = 0;
+
+/**
+ * @brief Reports a failed expectation and keeps going
+ */
+static void
+expect(bool condition, const string& what)
+{
+  if (!condition) {
+    cerr << "FAILED: " << what << endl;
+    failures++;
+  }
+}
+
+/**
+ * @brief Connects to port on localhost. Returns -1 on failure.
+ */
+static int
+connectLoopback(int port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons((uint16_t)port);
+  inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+  if (fd >= 0 && connect(fd, (sockaddr*)&server, sizeof(server)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Keeps publishing frame while reading the stream from fd until the
+ * response header and one complete part have arrived. Returns the part's JPEG
+ * bytes, or nothing on timeout or a malformed part.
+ */
+static vector<uchar>
+readFirstPart(stream_server::StreamServer& server,
+              int fd,
+              const Mat& frame,
+              string& header)
+{
+  string received;
+  int64 start = getTickCount();
+  while ((getTickCount() - start) / getTickFrequency() < timeoutSeconds) {
+    // Frames are only encoded once a client is watching
+    server.publish(0, frame);
+
+    pollfd incoming = { fd, POLLIN, 0 };
+    if (poll(&incoming, 1, 50) > 0) {
+      char buffer[16384];
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        break;
+      }
+      received.append(buffer, (size_t)n);
+    }
+
+    size_t headerEnd = received.find("\r\n\r\n");
+    if (headerEnd == string::npos) {
+      continue;
+    }
+    header = received.substr(0, headerEnd);
+    size_t partStart = headerEnd + 4;
+    size_t partHeadEnd = received.find("\r\n\r\n", partStart);
+    if (partHeadEnd == string::npos) {
+      continue;
+    }
+    string partHead = received.substr(partStart, partHeadEnd - partStart);
+    size_t length = partHead.find("Content-Length: ");
+    if (partHead.compare(0, 7, "--frame") != 0 || length == string::npos) {
+      break;
+    }
+    size_t size = (size_t)stoul(partHead.substr(length + 16));
+    size_t bodyStart = partHeadEnd + 4;
+    if (received.size() >= bodyStart + size) {
+      return vector<uchar>(received.begin() + bodyStart,
+                           received.begin() + bodyStart + size);
+    }
+  }
+  return vector<uchar>();
+}
+
+int
+main()
+{
+  stream_server::StreamServer server(1);
+  int port = firstPort;
+  while (!server.start(to_string(port)) && port < firstPort + portAttempts) {
+    port++;
+  }
+  expect(server.running(), "server listens on loopback");
+  if (!server.running()) {
+    return 1;
+  }
+
+  Mat frame(240, 320, CV_8UC3);
+  for (int y = 0; y < frame.rows; y++) {
+    for (int x = 0; x < frame.cols; x++) {
+      frame.at<Vec3b>(y, x) = Vec3b((uchar)x, (uchar)y, 128);
+    }
+  }
+
+  int fd = connectLoopback(port);
+  expect(fd >= 0, "client connects");
+  if (fd >= 0) {
+    static const char request[] = "GET /stream/0 HTTP/1.0\r\n\r\n";
+    expect(send(fd, request, sizeof(request) - 1, 0) ==
+             (ssize_t)sizeof(request) - 1,
+           "request sent");
+
+    string header;
+    vector<uchar> jpeg = readFirstPart(server, fd, frame, header);
+    expect(header.compare(0, 15, "HTTP/1.0 200 OK") == 0,
+           "response status is 200");
+    expect(header.find("multipart/x-mixed-replace; boundary=frame") !=
+             string::npos,
+           "response is a multipart stream");
+    expect(!jpeg.empty(), "one JPEG part received");
+
+    Mat decoded = jpeg.empty() ? Mat() : imdecode(jpeg, IMREAD_COLOR);
+    expect(decoded.size() == frame.size(), "part decodes to the frame size");
+    if (decoded.size() == frame.size()) {
+      expect(PSNR(decoded, frame) > 30, "part matches the published frame");
+    }
+    close(fd);
+  }
+
+  server.stop();
+  if (failures > 0) {
+    cerr << failures << " check(s) failed" << endl;
+    return 1;
+  }
+  cout << "Stream server test passed" << endl;
+  return 0;
+}
@@ -0,0 +1,223 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Sample consumer of the frame bus. Follows the newest frames of one
+ * camera, reads them in place and prints throughput, skipped and torn frames
+ * once a second. With --self-test it also runs its own writer on a synthetic
+ * feed, to measure what the bus sustains without a camera.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <thread>
+
+#include "../include/cmdparser.hpp"
+#include "../include/frame_bus.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * @brief Configures the parameters being passed in through the command line.
+ */
+void
+configureParser(cli::Parser& parser)
+{
+  parser.set_optional<string>(
+    "n", "name", "/augmuseum", "Shared memory name given to --frame-bus");
+  parser.set_optional<int>("cam", "camera", 0, "Camera to follow");
+  parser.set_optional<bool>("raw",
+                            "raw",
+                            false,
+                            "If true, follows the camera frames instead of "
+                            "the composited ones");
+  parser.set_optional<int>(
+    "s", "seconds", 10, "How long to run before printing totals and exiting");
+  parser.set_optional<string>(
+    "o",
+    "snapshot",
+    "",
+    "Writes the first frame read to this image file, with the detected "
+    "markers outlined");
+  parser.set_optional<bool>("st",
+                            "self-test",
+                            false,
+                            "If true, publishes a synthetic 1280x720 feed "
+                            "on a private bus and reads it back as fast as "
+                            "possible");
+}
+
+/**
+ * @brief Publishes a moving synthetic frame for every camera and kind as fast
+ * as the bus takes it, until stop is set
+ */
+static void
+produce(frame_bus::FrameBus& bus,
+        atomic<bool>& stop,
+        atomic<uint64_t>& published)
+{
+  Mat frame(720, 1280, CV_8UC3);
+  randu(frame, Scalar::all(0), Scalar::all(255));
+  vector<session::MarkerDetection> detections(1);
+  detections[0].id = 7;
+  vector<session::TrackedPose> poses(1);
+  poses[0] = { 7, 1, Vec3d(0, 0, 0), Vec3d(0, 0, 800) };
+
+  auto start = chrono::steady_clock::now();
+  while (!stop) {
+    double now =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    frame.at<Vec3b>(0, 0)[0]++;
+    bus.publish(0, frame_bus::RawFrame, frame, now, detections, poses);
+    bus.publish(0, frame_bus::CompositedFrame, frame, now, detections, poses);
+    published += 2;
+  }
+}
+
+/**
+ * @brief Follows the newest frames of a camera and prints throughput
+ */
+int
+main(int argc, char* argv[])
+{
+  cli::Parser parser(argc, argv);
+  configureParser(parser);
+  parser.run_and_exit_if_error();
+
+  string name = parser.get<string>("n");
+  uint32_t camera = (uint32_t)parser.get<int>("cam");
+  uint32_t kind =
+    parser.get<bool>("raw") ? frame_bus::RawFrame : frame_bus::CompositedFrame;
+  double seconds = parser.get<int>("s");
+  string snapshot = parser.get<string>("o");
+
+  // The self-test owns the bus and feeds it from a second thread
+  frame_bus::FrameBus bus;
+  atomic<bool> stop(false);
+  atomic<uint64_t> published(0);
+  thread producer;
+  if (parser.get<bool>("st")) {
+    name = "/augmuseum_selftest";
+    camera = 0;
+    if (!bus.open(name, 8, 1280 * 720 * 3)) {
+      return -1;
+    }
+    producer = thread(produce, ref(bus), ref(stop), ref(published));
+  }
+
+  frame_bus::FrameBusReader reader;
+  if (!reader.open(name)) {
+    stop = true;
+    if (producer.joinable()) {
+      producer.join();
+    }
+    return -1;
+  }
+
+  uint64_t frames = 0, bytes = 0, skipped = 0, torn = 0;
+  uint64_t intervalFrames = 0, intervalBytes = 0;
+  uint64_t last = reader.latest();
+  double checksum = 0;
+  auto start = chrono::steady_clock::now();
+  auto intervalStart = start;
+  while (true) {
+    auto now = chrono::steady_clock::now();
+    if (chrono::duration<double>(now - start).count() >= seconds) {
+      break;
+    }
+    if (chrono::duration<double>(now - intervalStart).count() >= 1) {
+      double interval = chrono::duration<double>(now - intervalStart).count();
+      cout << fixed << setprecision(1) << setw(8)
+           << intervalFrames / interval << " frames/s" << setw(10)
+           << intervalBytes / interval / (1 << 20) << " MiB/s" << endl;
+      intervalFrames = intervalBytes = 0;
+      intervalStart = now;
+    }
+
+    uint64_t newest = reader.latest();
+    if (newest == last) {
+      this_thread::sleep_for(chrono::microseconds(200));
+      continue;
+    }
+
+    // Frames the writer has already come round to again are gone
+    uint64_t oldest = newest > reader.slotCount() ? newest - reader.slotCount()
+                                                  : 0;
+    if (last < oldest) {
+      skipped += oldest - last;
+      last = oldest;
+    }
+
+    for (uint64_t sequence = last + 1; sequence <= newest; sequence++) {
+      const frame_bus::SlotHeader* slot = reader.slot(sequence);
+      if (!slot) {
+        skipped++;
+        continue;
+      }
+      if (slot->camera != camera || slot->kind != kind) {
+        continue;
+      }
+
+      // Read in place, as analytics would: no copy out of the bus
+      Mat image = reader.image(slot);
+      double sum = cv::sum(image)[0];
+      if (!snapshot.empty()) {
+        Mat shot;
+        if (image.type() == CV_8UC2) {
+          cvtColor(image, shot, COLOR_YUV2BGR_YUYV);
+        } else {
+          shot = image.clone();
+        }
+        for (uint32_t i = 0; i < slot->detectionCount; i++) {
+          Point outline[4];
+          for (int k = 0; k < 4; k++) {
+            outline[k] = Point(cvRound(slot->detections[i].corners[2 * k]),
+                               cvRound(slot->detections[i].corners[2 * k + 1]));
+          }
+          polylines(shot,
+                    vector<Point>(outline, outline + 4),
+                    true,
+                    Scalar(0, 255, 0),
+                    2);
+        }
+        if (reader.valid(slot, sequence)) {
+          imwrite(snapshot, shot);
+          cout << "Wrote " << snapshot << endl;
+          snapshot.clear();
+        }
+      }
+
+      if (!reader.valid(slot, sequence)) {
+        torn++;
+        continue;
+      }
+      checksum += sum;
+      frames++;
+      intervalFrames++;
+      bytes += slot->bytes;
+      intervalBytes += slot->bytes;
+    }
+    last = newest;
+  }
+
+  stop = true;
+  if (producer.joinable()) {
+    producer.join();
+  }
+
+  double elapsed =
+    chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "Read " << frames << " frames (" << bytes / (1 << 20) << " MiB) in "
+       << setprecision(1) << elapsed << " s: " << frames / elapsed
+       << " frames/s, " << bytes / elapsed / (1 << 20) << " MiB/s" << endl;
+  cout << "Skipped " << skipped << ", torn " << torn << endl;
+  if (published > 0) {
+    cout << "Published " << published << " frames: "
+         << published / elapsed << " frames/s" << endl;
+  }
+  cout << "Checksum " << setprecision(0) << checksum << endl;
+  return 0;
+}
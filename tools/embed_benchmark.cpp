@@ -0,0 +1,179 @@
+/**
+ * Author: Kevin Heleodoro
+ * Date: April 3, 2024
+ * Purpose: Sample host of the engine library and a measure of what embedding
+ * costs. Composites a synthetic frame with one marker through the C++ engine
+ * and through the C API, in place and through a copy, and prints the time of
+ * each per call.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+#include "../include/augmuseum.h"
+#include "../include/cmdparser.hpp"
+#include "../include/detector_config.h"
+#include "../include/engine.h"
+
+using namespace std;
+using namespace cv;
+
+static const int warmupIterations = 5;
+
+/**
+ * @brief Configures the parameters being passed in through the command line.
+ */
+void
+configureParser(cli::Parser& parser)
+{
+  parser.set_optional<string>(
+    "p", "path", "bin/paintings", "Directory containing the paintings");
+  parser.set_optional<string>(
+    "c", "calibration", "bin/calibration.xml", "Camera calibration file");
+  parser.set_optional<string>("dc",
+                              "detector-config",
+                              "bin/detector_config.yml",
+                              "Dictionary, marker size and detector "
+                              "parameters");
+  parser.set_optional<int>(
+    "n", "iterations", 200, "Calls timed for each way of compositing");
+}
+
+/**
+ * @brief A 1280x720 noise frame with marker 0 of the dictionary in the
+ * middle, on a white quiet zone
+ */
+static Mat
+syntheticFrame(const detector_config::DetectorConfig& config)
+{
+  Mat frame(720, 1280, CV_8UC3);
+  randu(frame, Scalar::all(0), Scalar::all(255));
+  Mat marker, markerBgr;
+  aruco::generateImageMarker(config.getDictionary(), 0, 200, marker, 1);
+  cvtColor(marker, markerBgr, COLOR_GRAY2BGR);
+  frame(Rect(520, 240, 240, 240)).setTo(Scalar::all(255));
+  markerBgr.copyTo(frame(Rect(540, 260, 200, 200)));
+  return frame;
+}
+
+/**
+ * @brief Milliseconds per call of body, after a warmup
+ */
+template<typename Body>
+static double
+timePerCall(int iterations, Body body)
+{
+  TickMeter timer;
+  for (int i = -warmupIterations; i < iterations; i++) {
+    if (i == 0) {
+      timer.start();
+    }
+    body();
+  }
+  timer.stop();
+  return timer.getTimeMilli() / iterations;
+}
+
+/**
+ * @brief Prints one line of the results table
+ */
+static void
+printResult(const string& label, double perCall, double restore)
+{
+  cout << left << setw(36) << label << right << fixed << setprecision(3)
+       << setw(10) << perCall - restore << " ms/call" << endl;
+}
+
+/**
+ * @brief Composites the same frame every way the library offers and prints
+ * the time per call. Every call starts from a fresh copy of the frame, since
+ * the last call drew over the marker; that copy is timed on its own and
+ * left out of the results.
+ */
+int
+main(int argc, char* argv[])
+{
+  cli::Parser parser(argc, argv);
+  configureParser(parser);
+  parser.run_and_exit_if_error();
+  string paintings = parser.get<string>("p");
+  string calibration = parser.get<string>("c");
+  string detectorConfigFile = parser.get<string>("dc");
+  int iterations = max(parser.get<int>("n"), 1);
+
+  engine::EngineOptions options;
+  options.paintingDirectory = paintings;
+  detector_config::loadDetectorConfig(detectorConfigFile,
+                                      options.detectorConfig);
+  engine::Engine direct;
+  if (!direct.open(options)) {
+    return -1;
+  }
+  int camera = direct.addCamera("embed_cpp", calibration);
+
+  augmuseum_options cOptions;
+  augmuseum_default_options(&cOptions);
+  cOptions.painting_directory = paintings.c_str();
+  cOptions.detector_config = detectorConfigFile.c_str();
+  augmuseum_context* context = augmuseum_create(&cOptions);
+  if (!context) {
+    return -1;
+  }
+  int cCamera = augmuseum_add_camera(context, "embed_c", calibration.c_str());
+
+  Mat source = syntheticFrame(options.detectorConfig);
+  Mat frame = source.clone(), copy, bgra, sourceBgra;
+  cvtColor(source, sourceBgra, COLOR_BGR2BGRA);
+  bgra = sourceBgra.clone();
+
+  frame.copyTo(copy);
+  if (direct.composite(camera, copy).area() == 0) {
+    cerr << "The marker in the synthetic frame was not found" << endl;
+    augmuseum_destroy(context);
+    return -1;
+  }
+
+  augmuseum_frame cFrame = {
+    frame.data, frame.cols, frame.rows, frame.step, AUGMUSEUM_FORMAT_BGR24, 0
+  };
+  augmuseum_frame cBgra = {
+    bgra.data, bgra.cols, bgra.rows, bgra.step, AUGMUSEUM_FORMAT_BGRA32, 0
+  };
+
+  cout << "Embedding benchmark: " << iterations << " calls, " << frame.cols
+       << "x" << frame.rows << " frame with one marker" << endl;
+  double restore = timePerCall(iterations, [&] { source.copyTo(frame); });
+  double restoreBgra =
+    timePerCall(iterations, [&] { sourceBgra.copyTo(bgra); });
+
+  double inPlace = timePerCall(iterations, [&] {
+    source.copyTo(frame);
+    direct.composite(camera, frame);
+  });
+  double copied = timePerCall(iterations, [&] {
+    source.copyTo(frame);
+    frame.copyTo(copy);
+    direct.composite(camera, copy);
+    copy.copyTo(frame);
+  });
+  double cApi = timePerCall(iterations, [&] {
+    source.copyTo(frame);
+    augmuseum_composite(context, cCamera, &cFrame);
+  });
+  double cApiBgra = timePerCall(iterations, [&] {
+    sourceBgra.copyTo(bgra);
+    augmuseum_composite(context, cCamera, &cBgra);
+  });
+
+  printResult("C++ engine, in place", inPlace, restore);
+  printResult("C++ engine, copied in and out", copied, restore);
+  printResult("C API, BGR24 in place", cApi, restore);
+  printResult("C API, BGRA32 via BGR copy", cApiBgra, restoreBgra);
+  cout << "C API overhead: " << setprecision(3) << (cApi - inPlace) * 1000
+       << " us/call, copying in and out: " << (copied - inPlace) * 1000
+       << " us/call" << endl;
+
+  augmuseum_destroy(context);
+  return 0;
+}